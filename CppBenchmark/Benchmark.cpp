@@ -0,0 +1,352 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <map>
+#include <cmath>
+#include <ctime>
+
+BenchmarkState::BenchmarkState(const BenchmarkSettings& settings, const int64_t argument)
+	: _settings(settings), _argument(argument), _iteration(0), _pausedNs(0), _measuredNs(0), _itemsPerIteration(1)
+{
+}
+
+bool BenchmarkState::KeepRunning()
+{
+	const Clock::time_point now = Clock::now();
+
+	if (_iteration > 0 && !IsWarmingUp())
+	{
+		const int64_t elapsed = GetNanoseconds(_iterationBegin, now) - _pausedNs;
+		_samples.emplace_back(elapsed);
+		_measuredNs += elapsed;
+	}
+
+	const uint64_t sampleCount = _samples.size();
+	const bool hasMinIterations = sampleCount >= _settings.minIterations;
+	const bool hasMinTime = _measuredNs >= _settings.minTimeSeconds * 1e9;
+	if ((hasMinIterations && hasMinTime) || sampleCount >= _settings.maxIterations)
+		return false;
+
+	_iteration++;
+	_pausedNs = 0;
+	_iterationBegin = Clock::now();
+
+	return true;
+}
+
+void BenchmarkState::PauseTiming()
+{
+	_pauseBegin = Clock::now();
+}
+
+void BenchmarkState::ResumeTiming()
+{
+	_pausedNs += GetNanoseconds(_pauseBegin, Clock::now());
+}
+
+void BenchmarkState::RecordStage(const std::string& stage, const int64_t nanoseconds)
+{
+	if (IsWarmingUp())
+		return;
+
+	auto stageSamples = std::find_if(_stageSamples.begin(), _stageSamples.end(),
+		[&stage](const std::pair<std::string, std::vector<int64_t>>& entry) { return entry.first == stage; });
+	if (stageSamples == _stageSamples.end())
+	{
+		_stageSamples.emplace_back(stage, std::vector<int64_t>());
+		stageSamples = _stageSamples.end() - 1;
+	}
+
+	stageSamples->second.emplace_back(nanoseconds);
+}
+
+int64_t BenchmarkState::GetArgument() const
+{
+	return _argument;
+}
+
+bool BenchmarkState::IsWarmingUp() const
+{
+	return _iteration <= (uint64_t)_settings.warmupIterations;
+}
+
+void BenchmarkState::SetItemsPerIteration(const double items)
+{
+	_itemsPerIteration = items;
+}
+
+void BenchmarkState::SetLabel(const std::string& label)
+{
+	_label = label;
+}
+
+BenchmarkResult BenchmarkState::GetResult(const std::string& name) const
+{
+	BenchmarkResult result;
+	result.time = GetStats(name, _samples);
+	result.itemsPerIteration = _itemsPerIteration;
+	result.label = _label;
+
+	for (const auto& stageSamples : _stageSamples)
+		result.stages.emplace_back(GetStats(stageSamples.first, stageSamples.second));
+
+	return result;
+}
+
+int64_t BenchmarkState::GetNanoseconds(const Clock::time_point& begin, const Clock::time_point& end)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+}
+
+SampleStats BenchmarkState::GetStats(const std::string& name, std::vector<int64_t> samples)
+{
+	SampleStats stats = {};
+	stats.name = name;
+	stats.count = samples.size();
+	if (samples.empty())
+		return stats;
+
+	std::sort(samples.begin(), samples.end());
+
+	// nearest-rank percentiles
+	const auto getPercentile = [&samples](const double percentile)
+	{
+		const size_t rank = (size_t)std::ceil(percentile / 100 * samples.size());
+		return (double)samples[std::max<size_t>(rank, 1) - 1];
+	};
+
+	stats.minNs = (double)samples.front();
+	stats.meanNs = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+	stats.p50Ns = getPercentile(50);
+	stats.p95Ns = getPercentile(95);
+	stats.p99Ns = getPercentile(99);
+	stats.maxNs = (double)samples.back();
+
+	return stats;
+}
+
+BenchmarkRunner::BenchmarkRunner(const BenchmarkSettings& settings)
+	: _settings(settings)
+{
+}
+
+void BenchmarkRunner::Add(const std::string& name, const BenchmarkFunction& function, const std::vector<int64_t>& arguments)
+{
+	if (arguments.empty())
+	{
+		_benchmarks.push_back({ name, function, 0 });
+		return;
+	}
+
+	for (const int64_t argument : arguments)
+		_benchmarks.push_back({ name + "/" + std::to_string(argument), function, argument });
+}
+
+std::vector<BenchmarkResult> BenchmarkRunner::Run() const
+{
+	std::vector<BenchmarkResult> results;
+
+	for (const RegisteredBenchmark& benchmark : _benchmarks)
+	{
+		if (benchmark.name.find(_settings.filter) == std::string::npos)
+			continue;
+
+		std::cout << "running " << benchmark.name << "..." << std::endl;
+
+		BenchmarkState state(_settings, benchmark.argument);
+		benchmark.function(state);
+		const BenchmarkResult& result = state.GetResult(benchmark.name);
+
+		// a benchmark that cannot run (missing model, too little memory) returns before its loop
+		if (result.time.count == 0)
+		{
+			std::cout << "skipped " << benchmark.name << std::endl;
+			continue;
+		}
+
+		results.emplace_back(result);
+	}
+
+	return results;
+}
+
+void BenchmarkRunner::PrintResults(const std::vector<BenchmarkResult>& results)
+{
+	std::cout << std::endl;
+	std::cout << std::left << std::setw(40) << "benchmark" << std::right << std::setw(10) << "iters" << std::setw(12) << "mean"
+		<< std::setw(12) << "p50" << std::setw(12) << "p95" << std::setw(12) << "p99" << std::setw(12) << "per item" << std::endl;
+
+	for (const BenchmarkResult& result : results)
+	{
+		PrintStats(result.time, result.itemsPerIteration, result.label, false);
+		for (const SampleStats& stage : result.stages)
+			PrintStats(stage, 1, "", true);
+	}
+
+	std::cout << std::endl;
+}
+
+bool BenchmarkRunner::SaveJson(const std::vector<BenchmarkResult>& results, const std::string& filepath)
+{
+	std::ofstream file(filepath);
+	if (!file.is_open())
+	{
+		std::cout << "failed to open " << filepath << " for writing" << std::endl;
+		return false;
+	}
+
+	const std::time_t now = std::time(nullptr);
+	char date[32];
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+#ifdef NDEBUG
+	const std::string buildType = "release";
+#else
+	const std::string buildType = "debug";
+#endif
+
+	file << "{" << std::endl;
+	file << "\"context\": {\"date\": \"" << date << "\", \"build\": \"" << buildType << "\", \"hardwareConcurrency\": "
+		<< std::thread::hardware_concurrency() << "}," << std::endl;
+	file << "\"benchmarks\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& result = results[i];
+		file << "{" << GetStatsJson(result.time) << ", \"itemsPerIteration\": " << result.itemsPerIteration
+			<< ", \"label\": \"" << EscapeJson(result.label) << "\", \"stages\": [";
+		for (size_t j = 0; j < result.stages.size(); j++)
+			file << (j > 0 ? ", " : "") << "{" << GetStatsJson(result.stages[j]) << "}";
+		file << "]}" << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	file << "]" << std::endl;
+	file << "}" << std::endl;
+
+	return file.good();
+}
+
+bool BenchmarkRunner::CompareWithBaseline(const std::vector<BenchmarkResult>& results, const std::string& baselineFilepath)
+{
+	std::ifstream file(baselineFilepath);
+	if (!file.is_open())
+	{
+		std::cout << "failed to open baseline " << baselineFilepath << std::endl;
+		return false;
+	}
+
+	// every benchmark is a line of its own, its first name and p50Ns belong to the benchmark and not to its stages
+	std::map<std::string, double> baselineMedians;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::string name;
+		double median;
+		if (ReadJsonString(line, "name", &name) && ReadJsonNumber(line, "p50Ns", &median))
+			baselineMedians[name] = median;
+	}
+
+	std::cout << "p50 against " << baselineFilepath << ":" << std::endl;
+	for (const BenchmarkResult& result : results)
+	{
+		const auto baselineMedian = baselineMedians.find(result.time.name);
+		std::cout << std::left << std::setw(40) << result.time.name << std::right;
+		if (baselineMedian == baselineMedians.end() || baselineMedian->second <= 0)
+		{
+			std::cout << std::setw(12) << FormatTime(result.time.p50Ns) << "  (new)" << std::endl;
+			continue;
+		}
+
+		const double change = (result.time.p50Ns / baselineMedian->second - 1) * 100;
+		std::cout << std::setw(12) << FormatTime(baselineMedian->second) << " -> " << std::setw(12) << FormatTime(result.time.p50Ns)
+			<< std::showpos << std::fixed << std::setprecision(1) << std::setw(9) << change << "%" << std::noshowpos
+			<< std::defaultfloat << std::endl;
+	}
+	std::cout << std::endl;
+
+	return true;
+}
+
+void BenchmarkRunner::PrintStats(const SampleStats& stats, const double itemsPerIteration, const std::string& label,
+	const bool isStage)
+{
+	std::cout << std::left << std::setw(40) << ((isStage ? "  " : "") + stats.name) << std::right << std::setw(10) << stats.count
+		<< std::setw(12) << FormatTime(stats.meanNs) << std::setw(12) << FormatTime(stats.p50Ns)
+		<< std::setw(12) << FormatTime(stats.p95Ns) << std::setw(12) << FormatTime(stats.p99Ns)
+		<< std::setw(12) << (itemsPerIteration > 1 ? FormatTime(stats.meanNs / itemsPerIteration) : "");
+	if (!label.empty())
+		std::cout << "  " << label;
+	std::cout << std::endl;
+}
+
+std::string BenchmarkRunner::FormatTime(const double nanoseconds)
+{
+	std::ostringstream stream;
+	stream << std::fixed << std::setprecision(nanoseconds < 1000 ? 0 : 2);
+	if (nanoseconds < 1000)
+		stream << nanoseconds << " ns";
+	else if (nanoseconds < 1000000)
+		stream << nanoseconds / 1000 << " us";
+	else if (nanoseconds < 1000000000)
+		stream << nanoseconds / 1000000 << " ms";
+	else
+		stream << nanoseconds / 1000000000 << " s";
+
+	return stream.str();
+}
+
+std::string BenchmarkRunner::GetStatsJson(const SampleStats& stats)
+{
+	std::ostringstream stream;
+	stream << std::fixed << std::setprecision(1);
+	stream << "\"name\": \"" << EscapeJson(stats.name) << "\", \"iterations\": " << stats.count << ", \"minNs\": " << stats.minNs
+		<< ", \"meanNs\": " << stats.meanNs << ", \"p50Ns\": " << stats.p50Ns << ", \"p95Ns\": " << stats.p95Ns
+		<< ", \"p99Ns\": " << stats.p99Ns << ", \"maxNs\": " << stats.maxNs;
+
+	return stream.str();
+}
+
+std::string BenchmarkRunner::EscapeJson(const std::string& text)
+{
+	std::string escaped;
+	escaped.reserve(text.size());
+	for (const char c : text)
+	{
+		if (c == '"' || c == '\\')
+			escaped += '\\';
+		escaped += c;
+	}
+
+	return escaped;
+}
+
+bool BenchmarkRunner::ReadJsonNumber(const std::string& line, const std::string& key, double* value)
+{
+	const std::string& pattern = "\"" + key + "\": ";
+	const size_t position = line.find(pattern);
+	if (position == std::string::npos)
+		return false;
+
+	*value = std::atof(line.c_str() + position + pattern.size());
+
+	return true;
+}
+
+bool BenchmarkRunner::ReadJsonString(const std::string& line, const std::string& key, std::string* value)
+{
+	const std::string& pattern = "\"" + key + "\": \"";
+	const size_t begin = line.find(pattern);
+	if (begin == std::string::npos)
+		return false;
+
+	const size_t end = line.find('"', begin + pattern.size());
+	if (end == std::string::npos)
+		return false;
+
+	*value = line.substr(begin + pattern.size(), end - begin - pattern.size());
+
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+struct BenchmarkSettings
+{
+	std::string filter; // only benchmarks whose name contains it are run
+	int warmupIterations = 3;
+	uint64_t minIterations = 10;
+	uint64_t maxIterations = 1000000;
+	double minTimeSeconds = 0.5;
+};
+
+struct SampleStats
+{
+	std::string name;
+	uint64_t count;
+	double minNs;
+	double meanNs;
+	double p50Ns;
+	double p95Ns;
+	double p99Ns;
+	double maxNs;
+};
+
+struct BenchmarkResult
+{
+	SampleStats time; // per iteration
+	double itemsPerIteration;
+	std::string label;
+	std::vector<SampleStats> stages;
+};
+
+// Passed to every benchmark function, which runs the measured code in a `while (state.KeepRunning())` loop.
+// Every iteration is timed on its own, so the results carry percentiles and not only a mean; the first warmupIterations
+// are run but not recorded. Code that should not count (input generation, checks) goes before the loop or between
+// PauseTiming() and ResumeTiming().
+class BenchmarkState
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	const BenchmarkSettings& _settings;
+	const int64_t _argument;
+	uint64_t _iteration;
+	Clock::time_point _iterationBegin;
+	Clock::time_point _pauseBegin;
+	int64_t _pausedNs;
+	int64_t _measuredNs;
+	std::vector<int64_t> _samples;
+	std::vector<std::pair<std::string, std::vector<int64_t>>> _stageSamples;
+	double _itemsPerIteration;
+	std::string _label;
+
+public:
+	BenchmarkState(const BenchmarkSettings& settings, const int64_t argument);
+
+	bool KeepRunning();
+	void PauseTiming();
+	void ResumeTiming();
+
+	// adds the time of one part of the iteration, so a multi-stage benchmark reports each stage separately
+	void RecordStage(const std::string& stage, const int64_t nanoseconds);
+
+	int64_t GetArgument() const;
+	bool IsWarmingUp() const;
+	// faces, candidates or probes handled by one iteration, used for the per-item time
+	void SetItemsPerIteration(const double items);
+	void SetLabel(const std::string& label);
+
+	BenchmarkResult GetResult(const std::string& name) const;
+
+	static int64_t GetNanoseconds(const Clock::time_point& begin, const Clock::time_point& end);
+	static SampleStats GetStats(const std::string& name, std::vector<int64_t> samples);
+};
+
+// Runs registered benchmarks one after another and reports them as a table or as JSON. The JSON holds one benchmark per
+// line with stable names, so the output of two commits can be compared with --baseline or any line-based tool.
+class BenchmarkRunner
+{
+public:
+	typedef std::function<void(BenchmarkState&)> BenchmarkFunction;
+
+private:
+	struct RegisteredBenchmark
+	{
+		std::string name;
+		BenchmarkFunction function;
+		int64_t argument;
+	};
+
+	const BenchmarkSettings _settings;
+	std::vector<RegisteredBenchmark> _benchmarks;
+
+public:
+	BenchmarkRunner(const BenchmarkSettings& settings);
+
+	// registers one benchmark per argument, named name/argument
+	void Add(const std::string& name, const BenchmarkFunction& function, const std::vector<int64_t>& arguments = {});
+
+	std::vector<BenchmarkResult> Run() const;
+
+	static void PrintResults(const std::vector<BenchmarkResult>& results);
+	static bool SaveJson(const std::vector<BenchmarkResult>& results, const std::string& filepath);
+	// prints the median of every benchmark against the same benchmark in a JSON file written by an earlier run
+	static bool CompareWithBaseline(const std::vector<BenchmarkResult>& results, const std::string& baselineFilepath);
+
+private:
+	static void PrintStats(const SampleStats& stats, const double itemsPerIteration, const std::string& label, const bool isStage);
+	static std::string FormatTime(const double nanoseconds);
+	static std::string GetStatsJson(const SampleStats& stats);
+	static std::string EscapeJson(const std::string& text);
+	static bool ReadJsonNumber(const std::string& line, const std::string& key, double* value);
+	static bool ReadJsonString(const std::string& line, const std::string& key, std::string* value);
+};
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Benchmark.h"
+#include "OrtUtils.h"
+
+struct ModelBenchmarkConfig
+{
+	std::string detectorModelFilepath;
+	std::string indexerModelFilepath;
+	std::string genderAgeModelFilepath;
+	std::string imageFilepath; // a real photo for the detection and frame benchmarks, noise is used when it is missing
+	InferenceOptions inferenceOptions;
+};
+
+// preprocessing, NMS, alignment, normalization, comparison and gallery search on synthetic data;
+// galleries go from 1k rows up to maxGalleryRowCount (10M rows of fp32 need about 40 GB while they are generated);
+// QuantizedSearch labels the top-1 agreement and recall of fp16 and int8 with float32 on a clustered 100k gallery,
+// AnnSearch compares HNSW searches at several efSearch values with an exact scan of a clustered 20k gallery and labels their recall
+void AddCpuBenchmarks(BenchmarkRunner& runner, const size_t maxGalleryRowCount);
+
+// detection, indexing and gender/age on the ONNX models, skipped for models that are missing;
+// IndexerPool serves a caller per core from one indexer with all cores or from one single-threaded indexer per core,
+// DetectionPass compares full size, reduced size and region detection on the same frame,
+// DetectionBatcher has several callers share one detector through DetectionBatcher at batch sizes 1 and 4;
+// the Frame benchmark runs the whole single-image flow and reports its stages, Pipeline the same flow through FacePipeline
+void AddModelBenchmarks(BenchmarkRunner& runner, Ort::Env& env, const ModelBenchmarkConfig& config);
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "Benchmarks.h"
+#include "SyntheticData.h"
+#include "ImagePreprocessor.h"
+#include "NonMaxSuppressor.h"
+#include "Umeyama.h"
+#include "ArcFaceNormalizer.h"
+#include "FaceComparer.h"
+#include "GallerySearcher.h"
+#include "HnswIndex.h"
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+namespace
+{
+	const cv::Size frameSize(1920, 1080);
+	const cv::Size uhdFrameSize(3840, 2160);
+	const int indexSize = 512;
+	const float overlapThreshold = 0.4f;
+	const int candidatesPerFace = 8;
+	const int maxMatchCount = 5;
+	const int pairCount = 1000;
+	const int annRowCount = 20000;
+	const int annProbeCount = 100;
+	const int annMaxMatchCount = 10;
+	const int quantizationRowCount = 100000;
+	const int quantizationProbeCount = 200;
+	const int quantizationMaxMatchCount = 10;
+
+	// identities around cluster centers, probes of the same clusters and their exact top-k;
+	// uniform noise has no neighbourhoods for an approximate index to find
+	struct ClusteredGallery
+	{
+		FaceGallery gallery;
+		std::vector<FaceIndex> indexes;
+		std::vector<FaceIndex> probes;
+		std::vector<std::vector<GalleryMatch>> exactMatches;
+	};
+
+	struct AnnFixture
+	{
+		std::unique_ptr<ClusteredGallery> clusteredGallery;
+		HnswIndex index;
+		int64_t buildNs;
+	};
+
+	void BenchmarkPreprocessing(BenchmarkState& state)
+	{
+		const int inputWidth = (int)state.GetArgument();
+		const cv::Mat& image = CreateSyntheticImage(frameSize);
+		ImagePreprocessor preprocessor(cv::Size(inputWidth, inputWidth));
+		std::vector<float> tensor(3 * inputWidth * inputWidth);
+		float scaleFactor;
+
+		while (state.KeepRunning())
+			preprocessor.Prepare(image, tensor.data(), &scaleFactor);
+	}
+
+	std::vector<int> GetReferenceIndexes(const std::vector<cv::Rect2f>& boxes, const std::vector<float>& scores)
+	{
+		std::vector<int> order(boxes.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&scores](int i1, int i2) { return scores[i1] > scores[i2]; });
+
+		std::vector<cv::Rect2f> boxesSortedByScore;
+		boxesSortedByScore.reserve(boxes.size());
+		for (const int index : order)
+			boxesSortedByScore.emplace_back(boxes[index]);
+
+		std::vector<int> referenceIndexes = NonMaxSuppressor::ApplyReference(boxesSortedByScore, overlapThreshold);
+		for (int& index : referenceIndexes)
+			index = order[index];
+
+		return referenceIndexes;
+	}
+
+	void BenchmarkNms(BenchmarkState& state, const NmsMethod method)
+	{
+		std::mt19937 generator(42);
+		const std::vector<Face>& faces = CreateSyntheticFaces((int)state.GetArgument(), frameSize, generator);
+		std::vector<cv::Rect2f> boxes;
+		std::vector<float> scores;
+		CreateDetectionCandidates(faces, frameSize, candidatesPerFace, generator, &boxes, &scores);
+
+		NonMaxSuppressor nms(method);
+		while (state.KeepRunning())
+			nms.Apply(boxes, scores, overlapThreshold);
+
+		const std::vector<int>& keptIndexes = nms.Apply(boxes, scores, overlapThreshold);
+		const bool matchesReference = keptIndexes == GetReferenceIndexes(boxes, scores);
+		state.SetItemsPerIteration((double)boxes.size());
+		state.SetLabel("kept " + std::to_string(keptIndexes.size()) + (matchesReference ? "" : " (MISMATCH)"));
+	}
+
+	void BenchmarkReferenceNms(BenchmarkState& state)
+	{
+		std::mt19937 generator(42);
+		const std::vector<Face>& faces = CreateSyntheticFaces((int)state.GetArgument(), frameSize, generator);
+		std::vector<cv::Rect2f> boxes;
+		std::vector<float> scores;
+		CreateDetectionCandidates(faces, frameSize, candidatesPerFace, generator, &boxes, &scores);
+
+		while (state.KeepRunning())
+			GetReferenceIndexes(boxes, scores);
+
+		state.SetItemsPerIteration((double)boxes.size());
+	}
+
+	void BenchmarkUmeyama(BenchmarkState& state)
+	{
+		std::mt19937 generator(42);
+		const std::vector<Face>& faces = CreateSyntheticFaces(1, cv::Size(112, 112), generator);
+
+		Landmarks source;
+		for (const cv::Point2f& landmark : faces[0].landmarks)
+			source.emplace_back(landmark * 112);
+		const Landmarks destination = { { 38.2946f, 51.6963f }, { 73.5318f, 51.5014f }, { 56.0252f, 71.7366f },
+			{ 41.5493f, 92.3655f }, { 70.7299f, 92.2041f } };
+
+		cv::Matx23f transform;
+		while (state.KeepRunning())
+			transform = Umeyama::GetSimilarTransform(source.data(), destination.data(), (int)source.size());
+
+		state.SetLabel(transform(0, 0) > 0 ? "" : "unexpected transform"); // keeps the estimate from being optimized away
+	}
+
+	// full resolution crops scaled to 112x112 afterwards against crops warped at 112x112, optionally face-parallel
+	void BenchmarkNormalization(BenchmarkState& state, const bool alignsDirectly, const cv::Size& imageSize, ThreadPool* threadPool)
+	{
+		std::mt19937 generator(42);
+		const cv::Mat& image = CreateSyntheticImage(imageSize);
+		const std::vector<Face>& faces = CreateSyntheticFaces((int)state.GetArgument(), imageSize, generator);
+		const cv::Size arcFaceTargetSize(112, 112);
+
+		const ArcFaceNormalizer normalizer(threadPool);
+		while (state.KeepRunning())
+		{
+			if (alignsDirectly)
+			{
+				normalizer.GetAlignedFaces(image, faces, arcFaceTargetSize);
+				continue;
+			}
+
+			const std::vector<cv::Mat>& normalizedFaces = normalizer.GetNormalizedFaces(image, faces);
+			std::vector<cv::Mat> scaledFaces(normalizedFaces.size());
+			for (size_t i = 0; i < normalizedFaces.size(); i++)
+				cv::resize(normalizedFaces[i], scaledFaces[i], arcFaceTargetSize);
+		}
+
+		state.SetItemsPerIteration((double)faces.size());
+	}
+
+	void BenchmarkCosineSimilarity(BenchmarkState& state)
+	{
+		std::mt19937 generator(42);
+		const std::vector<FaceIndex>& indexes = CreateRandomIndexes(pairCount + 1, indexSize, generator);
+
+		const FaceComparer comparer;
+		float similaritySum = 0;
+		while (state.KeepRunning())
+		{
+			for (int i = 0; i < pairCount; i++)
+				similaritySum += comparer.GetCosineSimilarity(indexes[i], indexes[i + 1]);
+		}
+
+		state.SetItemsPerIteration(pairCount);
+		state.SetLabel(similaritySum == 0 ? "zero" : ""); // keeps the loop from being optimized away
+	}
+
+	void BenchmarkDot(BenchmarkState& state)
+	{
+		std::mt19937 generator(42);
+		const std::vector<FaceIndex>& indexes = CreateRandomIndexes(pairCount + 1, indexSize, generator);
+
+		float dotSum = 0;
+		while (state.KeepRunning())
+		{
+			for (int i = 0; i < pairCount; i++)
+				dotSum += GallerySearcher::Dot(indexes[i].data(), indexes[i + 1].data(), indexSize);
+		}
+
+		state.SetItemsPerIteration(pairCount);
+		state.SetLabel(dotSum == 0 ? "zero" : "");
+	}
+
+	std::unique_ptr<ClusteredGallery> CreateClusteredGallery(const size_t rowCount, const size_t probeCount, const int maxMatchCount)
+	{
+		std::mt19937 generator(42);
+		const std::vector<FaceIndex>& centers = CreateRandomIndexes(rowCount / 40, indexSize, generator);
+
+		std::unique_ptr<ClusteredGallery> clusteredGallery(new ClusteredGallery());
+		clusteredGallery->indexes = CreateClusteredIndexes(rowCount, centers, generator);
+		clusteredGallery->probes = CreateClusteredIndexes(probeCount, centers, generator);
+		clusteredGallery->gallery.Build(std::vector<std::string>(rowCount), clusteredGallery->indexes, indexSize);
+
+		GallerySearcher searcher(clusteredGallery->gallery);
+		for (const FaceIndex& probe : clusteredGallery->probes)
+			clusteredGallery->exactMatches.emplace_back(searcher.Search(probe, maxMatchCount));
+
+		return clusteredGallery;
+	}
+
+	// share of the exact top-k rows that were found
+	float GetRecall(const std::vector<std::vector<GalleryMatch>>& matches, const std::vector<std::vector<GalleryMatch>>& exactMatches)
+	{
+		size_t foundCount = 0;
+		size_t exactCount = 0;
+		for (size_t i = 0; i < exactMatches.size(); i++)
+		{
+			exactCount += exactMatches[i].size();
+			for (const GalleryMatch& match : matches[i])
+			{
+				for (const GalleryMatch& exactMatch : exactMatches[i])
+					foundCount += match.row == exactMatch.row;
+			}
+		}
+
+		return exactCount > 0 ? (float)foundCount / exactCount : 0;
+	}
+
+	std::string FormatRatio(const std::string& name, const float ratio)
+	{
+		std::ostringstream stream;
+		stream << name << " " << std::fixed << std::setprecision(3) << ratio;
+
+		return stream.str();
+	}
+
+	// built by the first ANN benchmark that runs and shared with the others, the graph takes seconds to build
+	AnnFixture& GetAnnFixture()
+	{
+		static AnnFixture fixture;
+		if (!fixture.clusteredGallery)
+		{
+			fixture.clusteredGallery = CreateClusteredGallery(annRowCount, annProbeCount, annMaxMatchCount);
+
+			const auto begin = std::chrono::steady_clock::now();
+			fixture.index.Build(fixture.clusteredGallery->gallery);
+			fixture.buildNs = BenchmarkState::GetNanoseconds(begin, std::chrono::steady_clock::now());
+		}
+
+		return fixture;
+	}
+
+	// exact scan of the ANN gallery, the reference for the latency and recall of the HNSW searches
+	void BenchmarkAnnExactSearch(BenchmarkState& state)
+	{
+		const ClusteredGallery& clusteredGallery = *GetAnnFixture().clusteredGallery;
+		GallerySearcher searcher(clusteredGallery.gallery);
+
+		size_t probeNumber = 0;
+		while (state.KeepRunning())
+			searcher.Search(clusteredGallery.probes[probeNumber++ % clusteredGallery.probes.size()], annMaxMatchCount);
+	}
+
+	void BenchmarkAnnSearch(BenchmarkState& state)
+	{
+		AnnFixture& fixture = GetAnnFixture();
+		const ClusteredGallery& clusteredGallery = *fixture.clusteredGallery;
+		fixture.index.SetEfSearch((int)state.GetArgument());
+
+		size_t probeNumber = 0;
+		while (state.KeepRunning())
+			fixture.index.Search(clusteredGallery.probes[probeNumber++ % clusteredGallery.probes.size()], annMaxMatchCount);
+
+		std::vector<std::vector<GalleryMatch>> matches;
+		for (const FaceIndex& probe : clusteredGallery.probes)
+			matches.emplace_back(fixture.index.Search(probe, annMaxMatchCount));
+
+		state.SetLabel(FormatRatio("recall@" + std::to_string(annMaxMatchCount), GetRecall(matches, clusteredGallery.exactMatches))
+			+ ", build " + std::to_string(fixture.buildNs / 1000000) + " ms");
+	}
+
+	// built by the first quantization benchmark that runs, its exact matches come from the float32 gallery
+	const ClusteredGallery& GetQuantizationGallery()
+	{
+		static const std::unique_ptr<ClusteredGallery> clusteredGallery =
+			CreateClusteredGallery(quantizationRowCount, quantizationProbeCount, quantizationMaxMatchCount);
+
+		return *clusteredGallery;
+	}
+
+	// search time of a quantized gallery together with how far its rankings drift from float32
+	void BenchmarkQuantizedSearch(BenchmarkState& state, const EmbeddingType type)
+	{
+		const ClusteredGallery& clusteredGallery = GetQuantizationGallery();
+		FaceGallery gallery;
+		gallery.Build(std::vector<std::string>(clusteredGallery.indexes.size()), clusteredGallery.indexes, indexSize, type);
+		GallerySearcher searcher(gallery);
+
+		size_t probeNumber = 0;
+		while (state.KeepRunning())
+			searcher.Search(clusteredGallery.probes[probeNumber++ % clusteredGallery.probes.size()], quantizationMaxMatchCount);
+
+		std::vector<std::vector<GalleryMatch>> matches;
+		int top1Count = 0;
+		for (size_t i = 0; i < clusteredGallery.probes.size(); i++)
+		{
+			matches.emplace_back(searcher.Search(clusteredGallery.probes[i], quantizationMaxMatchCount));
+			top1Count += !matches[i].empty() && matches[i][0].row == clusteredGallery.exactMatches[i][0].row;
+		}
+
+		state.SetLabel(std::to_string(gallery.GetRowStride()) + " B per identity, "
+			+ FormatRatio("top-1 agreement", (float)top1Count / clusteredGallery.probes.size()) + ", "
+			+ FormatRatio("recall@" + std::to_string(quantizationMaxMatchCount), GetRecall(matches, clusteredGallery.exactMatches)));
+	}
+
+	void BenchmarkGallerySearch(BenchmarkState& state, const EmbeddingType type, const int probeCount, ThreadPool* threadPool)
+	{
+		const size_t rowCount = (size_t)state.GetArgument();
+		std::mt19937 generator(42);
+
+		FaceGallery gallery;
+		{
+			const std::vector<FaceIndex>& indexes = CreateRandomIndexes(rowCount, indexSize, generator);
+			gallery.Build(std::vector<std::string>(rowCount), indexes, indexSize, type);
+		}
+
+		const std::vector<FaceIndex>& probes = CreateRandomIndexes(probeCount, indexSize, generator);
+		GallerySearcher searcher(gallery, threadPool);
+		while (state.KeepRunning())
+		{
+			if (probeCount == 1)
+				searcher.Search(probes[0], maxMatchCount);
+			else
+				searcher.Search(probes, maxMatchCount);
+		}
+
+		state.SetItemsPerIteration(probeCount);
+	}
+}
+
+void AddCpuBenchmarks(BenchmarkRunner& runner, const size_t maxGalleryRowCount)
+{
+	const std::vector<int64_t> faceCounts = { 1, 10, 100, 1000 };
+
+	std::vector<int64_t> galleryRowCounts;
+	for (const int64_t rowCount : { 1000, 10000, 100000, 1000000, 10000000 })
+	{
+		if (rowCount <= (int64_t)maxGalleryRowCount)
+			galleryRowCounts.emplace_back(rowCount);
+	}
+
+	runner.Add("Preprocess", BenchmarkPreprocessing, { 320, 640 });
+
+	runner.Add("Nms/Auto", [](BenchmarkState& state) { BenchmarkNms(state, NmsMethod::Auto); }, faceCounts);
+	runner.Add("Nms/Bitmask", [](BenchmarkState& state) { BenchmarkNms(state, NmsMethod::Bitmask); }, faceCounts);
+	runner.Add("Nms/Grid", [](BenchmarkState& state) { BenchmarkNms(state, NmsMethod::Grid); }, faceCounts);
+	runner.Add("Nms/Reference", BenchmarkReferenceNms, faceCounts);
+
+	const std::shared_ptr<ThreadPool> threadPool = std::make_shared<ThreadPool>();
+
+	runner.Add("Umeyama", BenchmarkUmeyama);
+	runner.Add("Normalization/Padded",
+		[](BenchmarkState& state) { BenchmarkNormalization(state, false, frameSize, nullptr); }, faceCounts);
+	runner.Add("Normalization/Direct",
+		[](BenchmarkState& state) { BenchmarkNormalization(state, true, frameSize, nullptr); }, faceCounts);
+	runner.Add("Normalization/DirectParallel",
+		[threadPool](BenchmarkState& state) { BenchmarkNormalization(state, true, frameSize, threadPool.get()); }, faceCounts);
+	runner.Add("Normalization/Padded4K",
+		[](BenchmarkState& state) { BenchmarkNormalization(state, false, uhdFrameSize, nullptr); }, faceCounts);
+	runner.Add("Normalization/Direct4K",
+		[](BenchmarkState& state) { BenchmarkNormalization(state, true, uhdFrameSize, nullptr); }, faceCounts);
+	runner.Add("Normalization/Padded4KParallel",
+		[threadPool](BenchmarkState& state) { BenchmarkNormalization(state, false, uhdFrameSize, threadPool.get()); }, faceCounts);
+
+	runner.Add("CosineSimilarity", BenchmarkCosineSimilarity);
+	runner.Add("Dot", BenchmarkDot);
+
+	const std::pair<EmbeddingType, std::string> types[] = { { EmbeddingType::Float32, "Float32" },
+		{ EmbeddingType::Float16, "Float16" }, { EmbeddingType::Int8, "Int8" } };
+	for (const auto& type : types)
+	{
+		const EmbeddingType embeddingType = type.first;
+		runner.Add("GallerySearch/" + type.second,
+			[embeddingType](BenchmarkState& state) { BenchmarkGallerySearch(state, embeddingType, 1, nullptr); }, galleryRowCounts);
+		runner.Add("GallerySearch/" + type.second + "Block32",
+			[embeddingType](BenchmarkState& state) { BenchmarkGallerySearch(state, embeddingType, 32, nullptr); }, galleryRowCounts);
+		runner.Add("GallerySearch/" + type.second + "Sharded32",
+			[embeddingType, threadPool](BenchmarkState& state) { BenchmarkGallerySearch(state, embeddingType, 32, threadPool.get()); },
+			galleryRowCounts);
+
+		if (quantizationRowCount <= (int64_t)maxGalleryRowCount)
+			runner.Add("QuantizedSearch/" + type.second, [embeddingType](BenchmarkState& state) { BenchmarkQuantizedSearch(state, embeddingType); });
+	}
+
+	runner.Add("AnnSearch/Exact", BenchmarkAnnExactSearch);
+	runner.Add("AnnSearch/Ef", BenchmarkAnnSearch, { 16, 64, 256 });
+}
\ No newline at end of file
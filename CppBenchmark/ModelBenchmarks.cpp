@@ -0,0 +1,355 @@
+#include "Benchmarks.h"
+#include "SyntheticData.h"
+#include "RetinaFaceDetector.h"
+#include "ArcFaceNormalizer.h"
+#include "ArcFace50Indexer.h"
+#include "GenderAgeAnalyzer.h"
+#include "FacePipeline.h"
+#include "DetectionBatcher.h"
+#include "InferencePool.h"
+#include "ThreadAffinity.h"
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	const float detectionThreshold = 0.5f;
+	const float overlapThreshold = 0.4f;
+	const int maxIndexingBatchSize = 32;
+	const int maxAttributeBatchSize = 32;
+	const cv::Size arcFaceTargetSize(112, 112);
+	const int indexSize = 512;
+	const int galleryRowCount = 1000;
+	const int detectionCallerCount = 4;
+
+	cv::Mat LoadFrame(const std::string& imageFilepath)
+	{
+		cv::Mat image;
+		if (!imageFilepath.empty() && fs::exists(imageFilepath))
+			image = cv::imread(imageFilepath);
+
+		if (image.empty())
+		{
+			std::cout << "image " << imageFilepath << " not found, using a synthetic frame without faces" << std::endl;
+			image = CreateSyntheticImage(cv::Size(1920, 1080));
+		}
+
+		return image;
+	}
+
+	void BenchmarkDetection(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config)
+	{
+		const int inputWidth = (int)state.GetArgument();
+		RetinaFaceDetector detector(env, config.detectorModelFilepath, NmsMethod::Auto, 1, { cv::Size(inputWidth, inputWidth) },
+			config.inferenceOptions);
+		const cv::Mat& image = LoadFrame(config.imageFilepath);
+
+		std::vector<Face> faces;
+		while (state.KeepRunning())
+			faces = detector.Detect(image, detectionThreshold, overlapThreshold);
+
+		state.SetLabel(std::to_string(faces.size()) + " faces");
+	}
+
+	// one detector with the full and a reduced input size, the regions pass only looks around the faces of the full pass
+	// as the pipeline does around tracked faces; the label tells how many of the full size faces each pass finds
+	void BenchmarkDetectionPass(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config, const int pass)
+	{
+		RetinaFaceDetector detector(env, config.detectorModelFilepath, NmsMethod::Auto, 1, { cv::Size(640, 640), cv::Size(320, 320) },
+			config.inferenceOptions);
+		const cv::Mat& image = LoadFrame(config.imageFilepath);
+
+		const std::vector<Face>& fullFaces = detector.Detect(image, detectionThreshold, overlapThreshold);
+		std::vector<cv::Rect2f> regions;
+		regions.reserve(fullFaces.size());
+		for (const Face& face : fullFaces)
+			regions.emplace_back(face.box);
+
+		std::vector<Face> faces;
+		while (state.KeepRunning())
+		{
+			if (pass == 2)
+				faces = detector.DetectInRegions(image, regions, detectionThreshold, overlapThreshold, 1);
+			else
+				faces = detector.Detect(image, detectionThreshold, overlapThreshold, pass);
+		}
+
+		state.SetLabel(std::to_string(faces.size()) + " of " + std::to_string(fullFaces.size()) + " faces");
+	}
+
+	void BenchmarkBatchedDetection(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config)
+	{
+		const int batchSize = (int)state.GetArgument();
+		RetinaFaceDetector detector(env, config.detectorModelFilepath, NmsMethod::Auto, batchSize, { cv::Size(640, 640) },
+			config.inferenceOptions);
+		const std::vector<cv::Mat> images(batchSize, LoadFrame(config.imageFilepath));
+
+		while (state.KeepRunning())
+			detector.Detect(images, detectionThreshold, overlapThreshold, 0);
+
+		state.SetItemsPerIteration(batchSize);
+	}
+
+	// every caller stands for a stream that waits for its detections before sending the next frame,
+	// one iteration is one frame from each; the batches are capped at the argument
+	void BenchmarkDetectionBatcher(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config)
+	{
+		DetectionBatcherConfig batcherConfig;
+		batcherConfig.maxBatchSize = (int)state.GetArgument();
+		batcherConfig.detectionThreshold = detectionThreshold;
+		batcherConfig.overlapThreshold = overlapThreshold;
+		batcherConfig.inferenceOptions = config.inferenceOptions;
+		DetectionBatcher batcher(env, config.detectorModelFilepath, batcherConfig);
+		const cv::Mat& image = LoadFrame(config.imageFilepath);
+
+		DetectionBatcherStats previousStats = batcher.GetStats();
+		while (state.KeepRunning())
+		{
+			std::vector<std::thread> callers;
+			for (int i = 0; i < detectionCallerCount; i++)
+				callers.emplace_back([&batcher, &image]() { batcher.Detect(image).get(); });
+			for (std::thread& caller : callers)
+				caller.join();
+
+			const DetectionBatcherStats stats = batcher.GetStats();
+			const uint64_t requests = stats.requests - previousStats.requests;
+			const uint64_t batches = stats.batches - previousStats.batches;
+			if (requests > 0 && batches > 0)
+			{
+				state.RecordStage("queueing", (int64_t)((stats.queueMicroseconds - previousStats.queueMicroseconds) * 1000 / requests));
+				state.RecordStage("inference", (int64_t)((stats.inferenceMicroseconds - previousStats.inferenceMicroseconds) * 1000 / batches));
+			}
+			previousStats = stats;
+		}
+
+		const DetectionBatcherStats& stats = batcher.GetStats();
+		state.SetItemsPerIteration(detectionCallerCount);
+		state.SetLabel(std::to_string(stats.requests) + " requests in " + std::to_string(stats.batches) + " batches");
+	}
+
+	void BenchmarkIndexing(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config)
+	{
+		const int faceCount = (int)state.GetArgument();
+		ArcFace50Indexer indexer(env, config.indexerModelFilepath, maxIndexingBatchSize, config.inferenceOptions);
+		const std::vector<cv::Mat>& faceImages = CreateSyntheticFaceImages(faceCount, arcFaceTargetSize);
+
+		while (state.KeepRunning())
+			indexer.GetIndexes(faceImages);
+
+		state.SetItemsPerIteration(faceCount);
+	}
+
+	// the same cores spent on one request at a time or on one request per core: one iteration is one request
+	// from a caller per core, through a pool of instanceCount indexers that split the cores between them
+	void BenchmarkIndexerPool(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config, const bool instancePerCore)
+	{
+		const int coreCount = ThreadAffinity::GetCoreCount();
+		const int instanceCount = instancePerCore ? coreCount : 1;
+		InferenceOptions options = config.inferenceOptions;
+		options.intraOpThreadCount = instancePerCore ? 1 : coreCount;
+		InferencePool<ArcFace50Indexer> pool(instanceCount, [&env, &config, &options]()
+		{
+			return std::unique_ptr<ArcFace50Indexer>(new ArcFace50Indexer(env, config.indexerModelFilepath, 1, options));
+		});
+		const cv::Mat& faceImage = CreateSyntheticFaceImages(1, arcFaceTargetSize)[0];
+
+		std::vector<int64_t> latencies(coreCount);
+		while (state.KeepRunning())
+		{
+			std::vector<std::thread> callers;
+			for (int i = 0; i < coreCount; i++)
+			{
+				callers.emplace_back([&pool, &faceImage, &latencies, i]()
+				{
+					const auto begin = std::chrono::steady_clock::now();
+					pool.Acquire()->GetIndex(faceImage);
+					latencies[i] = BenchmarkState::GetNanoseconds(begin, std::chrono::steady_clock::now());
+				});
+			}
+			for (std::thread& caller : callers)
+				caller.join();
+
+			for (const int64_t latency : latencies)
+				state.RecordStage("request", latency);
+		}
+
+		state.SetItemsPerIteration(coreCount);
+		state.SetLabel(std::to_string(instanceCount) + " x " + std::to_string(options.intraOpThreadCount) + " threads");
+	}
+
+	// one session call per face against batches of the same 112x112 crops the indexer gets
+	void BenchmarkAttributes(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config, const bool isBatched)
+	{
+		const int faceCount = (int)state.GetArgument();
+		GenderAgeAnalyzer analyzer(env, config.genderAgeModelFilepath, maxAttributeBatchSize, config.inferenceOptions);
+		const std::vector<cv::Mat>& faceImages = CreateSyntheticFaceImages(faceCount, arcFaceTargetSize);
+
+		while (state.KeepRunning())
+		{
+			if (isBatched)
+			{
+				analyzer.GetAttributes(faceImages);
+				continue;
+			}
+
+			for (const cv::Mat& faceImage : faceImages)
+				analyzer.GetAttributes(faceImage);
+		}
+
+		state.SetItemsPerIteration(faceCount);
+	}
+
+	// the single-image flow of CppSandbox, timed stage by stage
+	void BenchmarkFrame(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config)
+	{
+		RetinaFaceDetector detector(env, config.detectorModelFilepath, NmsMethod::Auto, 1, { cv::Size(640, 640) },
+			config.inferenceOptions);
+		ArcFace50Indexer indexer(env, config.indexerModelFilepath, maxIndexingBatchSize, config.inferenceOptions);
+		GenderAgeAnalyzer analyzer(env, config.genderAgeModelFilepath, maxAttributeBatchSize, config.inferenceOptions);
+		const ArcFaceNormalizer normalizer;
+		const cv::Mat& image = LoadFrame(config.imageFilepath);
+
+		size_t faceCount = 0;
+		while (state.KeepRunning())
+		{
+			const auto detectionBegin = std::chrono::steady_clock::now();
+			const std::vector<Face>& faces = detector.Detect(image, detectionThreshold, overlapThreshold);
+			const auto normalizationBegin = std::chrono::steady_clock::now();
+			const std::vector<cv::Mat>& normalizedFaces = normalizer.GetAlignedFaces(image, faces, arcFaceTargetSize);
+			const auto indexingBegin = std::chrono::steady_clock::now();
+			indexer.GetIndexes(normalizedFaces);
+			const auto attributesBegin = std::chrono::steady_clock::now();
+			analyzer.GetAttributes(normalizedFaces);
+			const auto end = std::chrono::steady_clock::now();
+
+			state.RecordStage("detection", BenchmarkState::GetNanoseconds(detectionBegin, normalizationBegin));
+			state.RecordStage("normalization", BenchmarkState::GetNanoseconds(normalizationBegin, indexingBegin));
+			state.RecordStage("indexing", BenchmarkState::GetNanoseconds(indexingBegin, attributesBegin));
+			state.RecordStage("attributes", BenchmarkState::GetNanoseconds(attributesBegin, end));
+			faceCount = faces.size();
+		}
+
+		state.SetLabel(std::to_string(faceCount) + " faces");
+	}
+
+	FacePipelineConfig GetPipelineConfig(const ModelBenchmarkConfig& config)
+	{
+		FacePipelineConfig pipelineConfig;
+		pipelineConfig.detectorModelFilepath = config.detectorModelFilepath;
+		pipelineConfig.indexerModelFilepath = config.indexerModelFilepath;
+		pipelineConfig.genderAgeModelFilepath = config.genderAgeModelFilepath;
+		pipelineConfig.detectionThreshold = detectionThreshold;
+		pipelineConfig.overlapThreshold = overlapThreshold;
+		pipelineConfig.inferenceOptions = config.inferenceOptions;
+
+		return pipelineConfig;
+	}
+
+	// frames in flight through the pipelined engine, one iteration submits and flushes argument frames;
+	// the stages report their busy time per frame, so their sum is what one frame costs without pipelining,
+	// and latency runs from Submit() to the callback
+	void BenchmarkPipeline(BenchmarkState& state, Ort::Env& env, const ModelBenchmarkConfig& config)
+	{
+		const int frameCount = (int)state.GetArgument();
+		const cv::Mat& image = LoadFrame(config.imageFilepath);
+
+		FaceGallery gallery;
+		{
+			std::mt19937 generator(42);
+			gallery.Build(std::vector<std::string>(galleryRowCount), CreateRandomIndexes(galleryRowCount, indexSize, generator), indexSize);
+		}
+
+		std::mutex latencyMutex;
+		std::vector<int64_t> latencies;
+		FacePipeline pipeline(env, GetPipelineConfig(config), gallery, [&latencyMutex, &latencies](std::unique_ptr<PipelineFrame> frame)
+		{
+			const int64_t latency = BenchmarkState::GetNanoseconds(frame->submitTime, std::chrono::steady_clock::now());
+
+			std::lock_guard<std::mutex> lock(latencyMutex);
+			latencies.emplace_back(latency);
+		});
+		if (!pipeline.Start())
+			return;
+
+		FacePipelineStats previousStats = pipeline.GetStats();
+		while (state.KeepRunning())
+		{
+			for (int i = 0; i < frameCount; i++)
+				pipeline.Submit(image);
+			pipeline.Flush();
+
+			state.PauseTiming();
+			const FacePipelineStats stats = pipeline.GetStats();
+			for (int stage = 0; stage < FacePipeline::StageCount; stage++)
+			{
+				const uint64_t processedFrames = stats.processedFrames[stage] - previousStats.processedFrames[stage];
+				const uint64_t busyMicroseconds = stats.busyMicroseconds[stage] - previousStats.busyMicroseconds[stage];
+				if (processedFrames > 0)
+					state.RecordStage(FacePipeline::GetStageName(stage), (int64_t)(busyMicroseconds * 1000 / processedFrames));
+			}
+			previousStats = stats;
+
+			{
+				std::lock_guard<std::mutex> lock(latencyMutex);
+				for (const int64_t latency : latencies)
+					state.RecordStage("latency", latency);
+				latencies.clear();
+			}
+			state.ResumeTiming();
+		}
+
+		const FacePipelineStats& stats = pipeline.GetStats();
+		pipeline.Stop();
+
+		state.SetItemsPerIteration(frameCount);
+		state.SetLabel(std::to_string(stats.droppedFrames) + " dropped, " + std::to_string(stats.failedFrames) + " failed");
+	}
+
+	bool HasModel(const std::string& modelFilepath)
+	{
+		if (fs::exists(modelFilepath))
+			return true;
+
+		std::cout << "model " << modelFilepath << " not found, its benchmarks are not registered" << std::endl;
+
+		return false;
+	}
+}
+
+void AddModelBenchmarks(BenchmarkRunner& runner, Ort::Env& env, const ModelBenchmarkConfig& config)
+{
+	const bool hasDetector = HasModel(config.detectorModelFilepath);
+	const bool hasIndexer = HasModel(config.indexerModelFilepath);
+	const bool hasGenderAgeAnalyzer = HasModel(config.genderAgeModelFilepath);
+
+	if (hasDetector)
+	{
+		runner.Add("Detection", [&env, config](BenchmarkState& state) { BenchmarkDetection(state, env, config); }, { 320, 640 });
+		runner.Add("DetectionBatch", [&env, config](BenchmarkState& state) { BenchmarkBatchedDetection(state, env, config); }, { 1, 4 });
+		runner.Add("DetectionPass/Full", [&env, config](BenchmarkState& state) { BenchmarkDetectionPass(state, env, config, 0); });
+		runner.Add("DetectionPass/Reduced", [&env, config](BenchmarkState& state) { BenchmarkDetectionPass(state, env, config, 1); });
+		runner.Add("DetectionPass/Regions", [&env, config](BenchmarkState& state) { BenchmarkDetectionPass(state, env, config, 2); });
+		runner.Add("DetectionBatcher", [&env, config](BenchmarkState& state) { BenchmarkDetectionBatcher(state, env, config); },
+			{ 1, detectionCallerCount });
+	}
+
+	if (hasIndexer)
+	{
+		runner.Add("Indexing", [&env, config](BenchmarkState& state) { BenchmarkIndexing(state, env, config); }, { 1, 10, 100 });
+		runner.Add("IndexerPool/Shared", [&env, config](BenchmarkState& state) { BenchmarkIndexerPool(state, env, config, false); });
+		runner.Add("IndexerPool/PerCore", [&env, config](BenchmarkState& state) { BenchmarkIndexerPool(state, env, config, true); });
+	}
+
+	if (hasGenderAgeAnalyzer)
+	{
+		runner.Add("Attributes", [&env, config](BenchmarkState& state) { BenchmarkAttributes(state, env, config, false); }, { 1, 10, 100 });
+		runner.Add("AttributesBatch", [&env, config](BenchmarkState& state) { BenchmarkAttributes(state, env, config, true); },
+			{ 1, 10, 100 });
+	}
+
+	if (hasDetector && hasIndexer && hasGenderAgeAnalyzer)
+	{
+		runner.Add("Frame", [&env, config](BenchmarkState& state) { BenchmarkFrame(state, env, config); });
+		runner.Add("Pipeline", [&env, config](BenchmarkState& state) { BenchmarkPipeline(state, env, config); }, { 1, 32 });
+	}
+}
\ No newline at end of file
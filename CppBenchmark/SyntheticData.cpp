@@ -0,0 +1,127 @@
+#include "SyntheticData.h"
+#include <cmath>
+
+namespace
+{
+	// ArcFace reference landmarks relative to the face box
+	const float referenceLandmarks[] = { 0.34191f, 0.46157f, 0.65653f, 0.45983f, 0.50022f, 0.64050f, 0.37097f, 0.82469f, 0.63151f, 0.82325f };
+}
+
+cv::Mat CreateSyntheticImage(const cv::Size& size)
+{
+	cv::Mat image(size, CV_8UC3);
+	cv::RNG rng(42);
+	rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+
+	return image;
+}
+
+std::vector<Face> CreateSyntheticFaces(const int count, const cv::Size& frameSize, std::mt19937& generator)
+{
+	const float aspectRatio = frameSize.width / (float)frameSize.height;
+	const int columns = std::max((int)std::ceil(std::sqrt(count * aspectRatio)), 1);
+	const int rows = (count + columns - 1) / columns;
+	const float cellWidth = 1.0f / columns;
+	const float cellHeight = 1.0f / rows;
+	// boxes are a bit taller than wide, as detected
+	const float boxHeight = cellHeight * 0.6f;
+	const float boxWidth = std::min(boxHeight / aspectRatio / 1.2f, cellWidth * 0.6f);
+
+	std::uniform_real_distribution<float> offsetDistribution(-0.1f, 0.1f);
+	std::uniform_real_distribution<float> landmarkDistribution(-0.02f, 0.02f);
+	std::uniform_real_distribution<float> scoreDistribution(0.6f, 1.0f);
+
+	std::vector<Face> faces(count);
+	for (int i = 0; i < count; i++)
+	{
+		const float centerX = (i % columns + 0.5f + offsetDistribution(generator)) * cellWidth;
+		const float centerY = (i / columns + 0.5f + offsetDistribution(generator)) * cellHeight;
+
+		Face& face = faces[i];
+		face.box = cv::Rect2f(centerX - boxWidth / 2, centerY - boxHeight / 2, boxWidth, boxHeight);
+		face.score = scoreDistribution(generator);
+		for (int j = 0; j < 5; j++)
+		{
+			face.landmarks.emplace_back(referenceLandmarks[j * 2] + landmarkDistribution(generator),
+				referenceLandmarks[j * 2 + 1] + landmarkDistribution(generator));
+		}
+	}
+
+	return faces;
+}
+
+void CreateDetectionCandidates(const std::vector<Face>& faces, const cv::Size& frameSize, const int candidatesPerFace,
+	std::mt19937& generator, std::vector<cv::Rect2f>* boxes, std::vector<float>* scores)
+{
+	std::uniform_real_distribution<float> jitterDistribution(-0.08f, 0.08f);
+	std::uniform_real_distribution<float> scoreDistribution(0.5f, 1.0f);
+
+	boxes->clear();
+	scores->clear();
+	boxes->reserve(faces.size() * candidatesPerFace);
+	scores->reserve(faces.size() * candidatesPerFace);
+
+	for (const Face& face : faces)
+	{
+		const cv::Rect2f box(face.box.x * frameSize.width, face.box.y * frameSize.height, face.box.width * frameSize.width,
+			face.box.height * frameSize.height);
+
+		for (int i = 0; i < candidatesPerFace; i++)
+		{
+			const float scale = 1 + jitterDistribution(generator);
+			boxes->emplace_back(box.x + jitterDistribution(generator) * box.width, box.y + jitterDistribution(generator) * box.height,
+				box.width * scale, box.height * scale);
+			scores->emplace_back(scoreDistribution(generator));
+		}
+	}
+}
+
+std::vector<cv::Mat> CreateSyntheticFaceImages(const int count, const cv::Size& size)
+{
+	std::vector<cv::Mat> images;
+	images.reserve(count);
+
+	cv::RNG rng(42);
+	for (int i = 0; i < count; i++)
+	{
+		cv::Mat image(size, CV_8UC3);
+		rng.fill(image, cv::RNG::UNIFORM, 0, 256);
+		images.emplace_back(image);
+	}
+
+	return images;
+}
+
+std::vector<FaceIndex> CreateRandomIndexes(const size_t count, const int indexSize, std::mt19937& generator)
+{
+	std::normal_distribution<float> distribution;
+
+	std::vector<FaceIndex> indexes(count, FaceIndex(indexSize));
+	for (FaceIndex& index : indexes)
+	{
+		for (float& value : index)
+			value = distribution(generator);
+	}
+
+	return indexes;
+}
+
+std::vector<FaceIndex> CreateClusteredIndexes(const size_t count, const std::vector<FaceIndex>& centers, std::mt19937& generator)
+{
+	std::normal_distribution<float> distribution;
+	std::uniform_int_distribution<int> clusterDistribution(0, (int)centers.size() - 1);
+
+	std::vector<FaceIndex> indexes;
+	indexes.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const FaceIndex& center = centers[clusterDistribution(generator)];
+		FaceIndex index(center.size());
+		for (size_t j = 0; j < center.size(); j++)
+			index[j] = center[j] + 0.8f * distribution(generator);
+
+		indexes.emplace_back(index);
+	}
+
+	return indexes;
+}
\ No newline at end of file
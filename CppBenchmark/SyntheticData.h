@@ -0,0 +1,24 @@
+#pragma once
+
+#include <random>
+#include "Structs.h"
+
+// Deterministic inputs for the benchmarks, so every run and every commit measures the same data.
+
+// uniform noise, which neither helps nor hurts the resizing and warping code
+cv::Mat CreateSyntheticImage(const cv::Size& size);
+
+// faces spread over a grid covering the frame, boxes and landmarks relative like the detector output
+std::vector<Face> CreateSyntheticFaces(const int count, const cv::Size& frameSize, std::mt19937& generator);
+
+// several overlapping boxes around each face in pixels, like the raw detector output before NMS
+void CreateDetectionCandidates(const std::vector<Face>& faces, const cv::Size& frameSize, const int candidatesPerFace,
+	std::mt19937& generator, std::vector<cv::Rect2f>* boxes, std::vector<float>* scores);
+
+// aligned 112x112 crops as they come out of the normalizer
+std::vector<cv::Mat> CreateSyntheticFaceImages(const int count, const cv::Size& size);
+
+std::vector<FaceIndex> CreateRandomIndexes(const size_t count, const int indexSize, std::mt19937& generator);
+
+// identities scattered around cluster centers, closer to real embeddings than uniform noise
+std::vector<FaceIndex> CreateClusteredIndexes(const size_t count, const std::vector<FaceIndex>& centers, std::mt19937& generator);
\ No newline at end of file
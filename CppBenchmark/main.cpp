@@ -0,0 +1,65 @@
+#include "Benchmarks.h"
+
+// CppBenchmark [--filter <text>] [--json <output file>] [--baseline <earlier output file>] [--min-time <seconds>]
+//	[--max-gallery-rows <rows>] [--cpu] [--no-models] [image file]
+int main(int argc, char* argv[])
+{
+	BenchmarkSettings settings;
+	std::string jsonFilepath;
+	std::string baselineFilepath;
+	size_t maxGalleryRowCount = 1000000;
+	bool runModelBenchmarks = true;
+
+	ModelBenchmarkConfig modelConfig;
+	modelConfig.detectorModelFilepath = "models/det_10g.onnx";
+	modelConfig.indexerModelFilepath = "models/w600k_r50.onnx";
+	modelConfig.genderAgeModelFilepath = "models/genderage.onnx";
+	modelConfig.imageFilepath = "images/sh.jpg";
+	modelConfig.inferenceOptions.optimizedModelFolder = "models/optimized";
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string argument = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (argument == "--filter" && hasValue)
+			settings.filter = argv[++i];
+		else if (argument == "--json" && hasValue)
+			jsonFilepath = argv[++i];
+		else if (argument == "--baseline" && hasValue)
+			baselineFilepath = argv[++i];
+		else if (argument == "--min-time" && hasValue)
+			settings.minTimeSeconds = std::atof(argv[++i]);
+		else if (argument == "--max-gallery-rows" && hasValue)
+			maxGalleryRowCount = std::strtoull(argv[++i], nullptr, 10);
+		else if (argument == "--cpu")
+			modelConfig.inferenceOptions.providers = { ExecutionProvider::Cpu };
+		else if (argument == "--no-models")
+			runModelBenchmarks = false;
+		else if (argument[0] != '-')
+			modelConfig.imageFilepath = argument;
+		else
+		{
+			std::cout << "unknown argument " << argument << std::endl;
+			return -1;
+		}
+	}
+
+	BenchmarkRunner runner(settings);
+	AddCpuBenchmarks(runner, maxGalleryRowCount);
+
+	Ort::Env env(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "benchmark");
+	if (runModelBenchmarks)
+		AddModelBenchmarks(runner, env, modelConfig);
+
+	const std::vector<BenchmarkResult>& results = runner.Run();
+	BenchmarkRunner::PrintResults(results);
+
+	if (!baselineFilepath.empty())
+		BenchmarkRunner::CompareWithBaseline(results, baselineFilepath);
+
+	if (!jsonFilepath.empty() && !BenchmarkRunner::SaveJson(results, jsonFilepath))
+		return -1;
+
+	return 0;
+}
\ No newline at end of file
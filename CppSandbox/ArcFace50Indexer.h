@@ -1,20 +1,26 @@
 #pragma once
 
 #include "Structs.h"
-#include <onnxruntime_cxx_api.h>
+#include "InferenceSession.h"
+#include "ImagePreprocessor.h"
 
+// not thread safe, an instance serves one thread at a time (see InferencePool)
 class ArcFace50Indexer
 {
 private:
-	Ort::Session _session;
 	const cv::Size _inputSize = cv::Size(112, 112);
 	const int _inputDepth = 3;
+	const int _maxBatchSize;
+	InferenceSession _session;
+	ImagePreprocessor _preprocessor;
 
 public:
-	ArcFace50Indexer(Ort::Env& env, const std::string& modelFilepath);
+	ArcFace50Indexer(Ort::Env& env, const std::string& modelFilepath, const int maxBatchSize = 32,
+		const InferenceOptions& options = InferenceOptions());
 	FaceIndex GetIndex(const cv::Mat& faceImage);
+	std::vector<FaceIndex> GetIndexes(const std::vector<cv::Mat>& faceImages);
 
 private:
-	cv::Mat PrepareImage(const cv::Mat& image, float* scaleFactor) const;
-	FaceIndex RunNet(const cv::Mat& floatImage);
+	void PrepareImage(const cv::Mat& image, const int batchIndex);
+	std::vector<FaceIndex> RunNet(const int batchSize);
 };
\ No newline at end of file
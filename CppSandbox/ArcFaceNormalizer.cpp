@@ -1,111 +1,180 @@
 #include "ArcFaceNormalizer.h"
 #include "Umeyama.h"
+#include "Metrics.h"
+
+namespace
+{
+	const int templatePointCount = 5;
+}
+
+ArcFaceNormalizer::ArcFaceNormalizer(ThreadPool* threadPool)
+	: _threadPool(threadPool)
+{
+}
 
 std::vector<cv::Mat> ArcFaceNormalizer::GetNormalizedFaces(const cv::Mat& image, const std::vector<Face>& faces) const
 {
-	std::vector<cv::Mat> normalizedFaces;
-	normalizedFaces.reserve(faces.size());
+	const StageTimer timer(MetricStage::Normalization);
+	std::vector<cv::Mat> normalizedFaces(faces.size());
 
-	for (int i = 0; i < faces.size(); i++)
+	RunForFaces((int)faces.size(), [this, &image, &faces, &normalizedFaces](const int i)
 	{
-		const Face& face = faces[i];
-
-		const cv::Rect absRect(face.box.x * image.cols, face.box.y * image.rows, face.box.width * image.cols, face.box.height * image.rows);
-		const cv::Mat faceImage = image(absRect);
-
-		Landmarks absLandmarks;
-		absLandmarks.reserve(face.landmarks.size());
-		for (int j = 0; j < face.landmarks.size(); j++)
-		{
-			const int x = face.landmarks[j].x * absRect.width;
-			const int y = face.landmarks[j].y * absRect.height;
-			absLandmarks.emplace_back(cv::Point2f(x, y));
-		}
-
-		int pixelOffsetX = 0;
-		int pixelOffsetY = 0;
-		float scaleValueX = 0;
-		float scaleValueY = 0;
-		int maxDim = faceImage.cols;
-		if (faceImage.cols < faceImage.rows)
-		{
-			pixelOffsetX = (faceImage.rows - faceImage.cols) / 2;
-			scaleValueX = pixelOffsetX / (float)faceImage.rows;
-			maxDim = faceImage.rows;
-		}
-		if (faceImage.rows < faceImage.cols)
-		{
-			pixelOffsetY = (faceImage.cols - faceImage.rows) / 2;
-			scaleValueY = pixelOffsetY / (float)faceImage.cols;
-			maxDim = faceImage.cols;
-		}
-
-		const cv::Rect absRectPadded(absRect.x - pixelOffsetX, absRect.y - pixelOffsetY, maxDim, maxDim);
-		const int pixelOffset = (float)maxDim * 0.3;
-		const cv::Rect enlargedRect(absRectPadded.x - pixelOffset, absRectPadded.y - pixelOffset,
-			absRectPadded.width + pixelOffset * 2, absRectPadded.height + pixelOffset * 2);
-		
-		const bool xOk = enlargedRect.x >= 0;
-		const bool yOk = enlargedRect.y >= 0;
-		const bool wOk = enlargedRect.x + enlargedRect.width < image.cols;
-		const bool hOk = enlargedRect.y + enlargedRect.height < image.rows;
-
-		cv::Mat paddedEnlImage;
-		const bool rectInbounds = xOk && yOk && wOk && hOk;
-		if (rectInbounds)
-			paddedEnlImage = image(enlargedRect);
-		else
-		{
-			const int xOffset = xOk ? 0 : std::abs(enlargedRect.x);
-			const int yOffset = yOk ? 0 : std::abs(enlargedRect.y);
-			const int wOffset = wOk ? 0 : (enlargedRect.x + enlargedRect.width) - image.cols;
-			const int hOffset = hOk ? 0 : (enlargedRect.y + enlargedRect.height) - image.rows;
-			const int reducedWidth = enlargedRect.width - xOffset - wOffset;
-			const int reducedHeight = enlargedRect.height - yOffset - hOffset;
-
-			const cv::Rect enlIntRect(enlargedRect.x + xOffset, enlargedRect.y + yOffset,	reducedWidth, reducedHeight);
-			const cv::Rect intRect(xOffset, yOffset, reducedWidth, reducedHeight);
-
-			paddedEnlImage = cv::Mat(cv::Size(enlargedRect.width, enlargedRect.height), CV_8UC3);
-			const cv::Mat partImage = image(enlIntRect);
-			partImage.copyTo(paddedEnlImage(intRect));
-		}
-
-		Landmarks correctedLandmarks;
-		correctedLandmarks.reserve(face.landmarks.size());
-
-		Landmarks correctedIdLandmarks;
-		correctedIdLandmarks.reserve(face.landmarks.size());
-
-		for (int j = 0; j < face.landmarks.size(); j++)
-		{
-			const float x = face.landmarks[j].x * faceImage.cols / maxDim + scaleValueX;
-			const float y = face.landmarks[j].y * faceImage.rows / maxDim + scaleValueY;
-
-			const int corrX = x * maxDim + pixelOffset;
-			const int corrY = y * maxDim + pixelOffset;
-			const cv::Point2f corrLm(corrX, corrY);
-			correctedLandmarks.emplace_back(corrLm);
-
-			const int idX = _dstMap[j * 2] * maxDim + pixelOffset;
-			const int idY = _dstMap[j * 2 + 1] * maxDim + pixelOffset;
-			const cv::Point2f corrId(idX, idY);
-			correctedIdLandmarks.emplace_back(corrId);
-		}
-
-		const cv::Mat srcMat(_lmArraySize, CV_32FC1, (float*)correctedLandmarks.data());
-		const cv::Mat dstMat(_lmArraySize, CV_32FC1, (float*)correctedIdLandmarks.data());
-		const cv::Mat affine = _transformer.GetSimilarTransform(srcMat, dstMat);
-		const cv::Mat affine3x2(2, 3, CV_32FC1, affine.data);
-
-		const cv::Mat normImage(paddedEnlImage.size(), CV_8UC3);
-		cv::warpAffine(paddedEnlImage, normImage, affine3x2, paddedEnlImage.size());
-
-		const cv::Rect unpaddedRect(pixelOffset, pixelOffset, normImage.cols - pixelOffset * 2, normImage.rows - pixelOffset * 2);
-		const cv::Mat& unpaddedImage = normImage(unpaddedRect);
-
-		normalizedFaces.emplace_back(unpaddedImage);
-	}
+		normalizedFaces[i] = GetNormalizedFace(image, faces[i]);
+	});
+
+	Metrics::Get().AddCount(MetricCounter::FacesNormalized, normalizedFaces.size());
 
 	return normalizedFaces;
+}
+
+std::vector<cv::Mat> ArcFaceNormalizer::GetAlignedFaces(const cv::Mat& image, const std::vector<Face>& faces,
+	const cv::Size& outputSize) const
+{
+	const StageTimer timer(MetricStage::Normalization);
+	const int faceCount = (int)faces.size();
+	std::vector<cv::Mat> alignedFaces(faceCount);
+	if (faceCount == 0)
+		return alignedFaces;
+
+	// the crops of a frame are stacked in one allocation and released together with the last one in use;
+	// full-width row ranges stay continuous, and the warp writes into them without reallocating
+	const cv::Mat cropBlock(outputSize.height * faceCount, outputSize.width, image.type());
+	for (int i = 0; i < faceCount; i++)
+		alignedFaces[i] = cropBlock.rowRange(i * outputSize.height, (i + 1) * outputSize.height);
+
+	// only the output pixels are interpolated, however large the face is in the image
+	RunForFaces(faceCount, [this, &image, &faces, &outputSize, &alignedFaces](const int i)
+	{
+		cv::warpAffine(image, alignedFaces[i], GetAlignment(image.size(), faces[i], outputSize), outputSize, cv::INTER_LINEAR,
+			cv::BORDER_CONSTANT);
+	});
+
+	Metrics::Get().AddCount(MetricCounter::FacesNormalized, alignedFaces.size());
+
+	return alignedFaces;
+}
+
+cv::Mat ArcFaceNormalizer::GetNormalizedFace(const cv::Mat& image, const Face& face) const
+{
+	const cv::Rect absRect(face.box.x * image.cols, face.box.y * image.rows, face.box.width * image.cols, face.box.height * image.rows);
+	const cv::Mat faceImage = image(absRect);
+
+	Landmarks absLandmarks;
+	absLandmarks.reserve(face.landmarks.size());
+	for (int j = 0; j < face.landmarks.size(); j++)
+	{
+		const int x = face.landmarks[j].x * absRect.width;
+		const int y = face.landmarks[j].y * absRect.height;
+		absLandmarks.emplace_back(cv::Point2f(x, y));
+	}
+
+	int pixelOffsetX = 0;
+	int pixelOffsetY = 0;
+	float scaleValueX = 0;
+	float scaleValueY = 0;
+	int maxDim = faceImage.cols;
+	if (faceImage.cols < faceImage.rows)
+	{
+		pixelOffsetX = (faceImage.rows - faceImage.cols) / 2;
+		scaleValueX = pixelOffsetX / (float)faceImage.rows;
+		maxDim = faceImage.rows;
+	}
+	if (faceImage.rows < faceImage.cols)
+	{
+		pixelOffsetY = (faceImage.cols - faceImage.rows) / 2;
+		scaleValueY = pixelOffsetY / (float)faceImage.cols;
+		maxDim = faceImage.cols;
+	}
+
+	const cv::Rect absRectPadded(absRect.x - pixelOffsetX, absRect.y - pixelOffsetY, maxDim, maxDim);
+	const int pixelOffset = (float)maxDim * 0.3;
+	const cv::Rect enlargedRect(absRectPadded.x - pixelOffset, absRectPadded.y - pixelOffset,
+		absRectPadded.width + pixelOffset * 2, absRectPadded.height + pixelOffset * 2);
+	
+	const bool xOk = enlargedRect.x >= 0;
+	const bool yOk = enlargedRect.y >= 0;
+	const bool wOk = enlargedRect.x + enlargedRect.width < image.cols;
+	const bool hOk = enlargedRect.y + enlargedRect.height < image.rows;
+
+	cv::Mat paddedEnlImage;
+	const bool rectInbounds = xOk && yOk && wOk && hOk;
+	if (rectInbounds)
+		paddedEnlImage = image(enlargedRect);
+	else
+	{
+		const int xOffset = xOk ? 0 : std::abs(enlargedRect.x);
+		const int yOffset = yOk ? 0 : std::abs(enlargedRect.y);
+		const int wOffset = wOk ? 0 : (enlargedRect.x + enlargedRect.width) - image.cols;
+		const int hOffset = hOk ? 0 : (enlargedRect.y + enlargedRect.height) - image.rows;
+		const int reducedWidth = enlargedRect.width - xOffset - wOffset;
+		const int reducedHeight = enlargedRect.height - yOffset - hOffset;
+
+		const cv::Rect enlIntRect(enlargedRect.x + xOffset, enlargedRect.y + yOffset,	reducedWidth, reducedHeight);
+		const cv::Rect intRect(xOffset, yOffset, reducedWidth, reducedHeight);
+
+		paddedEnlImage = cv::Mat(cv::Size(enlargedRect.width, enlargedRect.height), CV_8UC3);
+		const cv::Mat partImage = image(enlIntRect);
+		partImage.copyTo(paddedEnlImage(intRect));
+	}
+
+	Landmarks correctedLandmarks;
+	correctedLandmarks.reserve(face.landmarks.size());
+
+	Landmarks correctedIdLandmarks;
+	correctedIdLandmarks.reserve(face.landmarks.size());
+
+	for (int j = 0; j < face.landmarks.size(); j++)
+	{
+		const float x = face.landmarks[j].x * faceImage.cols / maxDim + scaleValueX;
+		const float y = face.landmarks[j].y * faceImage.rows / maxDim + scaleValueY;
+
+		const int corrX = x * maxDim + pixelOffset;
+		const int corrY = y * maxDim + pixelOffset;
+		const cv::Point2f corrLm(corrX, corrY);
+		correctedLandmarks.emplace_back(corrLm);
+
+		const int idX = _dstMap[j * 2] * maxDim + pixelOffset;
+		const int idY = _dstMap[j * 2 + 1] * maxDim + pixelOffset;
+		const cv::Point2f corrId(idX, idY);
+		correctedIdLandmarks.emplace_back(corrId);
+	}
+
+	const cv::Matx23f affine = Umeyama::GetSimilarTransform(correctedLandmarks.data(), correctedIdLandmarks.data(),
+		(int)correctedLandmarks.size());
+
+	const cv::Mat normImage(paddedEnlImage.size(), CV_8UC3);
+	cv::warpAffine(paddedEnlImage, normImage, affine, paddedEnlImage.size());
+
+	const cv::Rect unpaddedRect(pixelOffset, pixelOffset, normImage.cols - pixelOffset * 2, normImage.rows - pixelOffset * 2);
+
+	return normImage(unpaddedRect);
+}
+
+cv::Matx23f ArcFaceNormalizer::GetAlignment(const cv::Size& imageSize, const Face& face, const cv::Size& outputSize) const
+{
+	// landmarks are relative to the box, the box to the image and the template to the crop
+	const int pointCount = (int)std::min(face.landmarks.size(), (size_t)templatePointCount);
+	cv::Point2f imagePoints[templatePointCount];
+	cv::Point2f cropPoints[templatePointCount];
+	for (int i = 0; i < pointCount; i++)
+	{
+		imagePoints[i].x = (face.box.x + face.landmarks[i].x * face.box.width) * imageSize.width;
+		imagePoints[i].y = (face.box.y + face.landmarks[i].y * face.box.height) * imageSize.height;
+		cropPoints[i].x = _dstMap[i * 2] * outputSize.width;
+		cropPoints[i].y = _dstMap[i * 2 + 1] * outputSize.height;
+	}
+
+	return Umeyama::GetSimilarTransform(imagePoints, cropPoints, pointCount);
+}
+
+void ArcFaceNormalizer::RunForFaces(const int faceCount, const std::function<void(const int)>& task) const
+{
+	if (_threadPool != nullptr)
+	{
+		_threadPool->Run(faceCount, task);
+		return;
+	}
+
+	for (int i = 0; i < faceCount; i++)
+		task(i);
 }
\ No newline at end of file
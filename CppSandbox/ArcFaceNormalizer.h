@@ -3,15 +3,28 @@
 #include "Structs.h"
 #include "CvInclude.h"
 #include "Umeyama.h"
+#include "ThreadPool.h"
 
+// With a thread pool the faces of one call are normalized in parallel and the crops still come back in the order
+// of the faces. Without one an instance can be shared between threads, with one it serves a thread at a time like the pool.
 class ArcFaceNormalizer
 {
 private:
-	const cv::Size _lmArraySize = cv::Size(2, 5);
 	const std::vector<float> _dstMap = { 0.34191, 0.46157, 0.65653, 0.45983, 0.50022, 0.64050, 0.37097, 0.82469, 0.63151, 0.82325 };
 	//float dstMap[lmCount * lmPoints] = { 38.2946, 51.6963, 73.5318, 51.5014, 56.0252, 71.7366, 41.5493, 92.3655, 70.7299, 92.2041 };
-	Umeyama _transformer;
+	ThreadPool* _threadPool;
 
 public:
+	ArcFaceNormalizer(ThreadPool* threadPool = nullptr);
+	// crops at the resolution of the face in the image, the caller scales them to the network input
 	std::vector<cv::Mat> GetNormalizedFaces(const cv::Mat& image, const std::vector<Face>& faces) const;
+	// warps every face straight from the image into a crop of outputSize (112x112 for ArcFace, 96x96 for GenderAge),
+	// crop, alignment and scaling being one affine transform; pixels outside the image are black
+	std::vector<cv::Mat> GetAlignedFaces(const cv::Mat& image, const std::vector<Face>& faces, const cv::Size& outputSize) const;
+	// maps pixels of an image of imageSize to the aligned crop of the face
+	cv::Matx23f GetAlignment(const cv::Size& imageSize, const Face& face, const cv::Size& outputSize) const;
+
+private:
+	cv::Mat GetNormalizedFace(const cv::Mat& image, const Face& face) const;
+	void RunForFaces(const int faceCount, const std::function<void(const int)>& task) const;
 };
\ No newline at end of file
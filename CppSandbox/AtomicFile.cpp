@@ -0,0 +1,17 @@
+#include "AtomicFile.h"
+#include <cstdio>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+bool AtomicFile::Replace(const std::string& temporaryFilepath, const std::string& filepath)
+{
+#ifdef _WIN32
+	// rename() fails on Windows when the target exists
+	return MoveFileExA(temporaryFilepath.c_str(), filepath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(temporaryFilepath.c_str(), filepath.c_str()) == 0;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+// Files that readers may open at any time (metrics for a scraper, say) are written to a temporary file first
+// and then moved over the target in one step, so a reader sees either the old or the new content, never a partial file.
+class AtomicFile
+{
+public:
+	// moves temporaryFilepath over filepath, replacing it if it exists; false if the move failed
+	static bool Replace(const std::string& temporaryFilepath, const std::string& filepath);
+};
\ No newline at end of file
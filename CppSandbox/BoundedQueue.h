@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free multi-producer multi-consumer ring buffer (D. Vyukov's algorithm).
+// Every cell carries a sequence number telling whether it is ready for the next push or pop,
+// so producers and consumers only contend on their own position counter. TryPush/TryPop never block,
+// waiting and backpressure are left to the caller. T should be cheap to copy, e.g. a pointer.
+template <typename T>
+class BoundedQueue
+{
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	const size_t _capacity;
+	const size_t _mask;
+	std::unique_ptr<Cell[]> _cells;
+	alignas(64) std::atomic<size_t> _pushPosition;
+	alignas(64) std::atomic<size_t> _popPosition;
+
+public:
+	// capacity is rounded up to a power of two
+	BoundedQueue(const size_t capacity)
+		: _capacity(RoundUpToPowerOfTwo(capacity)), _mask(_capacity - 1), _cells(new Cell[_capacity]), _pushPosition(0), _popPosition(0)
+	{
+		for (size_t i = 0; i < _capacity; i++)
+			_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	bool TryPush(const T& value)
+	{
+		size_t position = _pushPosition.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		while (true)
+		{
+			cell = &_cells[position & _mask];
+			const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+			if (difference == 0)
+			{
+				if (_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+				return false; // full
+			else
+				position = _pushPosition.load(std::memory_order_relaxed);
+		}
+
+		cell->value = value;
+		cell->sequence.store(position + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	bool TryPop(T* value)
+	{
+		size_t position = _popPosition.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		while (true)
+		{
+			cell = &_cells[position & _mask];
+			const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+			if (difference == 0)
+			{
+				if (_popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+				return false; // empty
+			else
+				position = _popPosition.load(std::memory_order_relaxed);
+		}
+
+		*value = cell->value;
+		cell->sequence.store(position + _mask + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	size_t GetCapacity() const
+	{
+		return _capacity;
+	}
+
+	// approximate while other threads are pushing or popping
+	size_t GetSize() const
+	{
+		const size_t pushPosition = _pushPosition.load(std::memory_order_relaxed);
+		const size_t popPosition = _popPosition.load(std::memory_order_relaxed);
+
+		return pushPosition > popPosition ? pushPosition - popPosition : 0;
+	}
+
+private:
+	static size_t RoundUpToPowerOfTwo(const size_t value)
+	{
+		size_t result = 2;
+		while (result < value)
+			result <<= 1;
+
+		return result;
+	}
+};
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include "InlineVector.h"
 
-typedef std::vector<cv::Point2f> Landmarks;
\ No newline at end of file
+// RetinaFace and the ArcFace template both use five points, kept inside the Face
+typedef InlineVector<cv::Point2f, 5> Landmarks;
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "DetectionBatcher.h"
+
+DetectionBatcher::DetectionBatcher(Ort::Env& env, const std::string& modelFilepath, const DetectionBatcherConfig& config)
+	: _config(config), _detector(env, modelFilepath, NmsMethod::Auto, std::max(config.maxBatchSize, 1), config.inputSizes,
+		config.inferenceOptions),
+	_stopping(false),
+	_requestCount(0), _batchCount(0), _queueMicroseconds(0), _inferenceMicroseconds(0)
+{
+	_thread = std::thread(&DetectionBatcher::Run, this);
+}
+
+DetectionBatcher::~DetectionBatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_requestsAvailable.notify_all();
+
+	if (_thread.joinable())
+		_thread.join();
+}
+
+std::future<std::vector<Face>> DetectionBatcher::Detect(const cv::Mat& image, const int inputSizeIndex)
+{
+	DetectionRequest request;
+	request.image = image;
+	request.inputSizeIndex = inputSizeIndex;
+	request.submitTime = std::chrono::steady_clock::now();
+	std::future<std::vector<Face>> faces = request.faces.get_future();
+
+	bool batchFull;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_requests.emplace_back(std::move(request));
+		batchFull = _requests.size() == 1 || _requests.size() >= (size_t)_detector.GetMaxBatchSize();
+	}
+
+	// the batching thread only has to wake up for the first request of a batch and for a full one
+	if (batchFull)
+		_requestsAvailable.notify_one();
+
+	return faces;
+}
+
+DetectionBatcherStats DetectionBatcher::GetStats() const
+{
+	DetectionBatcherStats stats;
+	stats.requests = _requestCount;
+	stats.batches = _batchCount;
+	stats.queueMicroseconds = _queueMicroseconds;
+	stats.inferenceMicroseconds = _inferenceMicroseconds;
+
+	return stats;
+}
+
+void DetectionBatcher::Run()
+{
+	const size_t maxBatchSize = (size_t)_detector.GetMaxBatchSize();
+	const std::chrono::microseconds latencyWindow(std::max(_config.latencyWindowMicroseconds, 0));
+
+	std::vector<DetectionRequest> batch;
+	batch.reserve(maxBatchSize);
+	int inputSizeIndex = 0;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_requestsAvailable.wait(lock, [this]() { return _stopping || !_requests.empty(); });
+			if (_requests.empty())
+				return;
+
+			// the window is measured from the oldest request, so nobody waits longer than that for company
+			const std::chrono::steady_clock::time_point deadline = _requests.front().submitTime + latencyWindow;
+			_requestsAvailable.wait_until(lock, deadline, [this, maxBatchSize]() { return _stopping || _requests.size() >= maxBatchSize; });
+
+			inputSizeIndex = _requests.front().inputSizeIndex;
+			for (auto request = _requests.begin(); request != _requests.end() && batch.size() < maxBatchSize;)
+			{
+				if (request->inputSizeIndex != inputSizeIndex)
+				{
+					request++;
+					continue;
+				}
+
+				batch.emplace_back(std::move(*request));
+				request = _requests.erase(request);
+			}
+		}
+
+		RunBatch(batch, inputSizeIndex);
+		batch.clear();
+	}
+}
+
+void DetectionBatcher::RunBatch(std::vector<DetectionRequest>& batch, const int inputSizeIndex)
+{
+	const auto begin = std::chrono::steady_clock::now();
+
+	std::vector<cv::Mat> images;
+	images.reserve(batch.size());
+	for (DetectionRequest& request : batch)
+	{
+		images.emplace_back(request.image);
+		_queueMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(begin - request.submitTime).count();
+	}
+
+	try
+	{
+		std::vector<std::vector<Face>> faces = _detector.Detect(images, _config.detectionThreshold, _config.overlapThreshold,
+			inputSizeIndex);
+		for (size_t i = 0; i < batch.size(); i++)
+			batch[i].faces.set_value(std::move(faces[i]));
+	}
+	catch (...)
+	{
+		for (DetectionRequest& request : batch)
+			request.faces.set_exception(std::current_exception());
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+	_inferenceMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+	_requestCount += batch.size();
+	_batchCount++;
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "RetinaFaceDetector.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <chrono>
+#include <atomic>
+
+struct DetectionBatcherConfig
+{
+	int maxBatchSize = 4;
+	int latencyWindowMicroseconds = 5000; // how long the first request of a batch may wait for others
+	float detectionThreshold = 0.5f;
+	float overlapThreshold = 0.4f;
+	std::vector<cv::Size> inputSizes = { cv::Size(640, 640) }; // see RetinaFaceDetector
+	InferenceOptions inferenceOptions; // a batch is one Run(), intra-op threads are what spreads it over cores
+};
+
+struct DetectionBatcherStats
+{
+	uint64_t requests;
+	uint64_t batches;
+	uint64_t queueMicroseconds; // summed over requests, from Detect() to the start of their batch
+	uint64_t inferenceMicroseconds; // summed over batches
+};
+
+// Collects detection requests from any number of threads or streams and runs them through one detector
+// as batched inferences. A batch starts as soon as it is full or once its oldest request has waited for
+// the latency window, so a lone caller pays at most the window on top of a single-image detection.
+// Faces are scattered back to every caller through its future. Only requests for the same input size share a batch.
+class DetectionBatcher
+{
+private:
+	struct DetectionRequest
+	{
+		cv::Mat image;
+		int inputSizeIndex;
+		std::promise<std::vector<Face>> faces;
+		std::chrono::steady_clock::time_point submitTime;
+	};
+
+	const DetectionBatcherConfig _config;
+	RetinaFaceDetector _detector; // used by the batching thread only
+	std::mutex _mutex;
+	std::condition_variable _requestsAvailable;
+	std::deque<DetectionRequest> _requests;
+	bool _stopping;
+	std::atomic<uint64_t> _requestCount;
+	std::atomic<uint64_t> _batchCount;
+	std::atomic<uint64_t> _queueMicroseconds;
+	std::atomic<uint64_t> _inferenceMicroseconds;
+	std::thread _thread;
+
+public:
+	DetectionBatcher(Ort::Env& env, const std::string& modelFilepath, const DetectionBatcherConfig& config = DetectionBatcherConfig());
+	DetectionBatcher(const DetectionBatcher&) = delete;
+	DetectionBatcher& operator=(const DetectionBatcher&) = delete;
+	// requests that are already queued are still detected
+	~DetectionBatcher();
+
+	// the image has to stay unchanged until the future is ready
+	std::future<std::vector<Face>> Detect(const cv::Mat& image, const int inputSizeIndex = 0);
+
+	DetectionBatcherStats GetStats() const;
+
+private:
+	void Run();
+	void RunBatch(std::vector<DetectionRequest>& batch, const int inputSizeIndex);
+};
\ No newline at end of file
@@ -0,0 +1,339 @@
+#include "FaceGallery.h"
+#include "HalfFloat.h"
+#include "Int8Quantizer.h"
+#include "Utils.h"
+#include <fstream>
+#include <cstdio>
+
+namespace
+{
+	const char GalleryMagic[8] = { 'O', 'M', 'F', 'R', 'G', 'A', 'L', '\0' };
+	const size_t GalleryAlignment = 64;
+	const uint64_t ChecksumSeed = 0xcbf29ce484222325ull;
+	const uint64_t ChecksumPrime = 0x100000001b3ull;
+
+	// the sections are 64-byte aligned, so the image is hashed in whole 64-bit words
+	uint64_t GetImageChecksum(const unsigned char* data, const size_t size)
+	{
+		uint64_t checksum = (ChecksumSeed ^ size) * ChecksumPrime;
+		for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+		{
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			checksum = (checksum ^ word) * ChecksumPrime;
+		}
+
+		return checksum;
+	}
+}
+
+FaceGallery::FaceGallery()
+{
+	Detach();
+}
+
+FaceGallery::FaceGallery(FaceGallery&& other)
+{
+	Detach();
+	*this = std::move(other);
+}
+
+FaceGallery& FaceGallery::operator=(FaceGallery&& other)
+{
+	if (this == &other)
+		return *this;
+
+	// both the mapping and the vector keep their buffers when moved, so the views stay valid
+	_file = std::move(other._file);
+	_ownedImage = std::move(other._ownedImage);
+	_image = other._image;
+	_imageSize = other._imageSize;
+	_header = other._header;
+	other.Detach();
+
+	return *this;
+}
+
+bool FaceGallery::Load(const std::string& filepath)
+{
+	Detach();
+	_ownedImage.clear();
+
+	if (!_file.Open(filepath))
+	{
+		std::cout << "failed to map gallery file " << filepath << std::endl;
+		return false;
+	}
+
+	if (!Attach(_file.GetData(), _file.GetSize()))
+	{
+		std::cout << "gallery file " << filepath << " is corrupted or has an unsupported version" << std::endl;
+		_file.Close();
+		return false;
+	}
+
+	return true;
+}
+
+void FaceGallery::Build(const std::vector<std::string>& labels, const std::vector<FaceIndex>& indexes, const int dimension,
+	const EmbeddingType type)
+{
+	Detach();
+	_file.Close();
+
+	std::vector<size_t> validRows;
+	validRows.reserve(indexes.size());
+	for (size_t i = 0; i < indexes.size() && i < labels.size(); i++)
+	{
+		if (indexes[i].size() == dimension)
+			validRows.emplace_back(i);
+		else
+			std::cout << "skipping gallery entry " << labels[i] << ": index size " << indexes[i].size() << std::endl;
+	}
+
+	const size_t count = validRows.size();
+	const size_t rowStride = AlignUp(GetRowSize(type, dimension), GetRowAlignment(type));
+	const size_t embeddingsOffset = AlignUp(sizeof(GalleryHeader), GalleryAlignment);
+	const size_t labelOffsetsOffset = AlignUp(embeddingsOffset + count * rowStride, GalleryAlignment);
+	const size_t labelsOffset = AlignUp(labelOffsetsOffset + (count + 1) * sizeof(uint64_t), GalleryAlignment);
+
+	size_t labelsSize = 0;
+	for (const size_t row : validRows)
+		labelsSize += labels[row].size() + 1;
+
+	const size_t imageSize = AlignUp(labelsOffset + labelsSize, GalleryAlignment);
+
+	_ownedImage.assign(imageSize + GalleryAlignment, 0);
+	const size_t misalignment = (size_t)_ownedImage.data() % GalleryAlignment;
+	unsigned char* image = _ownedImage.data() + (misalignment == 0 ? 0 : GalleryAlignment - misalignment);
+
+	GalleryHeader* header = (GalleryHeader*)image;
+	std::memcpy(header->magic, GalleryMagic, sizeof(GalleryMagic));
+	header->version = _version;
+	header->embeddingType = (uint32_t)type;
+	header->dimension = dimension;
+	header->flags = _normalizedFlag;
+	header->count = count;
+	header->rowStride = rowStride;
+	header->embeddingsOffset = embeddingsOffset;
+	header->labelOffsetsOffset = labelOffsetsOffset;
+	header->labelsOffset = labelsOffset;
+
+	std::vector<float> normalized(dimension);
+	uint64_t* labelOffsets = (uint64_t*)(image + labelOffsetsOffset);
+	char* labelTable = (char*)(image + labelsOffset);
+	uint64_t labelOffset = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const FaceIndex& index = indexes[validRows[i]];
+
+		float norm = 0;
+		for (const float value : index)
+			norm += value * value;
+		const float inverseNorm = norm > 0 ? 1 / std::sqrt(norm) : 0;
+		for (int j = 0; j < dimension; j++)
+			normalized[j] = index[j] * inverseNorm;
+
+		unsigned char* row = image + embeddingsOffset + i * rowStride;
+		if (type == EmbeddingType::Float16)
+			HalfFloat::FromFloat(normalized.data(), (uint16_t*)row, dimension);
+		else if (type == EmbeddingType::Int8)
+			Int8Quantizer::QuantizeRow(normalized.data(), row, dimension);
+		else
+			std::memcpy(row, normalized.data(), dimension * sizeof(float));
+
+		const std::string& label = labels[validRows[i]];
+		labelOffsets[i] = labelOffset;
+		std::memcpy(labelTable + labelOffset, label.c_str(), label.size() + 1);
+		labelOffset += label.size() + 1;
+	}
+	labelOffsets[count] = labelOffset;
+	header->checksum = GetImageChecksum(image + embeddingsOffset, imageSize - embeddingsOffset);
+
+	Attach(image, imageSize);
+}
+
+bool FaceGallery::Save(const std::string& filepath) const
+{
+	if (_image == nullptr)
+		return false;
+
+	std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "failed to open " << filepath << " for writing" << std::endl;
+		return false;
+	}
+
+	file.write((const char*)_image, _imageSize);
+
+	return file.good();
+}
+
+bool FaceGallery::Append(const std::string& filepath, const std::vector<std::string>& labels, const std::vector<FaceIndex>& indexes)
+{
+	std::vector<std::string> allLabels;
+	std::vector<FaceIndex> allIndexes;
+	int dimension = indexes.empty() ? 0 : (int)indexes[0].size();
+	EmbeddingType type = EmbeddingType::Float32;
+
+	{
+		// the existing mapping has to be released before the file is replaced
+		FaceGallery existing;
+		if (fs::exists(filepath))
+		{
+			// rebuilding from the new entries alone would drop every enrolled identity
+			if (!existing.Load(filepath))
+			{
+				std::cout << "gallery " << filepath << " exists but cannot be loaded, not appending to it" << std::endl;
+				return false;
+			}
+
+			dimension = existing.GetDimension();
+			type = existing.GetEmbeddingType();
+
+			const size_t count = existing.GetCount();
+			allLabels.reserve(count + labels.size());
+			allIndexes.reserve(count + indexes.size());
+			for (size_t i = 0; i < count; i++)
+			{
+				FaceIndex index(dimension);
+				existing.ReadEmbedding(i, index.data());
+				allIndexes.emplace_back(index);
+				allLabels.emplace_back(existing.GetLabel(i));
+			}
+		}
+	}
+
+	allLabels.insert(allLabels.end(), labels.begin(), labels.end());
+	allIndexes.insert(allIndexes.end(), indexes.begin(), indexes.end());
+
+	FaceGallery merged;
+	merged.Build(allLabels, allIndexes, dimension, type);
+
+	const std::string& temporaryFilepath = filepath + ".tmp";
+	if (!merged.Save(temporaryFilepath))
+		return false;
+
+	std::remove(filepath.c_str());
+
+	return std::rename(temporaryFilepath.c_str(), filepath.c_str()) == 0;
+}
+
+size_t FaceGallery::GetCount() const
+{
+	return _header == nullptr ? 0 : (size_t)_header->count;
+}
+
+int FaceGallery::GetDimension() const
+{
+	return _header == nullptr ? 0 : (int)_header->dimension;
+}
+
+EmbeddingType FaceGallery::GetEmbeddingType() const
+{
+	return _header == nullptr ? EmbeddingType::Float32 : (EmbeddingType)_header->embeddingType;
+}
+
+size_t FaceGallery::GetRowStride() const
+{
+	return _header == nullptr ? 0 : (size_t)_header->rowStride;
+}
+
+const void* FaceGallery::GetEmbeddingData(const size_t row) const
+{
+	return _image + _header->embeddingsOffset + row * _header->rowStride;
+}
+
+const char* FaceGallery::GetLabel(const size_t row) const
+{
+	const uint64_t* labelOffsets = (const uint64_t*)(_image + _header->labelOffsetsOffset);
+
+	return (const char*)(_image + _header->labelsOffset + labelOffsets[row]);
+}
+
+void FaceGallery::ReadEmbedding(const size_t row, float* destination) const
+{
+	const void* data = GetEmbeddingData(row);
+
+	if (GetEmbeddingType() == EmbeddingType::Float16)
+		HalfFloat::ToFloat((const uint16_t*)data, destination, GetDimension());
+	else if (GetEmbeddingType() == EmbeddingType::Int8)
+		Int8Quantizer::Dequantize((const unsigned char*)data, destination, GetDimension());
+	else
+		std::memcpy(destination, data, GetDimension() * sizeof(float));
+}
+
+bool FaceGallery::IsEmpty() const
+{
+	return GetCount() == 0;
+}
+
+uint64_t FaceGallery::GetChecksum() const
+{
+	return _header == nullptr ? 0 : _header->checksum;
+}
+
+bool FaceGallery::Attach(const unsigned char* image, const size_t imageSize)
+{
+	if (imageSize < sizeof(GalleryHeader))
+		return false;
+
+	const GalleryHeader* header = (const GalleryHeader*)image;
+	if (std::memcmp(header->magic, GalleryMagic, sizeof(GalleryMagic)) != 0 || header->version != _version)
+		return false;
+
+	if (header->embeddingType > (uint32_t)EmbeddingType::Int8)
+		return false;
+
+	const EmbeddingType type = (EmbeddingType)header->embeddingType;
+	const uint64_t rowSize = GetRowSize(type, header->dimension);
+	const bool layoutOk = header->rowStride >= rowSize && header->embeddingsOffset % GalleryAlignment == 0
+		&& header->rowStride % GetRowAlignment(type) == 0
+		&& header->embeddingsOffset + header->count * header->rowStride <= header->labelOffsetsOffset
+		&& header->labelOffsetsOffset + (header->count + 1) * sizeof(uint64_t) <= header->labelsOffset
+		&& header->labelsOffset <= imageSize;
+	if (!layoutOk)
+		return false;
+
+	const uint64_t* labelOffsets = (const uint64_t*)(image + header->labelOffsetsOffset);
+	if (header->labelsOffset + labelOffsets[header->count] > imageSize)
+		return false;
+
+	_image = image;
+	_imageSize = imageSize;
+	_header = header;
+
+	return true;
+}
+
+void FaceGallery::Detach()
+{
+	_image = nullptr;
+	_imageSize = 0;
+	_header = nullptr;
+}
+
+size_t FaceGallery::GetRowSize(const EmbeddingType type, const size_t dimension)
+{
+	switch (type)
+	{
+	case EmbeddingType::Float16:
+		return dimension * sizeof(uint16_t);
+	case EmbeddingType::Int8:
+		return Int8Quantizer::GetRowSize(dimension);
+	default:
+		return dimension * sizeof(float);
+	}
+}
+
+size_t FaceGallery::GetRowAlignment(const EmbeddingType type)
+{
+	return type == EmbeddingType::Int8 ? 16 : GalleryAlignment;
+}
+
+size_t FaceGallery::AlignUp(const size_t value, const size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Structs.h"
+#include "MappedFile.h"
+#include <cstdint>
+
+enum class EmbeddingType : uint32_t
+{
+	Float32 = 0,
+	Float16 = 1,
+	Int8 = 2 // per-row scale, see Int8Quantizer
+};
+
+// On-disk layout, little endian, every section 64-byte aligned:
+// header | embedding matrix (count rows of rowStride bytes, L2-normalized) | uint64 label offsets[count + 1] | label strings
+// Float rows are 64-byte aligned, int8 rows only 16-byte aligned to keep the per-row scale from costing a whole cache line.
+struct GalleryHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t embeddingType;
+	uint32_t dimension;
+	uint32_t flags;
+	uint64_t count;
+	uint64_t rowStride;
+	uint64_t embeddingsOffset;
+	uint64_t labelOffsetsOffset;
+	uint64_t labelsOffset;
+	uint64_t checksum; // FNV-1a over everything after the header, ties derived files such as ANN indexes to this gallery
+};
+
+// Face identities with their embeddings in one contiguous, versioned binary image.
+// A loaded gallery is a read-only memory mapping of the file, nothing is parsed or copied;
+// a built gallery holds the same image in memory and can be saved as is.
+class FaceGallery
+{
+private:
+	static const uint32_t _version = 2;
+	static const uint32_t _normalizedFlag = 1;
+	MappedFile _file;
+	std::vector<unsigned char> _ownedImage;
+	const unsigned char* _image;
+	size_t _imageSize;
+	const GalleryHeader* _header;
+
+public:
+	FaceGallery();
+	FaceGallery(const FaceGallery&) = delete;
+	FaceGallery& operator=(const FaceGallery&) = delete;
+	FaceGallery(FaceGallery&& other);
+	FaceGallery& operator=(FaceGallery&& other);
+
+	bool Load(const std::string& filepath);
+	void Build(const std::vector<std::string>& labels, const std::vector<FaceIndex>& indexes, const int dimension,
+		const EmbeddingType type = EmbeddingType::Float32);
+	bool Save(const std::string& filepath) const;
+	static bool Append(const std::string& filepath, const std::vector<std::string>& labels, const std::vector<FaceIndex>& indexes);
+
+	size_t GetCount() const;
+	int GetDimension() const;
+	EmbeddingType GetEmbeddingType() const;
+	size_t GetRowStride() const;
+	const void* GetEmbeddingData(const size_t row) const;
+	const char* GetLabel(const size_t row) const;
+	void ReadEmbedding(const size_t row, float* destination) const;
+	bool IsEmpty() const;
+	uint64_t GetChecksum() const;
+
+private:
+	bool Attach(const unsigned char* image, const size_t imageSize);
+	void Detach();
+	static size_t GetRowSize(const EmbeddingType type, const size_t dimension);
+	static size_t GetRowAlignment(const EmbeddingType type);
+	static size_t AlignUp(const size_t value, const size_t alignment);
+};
\ No newline at end of file
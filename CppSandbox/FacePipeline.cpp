@@ -0,0 +1,479 @@
+#include "FacePipeline.h"
+#include "RetinaFaceDetector.h"
+#include "ArcFaceNormalizer.h"
+#include "ArcFace50Indexer.h"
+#include "GenderAgeAnalyzer.h"
+#include "GallerySearcher.h"
+#include "ThreadAffinity.h"
+#include "Metrics.h"
+#include <numeric>
+
+namespace
+{
+	enum PipelineStage
+	{
+		Detection = 0,
+		Normalization = 1,
+		Indexing = 2,
+		Attributes = 3,
+		Matching = 4
+	};
+}
+
+FacePipeline::FacePipeline(Ort::Env& env, const FacePipelineConfig& config, const FaceGallery& gallery, const FrameCallback& callback)
+	: _env(env), _config(config), _gallery(gallery), _callback(callback), _stopping(true), _nextFrameId(0), _submittedFrames(0),
+	_completedFrames(0), _droppedFrames(0), _failedFrames(0), _readyWorkers(0), _failedWorkers(0), _fullDetections(0), _detectedFaces(0),
+	_recognizedFaces(0)
+{
+	for (int stage = 0; stage < StageCount; stage++)
+	{
+		_queues.emplace_back(new FrameQueue(std::max(config.queueCapacity, 1)));
+		_processedFrames[stage] = 0;
+		_busyMicroseconds[stage] = 0;
+	}
+
+	if (config.enableTracking)
+		_tracker.reset(new FaceTracker(config.trackerConfig));
+}
+
+FacePipeline::~FacePipeline()
+{
+	Stop();
+}
+
+bool FacePipeline::Start()
+{
+	if (!_workers.empty())
+		return true;
+
+	try
+	{
+		if (_config.detectionBatchSize > 1)
+		{
+			DetectionBatcherConfig batcherConfig;
+			batcherConfig.maxBatchSize = _config.detectionBatchSize;
+			batcherConfig.latencyWindowMicroseconds = _config.detectionLatencyWindowMicroseconds;
+			batcherConfig.detectionThreshold = _config.detectionThreshold;
+			batcherConfig.overlapThreshold = _config.overlapThreshold;
+			batcherConfig.inputSizes = GetDetectionInputSizes();
+			batcherConfig.inferenceOptions = _config.inferenceOptions;
+			_detectionBatcher.reset(new DetectionBatcher(_env, _config.detectorModelFilepath, batcherConfig));
+		}
+	}
+	catch (const std::exception& exception)
+	{
+		std::cout << "failed to create the batched detector: " << exception.what() << std::endl;
+		return false;
+	}
+
+	_stopping = false;
+	_readyWorkers = 0;
+	_failedWorkers = 0;
+
+	for (int i = 0; i < std::max(_config.detectionWorkerCount, 1); i++)
+		StartWorker(&FacePipeline::RunDetectionWorker);
+	for (int i = 0; i < std::max(_config.normalizationWorkerCount, 1); i++)
+		StartWorker(&FacePipeline::RunNormalizationWorker);
+	for (int i = 0; i < std::max(_config.indexingWorkerCount, 1); i++)
+		StartWorker(&FacePipeline::RunIndexingWorker);
+	for (int i = 0; i < std::max(_config.attributeWorkerCount, 1); i++)
+		StartWorker(&FacePipeline::RunAttributeWorker);
+	for (int i = 0; i < std::max(_config.matchingWorkerCount, 1); i++)
+		StartWorker(&FacePipeline::RunMatchingWorker);
+
+	int attempt = 0;
+	while (_readyWorkers + _failedWorkers < (int)_workers.size())
+		Backoff(&attempt);
+
+	if (_failedWorkers == 0)
+		return true;
+
+	// nothing was submitted yet, so there is nothing to flush
+	_stopping = true;
+	for (std::thread& worker : _workers)
+		worker.join();
+	_workers.clear();
+
+	return false;
+}
+
+bool FacePipeline::Submit(const cv::Mat& image, const int streamId)
+{
+	if (_stopping)
+		return false;
+
+	PipelineFrame* frame = new PipelineFrame();
+	frame->id = _nextFrameId++;
+	frame->streamId = streamId;
+	frame->image = image;
+	frame->submitTime = std::chrono::steady_clock::now();
+	_submittedFrames++;
+
+	FrameQueue& queue = *_queues[Detection];
+	int attempt = 0;
+
+	while (!queue.TryPush(frame))
+	{
+		switch (_config.dropPolicy)
+		{
+		case FrameDropPolicy::DropNewest:
+			delete frame;
+			_droppedFrames++;
+			Metrics::Get().AddCount(MetricCounter::FramesDropped);
+			return false;
+		case FrameDropPolicy::DropOldest:
+		{
+			PipelineFrame* oldestFrame = nullptr;
+			if (queue.TryPop(&oldestFrame))
+			{
+				delete oldestFrame;
+				_droppedFrames++;
+				Metrics::Get().AddCount(MetricCounter::FramesDropped);
+			}
+			break;
+		}
+		default:
+			Backoff(&attempt);
+			break;
+		}
+	}
+	Metrics::Get().SetQueueDepth(Detection, queue.GetSize());
+
+	return true;
+}
+
+void FacePipeline::Flush()
+{
+	int attempt = 0;
+	while (_completedFrames + _failedFrames + _droppedFrames < _submittedFrames)
+		Backoff(&attempt);
+}
+
+void FacePipeline::Stop()
+{
+	if (_workers.empty())
+		return;
+
+	Flush();
+	_stopping = true;
+
+	for (std::thread& worker : _workers)
+		worker.join();
+	_workers.clear();
+}
+
+FacePipelineStats FacePipeline::GetStats() const
+{
+	FacePipelineStats stats;
+	stats.submittedFrames = _submittedFrames;
+	stats.completedFrames = _completedFrames;
+	stats.droppedFrames = _droppedFrames;
+	stats.failedFrames = _failedFrames;
+	stats.detectionBatches = _detectionBatcher ? _detectionBatcher->GetStats().batches : (uint64_t)_processedFrames[Detection];
+	stats.fullDetections = _fullDetections;
+	stats.detectedFaces = _detectedFaces;
+	stats.recognizedFaces = _recognizedFaces;
+	for (int stage = 0; stage < StageCount; stage++)
+	{
+		stats.processedFrames[stage] = _processedFrames[stage];
+		stats.busyMicroseconds[stage] = _busyMicroseconds[stage];
+	}
+
+	return stats;
+}
+
+const char* FacePipeline::GetStageName(const int stage)
+{
+	const char* names[StageCount] = { "detection", "normalization", "indexing", "attributes", "matching" };
+
+	return stage >= 0 && stage < StageCount ? names[stage] : "unknown";
+}
+
+// workers are pinned round robin in start order, detection workers get the first cores
+void FacePipeline::StartWorker(void (FacePipeline::*run)())
+{
+	const int core = (int)_workers.size();
+
+	_workers.emplace_back([this, run, core]()
+	{
+		if (_config.pinWorkerThreads)
+			ThreadAffinity::PinCurrentThread(core);
+
+		// frames are failed one by one inside the stage, only creating the models can end up here
+		try
+		{
+			(this->*run)();
+		}
+		catch (const std::exception& exception)
+		{
+			std::cout << "failed to start a pipeline worker: " << exception.what() << std::endl;
+			_failedWorkers++;
+		}
+	});
+}
+
+// models are created inside the worker threads, every worker owns its instances
+void FacePipeline::RunDetectionWorker()
+{
+	if (_detectionBatcher)
+	{
+		// the worker only waits for its frame's batch, the batcher owns the detector;
+		// region crops would not batch with whole frames, so reduced passes always cover the whole frame here
+		RunStage(Detection, [this](PipelineFrame& frame)
+		{
+			frame.faces = _detectionBatcher->Detect(frame.image, IsFullDetectionPass(frame) ? 0 : 1).get();
+			SelectFacesToRecognize(frame);
+		});
+
+		return;
+	}
+
+	RetinaFaceDetector detector(_env, _config.detectorModelFilepath, NmsMethod::Auto, 1, GetDetectionInputSizes(),
+		_config.inferenceOptions);
+
+	RunStage(Detection, [this, &detector](PipelineFrame& frame)
+	{
+		if (IsFullDetectionPass(frame))
+			frame.faces = detector.Detect(frame.image, _config.detectionThreshold, _config.overlapThreshold);
+		else
+		{
+			const std::vector<cv::Rect2f>& regions = _tracker && _config.detectTrackedRegions
+				? _tracker->GetTrackedBoxes(frame.streamId) : std::vector<cv::Rect2f>();
+			frame.faces = regions.empty() ? detector.Detect(frame.image, _config.detectionThreshold, _config.overlapThreshold, 1)
+				: detector.DetectInRegions(frame.image, regions, _config.detectionThreshold, _config.overlapThreshold, 1);
+		}
+
+		SelectFacesToRecognize(frame);
+	});
+}
+
+void FacePipeline::RunNormalizationWorker()
+{
+	const std::unique_ptr<ThreadPool> threadPool(_config.normalizationThreadCount > 1
+		? new ThreadPool(_config.normalizationThreadCount) : nullptr);
+	const ArcFaceNormalizer normalizer(threadPool.get());
+	const cv::Size arcFaceTargetSize(112, 112);
+
+	RunStage(Normalization, [&normalizer, &arcFaceTargetSize](PipelineFrame& frame)
+	{
+		if (frame.recognizedFaces.size() == frame.faces.size())
+		{
+			frame.normalizedFaces = normalizer.GetAlignedFaces(frame.image, frame.faces, arcFaceTargetSize);
+			return;
+		}
+
+		std::vector<Face> recognizedFaces;
+		recognizedFaces.reserve(frame.recognizedFaces.size());
+		for (const size_t i : frame.recognizedFaces)
+			recognizedFaces.emplace_back(frame.faces[i]);
+
+		frame.normalizedFaces = normalizer.GetAlignedFaces(frame.image, recognizedFaces, arcFaceTargetSize);
+	});
+}
+
+void FacePipeline::RunIndexingWorker()
+{
+	ArcFace50Indexer indexer(_env, _config.indexerModelFilepath, _config.maxIndexingBatchSize, _config.inferenceOptions);
+
+	RunStage(Indexing, [&indexer](PipelineFrame& frame)
+	{
+		const size_t faceCount = frame.recognizedFaces.size();
+		for (size_t i = 0; i < faceCount; i++)
+			frame.faces[frame.recognizedFaces[i]].normImage = frame.normalizedFaces[i];
+
+		std::vector<FaceIndex> indexes = indexer.GetIndexes(frame.normalizedFaces);
+		for (size_t i = 0; i < faceCount; i++)
+			frame.faces[frame.recognizedFaces[i]].index = std::move(indexes[i]);
+	});
+}
+
+void FacePipeline::RunAttributeWorker()
+{
+	GenderAgeAnalyzer analyzer(_env, _config.genderAgeModelFilepath, _config.maxAttributeBatchSize, _config.inferenceOptions);
+
+	RunStage(Attributes, [&analyzer](PipelineFrame& frame)
+	{
+		// the crops the indexer got, in the order of the recognized faces
+		const std::vector<GenderAgeAttributes>& attributes = analyzer.GetAttributes(frame.normalizedFaces);
+		for (size_t i = 0; i < frame.recognizedFaces.size(); i++)
+		{
+			Face& face = frame.faces[frame.recognizedFaces[i]];
+			face.gender = attributes[i].first;
+			face.age = attributes[i].second;
+		}
+	});
+}
+
+void FacePipeline::RunMatchingWorker()
+{
+	GallerySearcher searcher(_gallery);
+
+	RunStage(Matching, [this, &searcher](PipelineFrame& frame)
+	{
+		// tracked faces are matched with the average embedding of their track, which is steadier than a single view
+		std::vector<FaceIndex> probes;
+		probes.reserve(frame.recognizedFaces.size());
+		for (const size_t i : frame.recognizedFaces)
+		{
+			const Face& face = frame.faces[i];
+			probes.emplace_back(_tracker ? _tracker->AddEmbedding(frame.streamId, face.trackId, face.index) : face.index);
+		}
+
+		const std::vector<std::vector<GalleryMatch>>& matches = searcher.Search(probes, 1, _config.comparisonThreshold);
+		for (size_t i = 0; i < frame.recognizedFaces.size(); i++)
+		{
+			Face& face = frame.faces[frame.recognizedFaces[i]];
+			if (!matches[i].empty())
+			{
+				face.label = _gallery.GetLabel(matches[i][0].row);
+				face.similarity = matches[i][0].similarity;
+			}
+
+			if (_tracker)
+				_tracker->SetResult(frame.streamId, face.trackId, face);
+		}
+
+		if (!_tracker || frame.recognizedFaces.size() == frame.faces.size())
+			return;
+
+		// the rest take the latest result of their track, if it has one yet
+		std::vector<bool> recognized(frame.faces.size(), false);
+		for (const size_t i : frame.recognizedFaces)
+			recognized[i] = true;
+
+		for (size_t i = 0; i < frame.faces.size(); i++)
+		{
+			if (!recognized[i])
+				_tracker->GetResult(frame.streamId, frame.faces[i].trackId, &frame.faces[i]);
+		}
+	});
+}
+
+void FacePipeline::RunStage(const int stage, const std::function<void(PipelineFrame&)>& process)
+{
+	FrameQueue& queue = *_queues[stage];
+	int attempt = 0;
+
+	// the models of this worker exist by now
+	_readyWorkers++;
+
+	while (true)
+	{
+		PipelineFrame* frame = nullptr;
+		if (!queue.TryPop(&frame))
+		{
+			// Stop() flushes first, so an empty queue after stopping stays empty
+			if (_stopping)
+				return;
+
+			Backoff(&attempt);
+			continue;
+		}
+
+		attempt = 0;
+		Metrics::Get().SetQueueDepth(stage, queue.GetSize());
+
+		// a failed frame still travels to the callback, so whoever counts frames in flight gets it back
+		if (!frame->failed)
+		{
+			const auto begin = std::chrono::steady_clock::now();
+			try
+			{
+				process(*frame);
+			}
+			catch (const std::exception& exception)
+			{
+				std::cout << GetStageName(stage) << " failed on frame " << frame->id << " of stream " << frame->streamId << ": "
+					<< exception.what() << std::endl;
+				frame->failed = true;
+			}
+			const auto end = std::chrono::steady_clock::now();
+			_busyMicroseconds[stage] += std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+			_processedFrames[stage]++;
+		}
+
+		Forward(stage, frame);
+	}
+}
+
+// the full input size first, then the reduced one if there is one
+std::vector<cv::Size> FacePipeline::GetDetectionInputSizes() const
+{
+	std::vector<cv::Size> inputSizes = { _config.detectionInputSize };
+	if (_config.reducedDetectionInputSize.area() > 0)
+		inputSizes.emplace_back(_config.reducedDetectionInputSize);
+
+	return inputSizes;
+}
+
+bool FacePipeline::IsFullDetectionPass(const PipelineFrame& frame)
+{
+	bool fullPass = true;
+	if (_config.reducedDetectionInputSize.area() > 0)
+	{
+		std::lock_guard<std::mutex> lock(_streamFramesMutex);
+		fullPass = _streamFrames[frame.streamId]++ % std::max(_config.fullDetectionInterval, 1) == 0;
+	}
+
+	if (fullPass)
+		_fullDetections++;
+
+	return fullPass;
+}
+
+void FacePipeline::SelectFacesToRecognize(PipelineFrame& frame)
+{
+	if (_tracker)
+		frame.recognizedFaces = _tracker->Update(frame.streamId, frame.id, &frame.faces);
+	else
+	{
+		frame.recognizedFaces.resize(frame.faces.size());
+		std::iota(frame.recognizedFaces.begin(), frame.recognizedFaces.end(), 0);
+	}
+
+	_detectedFaces += frame.faces.size();
+	_recognizedFaces += frame.recognizedFaces.size();
+}
+
+void FacePipeline::Forward(const int stage, PipelineFrame* frame)
+{
+	if (stage == StageCount - 1)
+	{
+		const bool failed = frame->failed;
+		if (failed)
+			Metrics::Get().AddCount(MetricCounter::FramesFailed);
+		else
+		{
+			Metrics::Get().RecordStage(MetricStage::Frame, frame->submitTime, std::chrono::steady_clock::now());
+			Metrics::Get().AddCount(MetricCounter::FramesCompleted);
+		}
+
+		_callback(std::unique_ptr<PipelineFrame>(frame));
+		if (failed)
+			_failedFrames++;
+		else
+			_completedFrames++;
+		return;
+	}
+
+	// frames already in flight are never dropped, a full queue stalls this stage instead
+	FrameQueue& nextQueue = *_queues[stage + 1];
+	int attempt = 0;
+	while (!nextQueue.TryPush(frame))
+		Backoff(&attempt);
+	Metrics::Get().SetQueueDepth(stage + 1, nextQueue.GetSize());
+}
+
+// spin briefly, then yield, then sleep, so idle stages do not burn a core
+void FacePipeline::Backoff(int* attempt)
+{
+	(*attempt)++;
+
+	if (*attempt < 64)
+		return;
+
+	if (*attempt < 128)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+}
\ No newline at end of file
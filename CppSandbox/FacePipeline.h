@@ -0,0 +1,160 @@
+#pragma once
+
+#include "Structs.h"
+#include "BoundedQueue.h"
+#include "FaceGallery.h"
+#include "DetectionBatcher.h"
+#include "FaceTracker.h"
+#include <onnxruntime_cxx_api.h>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <map>
+
+enum class FrameDropPolicy
+{
+	Block = 0, // Submit waits for space, backpressure reaches the producer
+	DropNewest = 1, // the submitted frame is rejected while the pipeline is full
+	DropOldest = 2 // the oldest frame waiting for detection is discarded to make room
+};
+
+struct FacePipelineConfig
+{
+	std::string detectorModelFilepath;
+	std::string indexerModelFilepath;
+	std::string genderAgeModelFilepath;
+	int detectionWorkerCount = 1;
+	// above 1 the detection workers share one batched detector instead of owning one each,
+	// so it only pays off with about as many detection workers as the batch size
+	int detectionBatchSize = 1;
+	int detectionLatencyWindowMicroseconds = 5000;
+	cv::Size detectionInputSize = cv::Size(640, 640);
+	// when set (e.g. 320x320) frames are detected at this size and only every fullDetectionInterval-th frame
+	// of a stream gets a full size pass; with tracking and detectTrackedRegions the reduced passes only look
+	// around tracked faces, new faces are then found by the next full pass
+	cv::Size reducedDetectionInputSize = cv::Size(0, 0);
+	int fullDetectionInterval = 10;
+	bool detectTrackedRegions = false;
+	int normalizationWorkerCount = 1;
+	// above 1 every normalization worker spreads the faces of its frame over this many threads,
+	// which shortens the latency of crowded frames rather than adding throughput
+	int normalizationThreadCount = 1;
+	int indexingWorkerCount = 1;
+	int attributeWorkerCount = 1;
+	int matchingWorkerCount = 1;
+	int queueCapacity = 4;
+	FrameDropPolicy dropPolicy = FrameDropPolicy::Block;
+	float detectionThreshold = 0.5f;
+	float overlapThreshold = 0.4f;
+	float comparisonThreshold = 0.3f;
+	int maxIndexingBatchSize = 32;
+	int maxAttributeBatchSize = 32;
+	// every model instance is used by its own worker thread only; the defaults run each inference on the
+	// thread of its worker, so worker counts decide how many cores are busy, and pinning keeps each worker on one core.
+	// Fewer workers with more intra-op threads favour the latency of single frames instead.
+	InferenceOptions inferenceOptions;
+	bool pinWorkerThreads = false;
+	// with tracking only new faces and the periodic or better views of known ones are indexed and analyzed,
+	// the others reuse the results of their track
+	bool enableTracking = false;
+	FaceTrackerConfig trackerConfig;
+};
+
+struct PipelineFrame
+{
+	uint64_t id;
+	int streamId;
+	cv::Mat image;
+	std::vector<Face> faces;
+	std::vector<size_t> recognizedFaces; // faces that go through normalization, indexing, attributes and matching
+	std::vector<cv::Mat> normalizedFaces; // one aligned 112x112 crop per recognized face
+	std::chrono::steady_clock::time_point submitTime;
+	bool failed; // a stage threw on the frame, the later stages passed it on untouched and its faces may be incomplete
+};
+
+struct FacePipelineStats
+{
+	uint64_t submittedFrames;
+	uint64_t completedFrames;
+	uint64_t droppedFrames;
+	uint64_t failedFrames;
+	uint64_t detectionBatches; // equals the detected frames without batching
+	uint64_t fullDetections; // frames detected at the full input size
+	uint64_t detectedFaces;
+	uint64_t recognizedFaces;
+	uint64_t processedFrames[5]; // per stage
+	uint64_t busyMicroseconds[5]; // per stage, summed over its workers
+};
+
+// Detection -> normalization -> indexing -> attributes -> matching, every stage with its own worker threads
+// and its own model instances, connected by bounded lock-free queues. While frame N is indexed and matched,
+// frame N + 1 is already being detected, so throughput is set by the slowest stage instead of the sum of all.
+// A full queue stalls the stage that feeds it; the drop policy decides what happens at the input.
+// With more than one worker per stage frames may complete out of order, PipelineFrame::id tells them apart.
+// A stage that throws on a frame only fails that frame, it still reaches the callback with PipelineFrame::failed set.
+class FacePipeline
+{
+public:
+	typedef std::function<void(std::unique_ptr<PipelineFrame>)> FrameCallback;
+	static const int StageCount = 5;
+
+private:
+	typedef BoundedQueue<PipelineFrame*> FrameQueue;
+
+	Ort::Env& _env;
+	const FacePipelineConfig _config;
+	const FaceGallery& _gallery;
+	const FrameCallback _callback;
+	std::vector<std::unique_ptr<FrameQueue>> _queues; // input queue of each stage
+	std::unique_ptr<DetectionBatcher> _detectionBatcher;
+	std::unique_ptr<FaceTracker> _tracker;
+	std::vector<std::thread> _workers;
+	std::mutex _streamFramesMutex;
+	std::map<int, uint64_t> _streamFrames; // detected frames per stream
+	std::atomic<bool> _stopping;
+	std::atomic<uint64_t> _nextFrameId;
+	std::atomic<uint64_t> _submittedFrames;
+	std::atomic<uint64_t> _completedFrames;
+	std::atomic<uint64_t> _droppedFrames;
+	std::atomic<uint64_t> _failedFrames;
+	std::atomic<int> _readyWorkers;
+	std::atomic<int> _failedWorkers;
+	std::atomic<uint64_t> _fullDetections;
+	std::atomic<uint64_t> _detectedFaces;
+	std::atomic<uint64_t> _recognizedFaces;
+	std::atomic<uint64_t> _processedFrames[StageCount];
+	std::atomic<uint64_t> _busyMicroseconds[StageCount];
+
+public:
+	// the gallery has to outlive the pipeline, the callback is called from the matching workers
+	FacePipeline(Ort::Env& env, const FacePipelineConfig& config, const FaceGallery& gallery, const FrameCallback& callback);
+	FacePipeline(const FacePipeline&) = delete;
+	FacePipeline& operator=(const FacePipeline&) = delete;
+	~FacePipeline();
+
+	// starts the workers, which create their models first; false if any model cannot be created
+	bool Start();
+	// returns false if the frame was dropped or the pipeline is not running
+	bool Submit(const cv::Mat& image, const int streamId = 0);
+	// waits until every submitted frame has been completed, failed or dropped
+	void Flush();
+	void Stop();
+
+	FacePipelineStats GetStats() const;
+	static const char* GetStageName(const int stage);
+
+private:
+	void StartWorker(void (FacePipeline::*run)());
+	void RunDetectionWorker();
+	void RunNormalizationWorker();
+	void RunIndexingWorker();
+	void RunAttributeWorker();
+	void RunMatchingWorker();
+	void RunStage(const int stage, const std::function<void(PipelineFrame&)>& process);
+	std::vector<cv::Size> GetDetectionInputSizes() const;
+	bool IsFullDetectionPass(const PipelineFrame& frame);
+	void SelectFacesToRecognize(PipelineFrame& frame);
+	void Forward(const int stage, PipelineFrame* frame);
+	static void Backoff(int* attempt);
+};
\ No newline at end of file
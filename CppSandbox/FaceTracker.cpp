@@ -0,0 +1,325 @@
+#include "FaceTracker.h"
+#include <algorithm>
+
+namespace
+{
+	// box coordinates are relative to the frame size
+	const float PositionNoise = 1e-5f;
+	const float VelocityNoise = 1e-5f;
+	const float MeasurementNoise = 2.5e-5f;
+	const float InitialVelocityVariance = 1e-3f;
+}
+
+FaceTracker::FaceTracker(const FaceTrackerConfig& config)
+	: _config(config), _nextTrackId(0), _trackedFaces(0), _recognizedFaces(0)
+{
+}
+
+std::vector<size_t> FaceTracker::Update(const int streamId, const uint64_t frameId, std::vector<Face>* faces)
+{
+	std::vector<size_t> recognizedFaces;
+	recognizedFaces.reserve(faces->size());
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	StreamTracks& stream = _streams[streamId];
+	if (stream.hasFrames && frameId <= stream.lastFrameId)
+	{
+		// a late frame would move the tracks back in time, its faces are recognized without tracking
+		for (size_t i = 0; i < faces->size(); i++)
+		{
+			(*faces)[i].trackId = -1;
+			recognizedFaces.emplace_back(i);
+		}
+		_recognizedFaces += faces->size();
+
+		return recognizedFaces;
+	}
+
+	stream.hasFrames = true;
+	stream.lastFrameId = frameId;
+
+	std::vector<Track>& tracks = stream.tracks;
+	for (Track& track : tracks)
+	{
+		for (KalmanAxis& axis : track.axes)
+			Predict(&axis);
+	}
+
+	// greedy assignment, best overlapping pairs first
+	_pairs.clear();
+	for (size_t i = 0; i < tracks.size(); i++)
+	{
+		const cv::Rect2f& predictedBox = GetBox(tracks[i]);
+		for (size_t j = 0; j < faces->size(); j++)
+		{
+			const float overlap = GetOverlap(predictedBox, (*faces)[j].box);
+			if (overlap >= _config.minOverlap)
+				_pairs.emplace_back(overlap, i, j);
+		}
+	}
+	std::sort(_pairs.begin(), _pairs.end(), [](const std::tuple<float, size_t, size_t>& a, const std::tuple<float, size_t, size_t>& b)
+	{
+		return std::get<0>(a) > std::get<0>(b);
+	});
+
+	_trackMatched.assign(tracks.size(), false);
+	_faceMatched.assign(faces->size(), false);
+
+	for (const std::tuple<float, size_t, size_t>& pair : _pairs)
+	{
+		const size_t trackIndex = std::get<1>(pair);
+		const size_t faceIndex = std::get<2>(pair);
+		if (_trackMatched[trackIndex] || _faceMatched[faceIndex])
+			continue;
+
+		_trackMatched[trackIndex] = true;
+		_faceMatched[faceIndex] = true;
+
+		Track& track = tracks[trackIndex];
+		Face& face = (*faces)[faceIndex];
+		const cv::Rect2f& box = face.box;
+		const float measurements[4] = { box.x + box.width / 2, box.y + box.height / 2, box.width, box.height };
+		for (int k = 0; k < 4; k++)
+			Correct(&track.axes[k], measurements[k]);
+
+		track.missedFrames = 0;
+		track.framesSinceRecognition++;
+		face.trackId = track.id;
+
+		const float quality = GetQuality(face);
+		if (track.framesSinceRecognition >= _config.recognitionInterval || quality > track.bestQuality * _config.qualityGain)
+		{
+			track.framesSinceRecognition = 0;
+			track.bestQuality = std::max(track.bestQuality, quality);
+			recognizedFaces.emplace_back(faceIndex);
+		}
+	}
+
+	for (size_t i = 0; i < tracks.size(); i++)
+	{
+		if (!_trackMatched[i])
+			tracks[i].missedFrames++;
+	}
+	tracks.erase(std::remove_if(tracks.begin(), tracks.end(), [this](const Track& track)
+	{
+		return track.missedFrames > _config.maxMissedFrames;
+	}), tracks.end());
+
+	for (size_t i = 0; i < faces->size(); i++)
+	{
+		if (_faceMatched[i])
+			continue;
+
+		Track track;
+		InitializeTrack((*faces)[i], &track);
+		tracks.emplace_back(std::move(track));
+
+		(*faces)[i].trackId = tracks.back().id;
+		recognizedFaces.emplace_back(i);
+	}
+
+	std::sort(recognizedFaces.begin(), recognizedFaces.end());
+	_trackedFaces += faces->size();
+	_recognizedFaces += recognizedFaces.size();
+
+	return recognizedFaces;
+}
+
+FaceIndex FaceTracker::AddEmbedding(const int streamId, const int trackId, const FaceIndex& index)
+{
+	float norm = 0;
+	for (const float value : index)
+		norm += value * value;
+	const float inverseNorm = norm > 0 ? 1 / std::sqrt(norm) : 0;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	Track* track = FindTrack(streamId, trackId);
+	if (track == nullptr)
+		return index;
+
+	if (track->embedding.size() != index.size())
+	{
+		track->embedding.assign(index.size(), 0);
+		track->embeddingCount = 0;
+	}
+
+	const float weight = 1.0f / (track->embeddingCount + 1);
+	float aggregatedNorm = 0;
+	for (size_t i = 0; i < index.size(); i++)
+	{
+		track->embedding[i] += (index[i] * inverseNorm - track->embedding[i]) * weight;
+		aggregatedNorm += track->embedding[i] * track->embedding[i];
+	}
+	track->embeddingCount++;
+
+	const float inverseAggregatedNorm = aggregatedNorm > 0 ? 1 / std::sqrt(aggregatedNorm) : 0;
+	FaceIndex aggregated(track->embedding);
+	for (float& value : aggregated)
+		value *= inverseAggregatedNorm;
+
+	return aggregated;
+}
+
+void FaceTracker::SetResult(const int streamId, const int trackId, const Face& face)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	Track* track = FindTrack(streamId, trackId);
+	if (track == nullptr)
+		return;
+
+	track->hasResult = true;
+	track->label = face.label;
+	track->similarity = face.similarity;
+	track->gender = face.gender;
+	track->age = face.age;
+}
+
+bool FaceTracker::GetResult(const int streamId, const int trackId, Face* face) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	const Track* track = FindTrack(streamId, trackId);
+	if (track == nullptr || !track->hasResult)
+		return false;
+
+	face->index = track->embedding;
+	face->label = track->label;
+	face->similarity = track->similarity;
+	face->gender = track->gender;
+	face->age = track->age;
+
+	return true;
+}
+
+std::vector<cv::Rect2f> FaceTracker::GetTrackedBoxes(const int streamId) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	std::vector<cv::Rect2f> boxes;
+	const auto stream = _streams.find(streamId);
+	if (stream == _streams.end())
+		return boxes;
+
+	boxes.reserve(stream->second.tracks.size());
+	for (const Track& track : stream->second.tracks)
+		boxes.emplace_back(GetBox(track));
+
+	return boxes;
+}
+
+FaceTrackerStats FaceTracker::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	FaceTrackerStats stats;
+	stats.trackedFaces = _trackedFaces;
+	stats.recognizedFaces = _recognizedFaces;
+	stats.tracks = (uint64_t)_nextTrackId;
+
+	return stats;
+}
+
+FaceTracker::Track* FaceTracker::FindTrack(const int streamId, const int trackId)
+{
+	return const_cast<Track*>(static_cast<const FaceTracker*>(this)->FindTrack(streamId, trackId));
+}
+
+const FaceTracker::Track* FaceTracker::FindTrack(const int streamId, const int trackId) const
+{
+	const auto stream = _streams.find(streamId);
+	if (trackId < 0 || stream == _streams.end())
+		return nullptr;
+
+	for (const Track& track : stream->second.tracks)
+	{
+		if (track.id == trackId)
+			return &track;
+	}
+
+	return nullptr;
+}
+
+void FaceTracker::InitializeTrack(const Face& face, Track* track)
+{
+	const cv::Rect2f& box = face.box;
+	const float measurements[4] = { box.x + box.width / 2, box.y + box.height / 2, box.width, box.height };
+	for (int k = 0; k < 4; k++)
+	{
+		KalmanAxis& axis = track->axes[k];
+		axis.position = measurements[k];
+		axis.velocity = 0;
+		axis.p00 = MeasurementNoise;
+		axis.p01 = 0;
+		axis.p11 = InitialVelocityVariance;
+	}
+
+	track->id = _nextTrackId++;
+	track->missedFrames = 0;
+	track->framesSinceRecognition = 0;
+	track->bestQuality = GetQuality(face);
+	track->embeddingCount = 0;
+	track->hasResult = false;
+	track->similarity = 0;
+	track->gender = Gender::Unknown;
+	track->age = 0;
+}
+
+// constant velocity, one frame per step
+void FaceTracker::Predict(KalmanAxis* axis)
+{
+	axis->position += axis->velocity;
+	axis->p00 += 2 * axis->p01 + axis->p11 + PositionNoise;
+	axis->p01 += axis->p11;
+	axis->p11 += VelocityNoise;
+}
+
+void FaceTracker::Correct(KalmanAxis* axis, const float measurement)
+{
+	const float innovationVariance = axis->p00 + MeasurementNoise;
+	const float positionGain = axis->p00 / innovationVariance;
+	const float velocityGain = axis->p01 / innovationVariance;
+	const float innovation = measurement - axis->position;
+
+	axis->position += positionGain * innovation;
+	axis->velocity += velocityGain * innovation;
+	axis->p11 -= velocityGain * axis->p01;
+	axis->p00 *= 1 - positionGain;
+	axis->p01 *= 1 - positionGain;
+}
+
+cv::Rect2f FaceTracker::GetBox(const Track& track)
+{
+	const float width = std::max(track.axes[2].position, 0.0f);
+	const float height = std::max(track.axes[3].position, 0.0f);
+
+	return cv::Rect2f(track.axes[0].position - width / 2, track.axes[1].position - height / 2, width, height);
+}
+
+float FaceTracker::GetOverlap(const cv::Rect2f& a, const cv::Rect2f& b)
+{
+	const float intersectionWidth = std::min(a.x + a.width, b.x + b.width) - std::max(a.x, b.x);
+	const float intersectionHeight = std::min(a.y + a.height, b.y + b.height) - std::max(a.y, b.y);
+	if (intersectionWidth <= 0 || intersectionHeight <= 0)
+		return 0;
+
+	const float intersection = intersectionWidth * intersectionHeight;
+
+	return intersection / (a.width * a.height + b.width * b.height - intersection);
+}
+
+// landmarks are relative to the box: eyes first, then the nose, which sits between the eyes on a frontal face
+float FaceTracker::GetQuality(const Face& face)
+{
+	float frontality = 1;
+	if (face.landmarks.size() >= 3)
+	{
+		const float eyeDistance = std::abs(face.landmarks[1].x - face.landmarks[0].x);
+		const float noseOffset = std::abs(face.landmarks[2].x - (face.landmarks[0].x + face.landmarks[1].x) / 2);
+		frontality = eyeDistance > 0 ? std::max(1 - 2 * noseOffset / eyeDistance, 0.0f) : 0;
+	}
+
+	return face.score * std::sqrt(face.box.width * face.box.height) * frontality;
+}
\ No newline at end of file
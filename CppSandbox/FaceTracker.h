@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Structs.h"
+#include <mutex>
+#include <map>
+#include <atomic>
+#include <tuple>
+
+struct FaceTrackerConfig
+{
+	float minOverlap = 0.3f; // IoU between a predicted track box and a detection to continue the track
+	int maxMissedFrames = 10;
+	int recognitionInterval = 30; // frames after which a track is recognized again
+	float qualityGain = 1.5f; // a face this much better than the best one recognized so far is recognized again
+};
+
+struct FaceTrackerStats
+{
+	uint64_t trackedFaces;
+	uint64_t recognizedFaces; // faces handed to recognition, the rest reused their track's result
+	uint64_t tracks;
+};
+
+// Gives faces of consecutive frames of a stream stable track ids, so recognition runs once per person instead of once per frame.
+// Tracks follow box center and size with a constant velocity Kalman filter and are matched to detections greedily by IoU.
+// A face is sent to recognition when its track is new, every recognitionInterval frames, and when its quality
+// (score, size and how frontal the landmarks are) clearly beats the best face of the track recognized so far.
+// Embeddings of a track are averaged, and the results are kept with the track for the faces that skip recognition.
+// All methods are thread safe; frames of one stream have to be tracked in order, late frames are not tracked.
+class FaceTracker
+{
+private:
+	// position and velocity of one box coordinate with their covariance
+	struct KalmanAxis
+	{
+		float position;
+		float velocity;
+		float p00;
+		float p01;
+		float p11;
+	};
+
+	struct Track
+	{
+		int id;
+		KalmanAxis axes[4]; // center x, center y, width, height
+		int missedFrames;
+		int framesSinceRecognition;
+		float bestQuality;
+		FaceIndex embedding; // running mean of the normalized embeddings
+		int embeddingCount;
+		bool hasResult;
+		std::string label;
+		float similarity;
+		Gender gender;
+		int age;
+	};
+
+	struct StreamTracks
+	{
+		uint64_t lastFrameId;
+		bool hasFrames;
+		std::vector<Track> tracks;
+	};
+
+	const FaceTrackerConfig _config;
+	mutable std::mutex _mutex;
+	std::map<int, StreamTracks> _streams;
+	// assignment scratch of Update(), guarded by the mutex
+	std::vector<std::tuple<float, size_t, size_t>> _pairs;
+	std::vector<bool> _trackMatched;
+	std::vector<bool> _faceMatched;
+	int _nextTrackId;
+	std::atomic<uint64_t> _trackedFaces;
+	std::atomic<uint64_t> _recognizedFaces;
+
+public:
+	FaceTracker(const FaceTrackerConfig& config = FaceTrackerConfig());
+
+	// sets Face::trackId and returns the indexes of the faces that need recognition
+	std::vector<size_t> Update(const int streamId, const uint64_t frameId, std::vector<Face>* faces);
+	// adds an embedding to the track and returns the aggregated one, or the embedding itself for untracked faces
+	FaceIndex AddEmbedding(const int streamId, const int trackId, const FaceIndex& index);
+	void SetResult(const int streamId, const int trackId, const Face& face);
+	// copies the last recognition result of the track into the face, false while there is none
+	bool GetResult(const int streamId, const int trackId, Face* face) const;
+	// last known boxes of the live tracks of a stream, for detection around them
+	std::vector<cv::Rect2f> GetTrackedBoxes(const int streamId) const;
+
+	FaceTrackerStats GetStats() const;
+
+private:
+	Track* FindTrack(const int streamId, const int trackId);
+	const Track* FindTrack(const int streamId, const int trackId) const;
+	void InitializeTrack(const Face& face, Track* track);
+	static void Predict(KalmanAxis* axis);
+	static void Correct(KalmanAxis* axis, const float measurement);
+	static cv::Rect2f GetBox(const Track& track);
+	static float GetOverlap(const cv::Rect2f& a, const cv::Rect2f& b);
+	static float GetQuality(const Face& face);
+};
\ No newline at end of file
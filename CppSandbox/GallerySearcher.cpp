@@ -0,0 +1,414 @@
+#include "GallerySearcher.h"
+#include "HalfFloat.h"
+#include "Int8Quantizer.h"
+#include "Metrics.h"
+#include <immintrin.h>
+
+namespace
+{
+	bool IsWorse(const GalleryMatch& m1, const GalleryMatch& m2)
+	{
+		return m1.similarity > m2.similarity;
+	}
+
+#if defined(__AVX2__)
+	float HorizontalSum(const __m256 v)
+	{
+		const __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		const __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+
+		return _mm_cvtss_f32(_mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1)));
+	}
+#endif
+}
+
+GallerySearcher::GallerySearcher(const FaceGallery& gallery, ThreadPool* threadPool, const size_t minShardRowCount)
+	: _embeddingType(gallery.GetEmbeddingType()), _matrix(nullptr), _rowStride(gallery.GetRowStride()), _rowCount(gallery.GetCount()),
+	_dimension(gallery.GetDimension()), _threadPool(threadPool), _minShardRowCount(std::max(minShardRowCount, (size_t)_rowTileSize))
+{
+	if (_rowCount > 0)
+		_matrix = (const unsigned char*)gallery.GetEmbeddingData(0);
+}
+
+std::vector<GalleryMatch> GallerySearcher::Search(const FaceIndex& probe, const int k, const float minSimilarity)
+{
+	const StageTimer timer(MetricStage::Matching);
+	Metrics::Get().AddCount(MetricCounter::GallerySearches);
+
+	_probes.resize(_dimension);
+	if (k <= 0 || _rowCount == 0 || !NormalizeProbe(probe, _probes.data()))
+		return std::vector<GalleryMatch>();
+
+	QuantizeProbes(1);
+
+	std::vector<GalleryMatch> matches = std::move(SearchShards(1, k, minSimilarity)[0]);
+	if (!matches.empty())
+		Metrics::Get().AddCount(MetricCounter::FacesMatched);
+
+	return matches;
+}
+
+std::vector<std::vector<GalleryMatch>> GallerySearcher::Search(const std::vector<FaceIndex>& probes, const int k, const float minSimilarity)
+{
+	const StageTimer timer(MetricStage::Matching);
+	Metrics::Get().AddCount(MetricCounter::GallerySearches, probes.size());
+
+	std::vector<std::vector<GalleryMatch>> results(probes.size());
+	if (k <= 0 || _rowCount == 0)
+		return results;
+
+	// probes that fail validation stay out of the blocks and get no matches
+	std::vector<size_t> probeIndexes;
+	probeIndexes.reserve(probes.size());
+	_probes.resize(probes.size() * _dimension);
+	for (size_t i = 0; i < probes.size(); i++)
+	{
+		if (NormalizeProbe(probes[i], _probes.data() + probeIndexes.size() * _dimension))
+			probeIndexes.emplace_back(i);
+	}
+
+	if (probeIndexes.empty())
+		return results;
+
+	QuantizeProbes((int)probeIndexes.size());
+
+	std::vector<std::vector<GalleryMatch>> matches = SearchShards((int)probeIndexes.size(), k, minSimilarity);
+	size_t matchedProbeCount = 0;
+	for (size_t p = 0; p < probeIndexes.size(); p++)
+	{
+		matchedProbeCount += matches[p].empty() ? 0 : 1;
+		results[probeIndexes[p]] = std::move(matches[p]);
+	}
+	Metrics::Get().AddCount(MetricCounter::FacesMatched, matchedProbeCount);
+
+	return results;
+}
+
+size_t GallerySearcher::GetRowCount() const
+{
+	return _rowCount;
+}
+
+float GallerySearcher::Dot(const float* a, const float* b, const int size)
+{
+	int i = 0;
+	float dot = 0;
+
+#if defined(__AVX512F__)
+	__m512 sum512 = _mm512_setzero_ps();
+	for (; i + 16 <= size; i += 16)
+		sum512 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum512);
+	dot = _mm512_reduce_add_ps(sum512);
+#elif defined(__AVX2__)
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	for (; i + 16 <= size; i += 16)
+	{
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+		sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+	}
+	dot = HorizontalSum(_mm256_add_ps(sum0, sum1));
+#endif
+
+	for (; i < size; i++)
+		dot += a[i] * b[i];
+
+	return dot;
+}
+
+bool GallerySearcher::NormalizeProbe(const FaceIndex& probe, float* destination) const
+{
+	if (probe.size() != _dimension)
+	{
+		std::cout << "probe size " << probe.size() << " does not match gallery dimension " << _dimension << std::endl;
+		return false;
+	}
+
+	const float norm = std::sqrt(Dot(probe.data(), probe.data(), _dimension));
+	if (norm == 0)
+		return false;
+
+	const float inverseNorm = 1 / norm;
+	for (int i = 0; i < _dimension; i++)
+		destination[i] = probe[i] * inverseNorm;
+
+	return true;
+}
+
+void GallerySearcher::QuantizeProbes(const int probeCount)
+{
+	if (_embeddingType != EmbeddingType::Int8)
+		return;
+
+	_quantizedProbes.resize(probeCount * _dimension);
+	_probeScales.resize(probeCount);
+	for (int p = 0; p < probeCount; p++)
+		_probeScales[p] = Int8Quantizer::Quantize(_probes.data() + p * _dimension, _quantizedProbes.data() + p * _dimension, _dimension);
+}
+
+const unsigned char* GallerySearcher::GetRow(const size_t row) const
+{
+	return _matrix + row * _rowStride;
+}
+
+const float* GallerySearcher::GetFloatRow(const size_t row) const
+{
+	return (const float*)GetRow(row);
+}
+
+float GallerySearcher::GetSimilarity(const int probeIndex, const size_t row) const
+{
+	const unsigned char* rowData = GetRow(row);
+
+	switch (_embeddingType)
+	{
+	case EmbeddingType::Float16:
+		return HalfFloat::Dot(_probes.data() + probeIndex * _dimension, (const uint16_t*)rowData, _dimension);
+	case EmbeddingType::Int8:
+	{
+		const int32_t dot = Int8Quantizer::Dot(_quantizedProbes.data() + probeIndex * _dimension, (const int8_t*)rowData, _dimension);
+		return dot * _probeScales[probeIndex] * Int8Quantizer::GetScale(rowData, _dimension);
+	}
+	default:
+		return Dot(_probes.data() + probeIndex * _dimension, (const float*)rowData, _dimension);
+	}
+}
+
+int GallerySearcher::GetShardCount() const
+{
+	if (_threadPool == nullptr)
+		return 1;
+
+	const size_t maxShardCount = std::max(_rowCount / _minShardRowCount, (size_t)1);
+
+	return (int)std::min((size_t)_threadPool->GetThreadCount(), maxShardCount);
+}
+
+std::vector<std::vector<GalleryMatch>> GallerySearcher::SearchShards(const int probeCount, const int k, const float minSimilarity)
+{
+	const int shardCount = GetShardCount();
+	const size_t tileCount = (_rowCount + _rowTileSize - 1) / _rowTileSize;
+	const size_t shardRowCount = (tileCount + shardCount - 1) / shardCount * _rowTileSize;
+
+	_shardHeaps.resize(shardCount * probeCount);
+	for (auto& heap : _shardHeaps)
+	{
+		heap.clear();
+		heap.reserve(k);
+	}
+
+	const std::function<void(const int)>& searchShard = [this, probeCount, k, minSimilarity, shardRowCount](const int shard)
+	{
+		const size_t shardBegin = std::min(shard * shardRowCount, _rowCount);
+		const size_t shardEnd = std::min(shardBegin + shardRowCount, _rowCount);
+		std::vector<GalleryMatch>* heaps = _shardHeaps.data() + shard * probeCount;
+
+		if (probeCount == 1)
+		{
+			ScanRows(0, shardBegin, shardEnd, k, minSimilarity, heaps);
+			return;
+		}
+
+		for (size_t rowBegin = shardBegin; rowBegin < shardEnd; rowBegin += _rowTileSize)
+		{
+			const size_t rowEnd = std::min(rowBegin + _rowTileSize, shardEnd);
+			for (int p = 0; p < probeCount; p += _probeBlockSize)
+			{
+				const int blockSize = std::min((int)_probeBlockSize, probeCount - p);
+				ScanTile(p, blockSize, rowBegin, rowEnd, k, minSimilarity, heaps + p);
+			}
+		}
+	};
+
+	if (shardCount == 1)
+		searchShard(0);
+	else
+		_threadPool->Run(shardCount, searchShard);
+
+	// merging the shard lists is cheap, at most shardCount * k candidates per probe
+	std::vector<std::vector<GalleryMatch>> matches(probeCount);
+	for (int p = 0; p < probeCount; p++)
+	{
+		if (shardCount == 1)
+		{
+			matches[p] = SortMatches(_shardHeaps[p]);
+			continue;
+		}
+
+		std::vector<GalleryMatch> heap;
+		heap.reserve(k);
+		for (int shard = 0; shard < shardCount; shard++)
+		{
+			for (const GalleryMatch& match : _shardHeaps[shard * probeCount + p])
+				PushMatch(match.row, match.similarity, k, minSimilarity, &heap);
+		}
+		matches[p] = SortMatches(heap);
+	}
+
+	return matches;
+}
+
+void GallerySearcher::ScanRows(const int probeIndex, const size_t rowBegin, const size_t rowEnd, const int k, const float minSimilarity,
+	std::vector<GalleryMatch>* heap) const
+{
+	size_t row = rowBegin;
+
+	if (_embeddingType == EmbeddingType::Float32)
+	{
+		const float* probe = _probes.data() + probeIndex * _dimension;
+		float similarities[4];
+
+		for (; row + 4 <= rowEnd; row += 4)
+		{
+			const float* rows[4] = { GetFloatRow(row), GetFloatRow(row + 1), GetFloatRow(row + 2), GetFloatRow(row + 3) };
+			DotRows4(probe, rows, _dimension, similarities);
+
+			for (int i = 0; i < 4; i++)
+				PushMatch(row + i, similarities[i], k, minSimilarity, heap);
+		}
+	}
+
+	for (; row < rowEnd; row++)
+		PushMatch(row, GetSimilarity(probeIndex, row), k, minSimilarity, heap);
+}
+
+void GallerySearcher::ScanTile(const int probeBegin, const int probeCount, const size_t rowBegin, const size_t rowEnd, const int k,
+	const float minSimilarity, std::vector<GalleryMatch>* heaps) const
+{
+	size_t row = rowBegin;
+
+	if (_embeddingType == EmbeddingType::Float32 && probeCount == _probeBlockSize)
+	{
+		const float* probes = _probes.data() + probeBegin * _dimension;
+		float similarities[_probeBlockSize][_rowBlockSize];
+		for (; row + _rowBlockSize <= rowEnd; row += _rowBlockSize)
+		{
+			const float* rows[_rowBlockSize] = { GetFloatRow(row), GetFloatRow(row + 1) };
+			DotBlock(probes, _dimension, rows, _dimension, similarities);
+
+			for (int p = 0; p < _probeBlockSize; p++)
+			{
+				for (int r = 0; r < _rowBlockSize; r++)
+					PushMatch(row + r, similarities[p][r], k, minSimilarity, &heaps[p]);
+			}
+		}
+	}
+
+	for (; row < rowEnd; row++)
+	{
+		for (int p = 0; p < probeCount; p++)
+			PushMatch(row, GetSimilarity(probeBegin + p, row), k, minSimilarity, &heaps[p]);
+	}
+}
+
+void GallerySearcher::DotRows4(const float* probe, const float* rows[4], const int size, float* similarities)
+{
+	int i = 0;
+	for (int r = 0; r < 4; r++)
+		similarities[r] = 0;
+
+#if defined(__AVX512F__)
+	__m512 sums[4] = { _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps() };
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m512 p = _mm512_loadu_ps(probe + i);
+		for (int r = 0; r < 4; r++)
+			sums[r] = _mm512_fmadd_ps(p, _mm512_loadu_ps(rows[r] + i), sums[r]);
+	}
+	for (int r = 0; r < 4; r++)
+		similarities[r] = _mm512_reduce_add_ps(sums[r]);
+#elif defined(__AVX2__)
+	__m256 sums[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 p = _mm256_loadu_ps(probe + i);
+		for (int r = 0; r < 4; r++)
+			sums[r] = _mm256_fmadd_ps(p, _mm256_loadu_ps(rows[r] + i), sums[r]);
+	}
+	for (int r = 0; r < 4; r++)
+		similarities[r] = HorizontalSum(sums[r]);
+#endif
+
+	for (; i < size; i++)
+	{
+		for (int r = 0; r < 4; r++)
+			similarities[r] += probe[i] * rows[r][i];
+	}
+}
+
+// register-blocked micro kernel of the many-probe path, 8 accumulators stay in registers over the whole dimension
+void GallerySearcher::DotBlock(const float* probes, const int probeStride, const float* rows[_rowBlockSize], const int size,
+	float similarities[_probeBlockSize][_rowBlockSize])
+{
+	int i = 0;
+	for (int p = 0; p < _probeBlockSize; p++)
+	{
+		for (int r = 0; r < _rowBlockSize; r++)
+			similarities[p][r] = 0;
+	}
+
+#if defined(__AVX2__)
+	__m256 sums[_probeBlockSize][_rowBlockSize];
+	for (int p = 0; p < _probeBlockSize; p++)
+	{
+		for (int r = 0; r < _rowBlockSize; r++)
+			sums[p][r] = _mm256_setzero_ps();
+	}
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 row0 = _mm256_loadu_ps(rows[0] + i);
+		const __m256 row1 = _mm256_loadu_ps(rows[1] + i);
+		for (int p = 0; p < _probeBlockSize; p++)
+		{
+			const __m256 probe = _mm256_loadu_ps(probes + p * probeStride + i);
+			sums[p][0] = _mm256_fmadd_ps(probe, row0, sums[p][0]);
+			sums[p][1] = _mm256_fmadd_ps(probe, row1, sums[p][1]);
+		}
+	}
+
+	for (int p = 0; p < _probeBlockSize; p++)
+	{
+		for (int r = 0; r < _rowBlockSize; r++)
+			similarities[p][r] = HorizontalSum(sums[p][r]);
+	}
+#endif
+
+	for (; i < size; i++)
+	{
+		for (int p = 0; p < _probeBlockSize; p++)
+		{
+			for (int r = 0; r < _rowBlockSize; r++)
+				similarities[p][r] += probes[p * probeStride + i] * rows[r][i];
+		}
+	}
+}
+
+// min-heap on similarity, the root is the weakest of the current top-k
+void GallerySearcher::PushMatch(const size_t row, const float similarity, const int k, const float minSimilarity,
+	std::vector<GalleryMatch>* heap)
+{
+	if (similarity <= minSimilarity)
+		return;
+
+	if (heap->size() < k)
+	{
+		heap->push_back({ row, similarity });
+		std::push_heap(heap->begin(), heap->end(), IsWorse);
+		return;
+	}
+
+	if (similarity <= heap->front().similarity)
+		return;
+
+	std::pop_heap(heap->begin(), heap->end(), IsWorse);
+	heap->back() = { row, similarity };
+	std::push_heap(heap->begin(), heap->end(), IsWorse);
+}
+
+std::vector<GalleryMatch> GallerySearcher::SortMatches(std::vector<GalleryMatch>& heap)
+{
+	std::sort_heap(heap.begin(), heap.end(), IsWorse);
+
+	return std::move(heap);
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "FaceGallery.h"
+#include "ThreadPool.h"
+
+struct GalleryMatch
+{
+	size_t row;
+	float similarity;
+};
+
+// Exhaustive cosine top-k search over a FaceGallery, which has to outlive the searcher.
+// Gallery rows are already L2-normalized, so a similarity is a single dot product against the normalized probe.
+// fp16 and int8 galleries are scanned as stored: fp16 rows are widened in registers, int8 rows are multiplied
+// with an int8 copy of the probe in the integer domain and rescaled once per row.
+// One probe streams the matrix (four float rows at a time); many probes are matched over L2-sized row tiles,
+// in register blocks of 4 probes x 2 rows for float galleries, so every gallery row is loaded once per probe block.
+// With a thread pool the rows are split into shards searched in parallel, per-shard top-k lists are merged at the end.
+class GallerySearcher
+{
+private:
+	static const int _probeBlockSize = 4;
+	static const int _rowBlockSize = 2;
+	static const size_t _rowTileSize = 128;
+	EmbeddingType _embeddingType;
+	const unsigned char* _matrix;
+	size_t _rowStride;
+	size_t _rowCount;
+	int _dimension;
+	ThreadPool* _threadPool;
+	const size_t _minShardRowCount;
+	std::vector<float> _probes;
+	std::vector<int8_t> _quantizedProbes;
+	std::vector<float> _probeScales;
+	std::vector<std::vector<GalleryMatch>> _shardHeaps;
+
+public:
+	GallerySearcher(const FaceGallery& gallery, ThreadPool* threadPool = nullptr, const size_t minShardRowCount = 16384);
+	GallerySearcher(const GallerySearcher&) = delete;
+	GallerySearcher& operator=(const GallerySearcher&) = delete;
+
+	// best matches first, only similarities strictly above minSimilarity are kept (a match must beat the threshold)
+	std::vector<GalleryMatch> Search(const FaceIndex& probe, const int k, const float minSimilarity = -1);
+	std::vector<std::vector<GalleryMatch>> Search(const std::vector<FaceIndex>& probes, const int k, const float minSimilarity = -1);
+
+	size_t GetRowCount() const;
+
+	static float Dot(const float* a, const float* b, const int size);
+
+private:
+	bool NormalizeProbe(const FaceIndex& probe, float* destination) const;
+	void QuantizeProbes(const int probeCount);
+	const unsigned char* GetRow(const size_t row) const;
+	const float* GetFloatRow(const size_t row) const;
+	float GetSimilarity(const int probeIndex, const size_t row) const;
+	int GetShardCount() const;
+	std::vector<std::vector<GalleryMatch>> SearchShards(const int probeCount, const int k, const float minSimilarity);
+	void ScanRows(const int probeIndex, const size_t rowBegin, const size_t rowEnd, const int k, const float minSimilarity,
+		std::vector<GalleryMatch>* heap) const;
+	void ScanTile(const int probeBegin, const int probeCount, const size_t rowBegin, const size_t rowEnd, const int k,
+		const float minSimilarity, std::vector<GalleryMatch>* heaps) const;
+	static void DotRows4(const float* probe, const float* rows[4], const int size, float* similarities);
+	static void DotBlock(const float* probes, const int probeStride, const float* rows[_rowBlockSize], const int size,
+		float similarities[_probeBlockSize][_rowBlockSize]);
+	static void PushMatch(const size_t row, const float similarity, const int k, const float minSimilarity,
+		std::vector<GalleryMatch>* heap);
+	static std::vector<GalleryMatch> SortMatches(std::vector<GalleryMatch>& heap);
+};
\ No newline at end of file
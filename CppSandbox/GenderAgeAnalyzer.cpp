@@ -1,112 +1,70 @@
 #include "GenderAgeAnalyzer.h"
-#include "OrtUtils.h"
+#include "Metrics.h"
 #include <numeric>
 
-GenderAgeAnalyzer::GenderAgeAnalyzer(Ort::Env& env, const std::string& modelFilepath)
-	:_session(CreateSession(env, modelFilepath))
+GenderAgeAnalyzer::GenderAgeAnalyzer(Ort::Env& env, const std::string& modelFilepath, const int maxBatchSize,
+	const InferenceOptions& options)
+	:_maxBatchSize(std::max(maxBatchSize, 1)),
+	_session(env, modelFilepath, { _inputDepth, _inputSize.height, _inputSize.width }, _maxBatchSize, {}, options),
+	_preprocessor(_inputSize)
 {
 }
 
 GenderAgeAttributes GenderAgeAnalyzer::GetAttributes(const cv::Mat& faceImage)
 {
-	float scaleFactor = 1;
-	const cv::Mat& preparedImage = PrepareImage(faceImage, &scaleFactor); // 4-dim float
+	const StageTimer timer(MetricStage::Attributes);
+	Metrics::Get().AddCount(MetricCounter::FacesAnalyzed);
 
-	const std::vector<float>& tensorOutput = RunNet(preparedImage);
+	PrepareImage(faceImage, 0);
 
-	return GetResultFromTensorOutput(tensorOutput);
+	return RunNet(1)[0];
 }
 
-cv::Mat GenderAgeAnalyzer::PrepareImage(const cv::Mat& image, float* scaleFactor) const
+std::vector<GenderAgeAttributes> GenderAgeAnalyzer::GetAttributes(const std::vector<cv::Mat>& faceImages)
 {
-	cv::Mat paddedImage;
+	const StageTimer timer(MetricStage::Attributes);
+	const int faceCount = (int)faceImages.size();
+	Metrics::Get().AddCount(MetricCounter::FacesAnalyzed, faceCount);
+
+	std::vector<GenderAgeAttributes> attributes;
+	attributes.reserve(faceCount);
 
-	const bool imgSizeMatches = image.cols == _inputSize.width && image.rows == _inputSize.height;
-	if (imgSizeMatches)
-		paddedImage = image;
-	else
+	for (int offset = 0; offset < faceCount; offset += _maxBatchSize)
 	{
-		const float im_ratio = (float)image.rows / image.cols;
-		const float model_ratio = (float)_inputSize.height / _inputSize.width;
-
-		int newWidth = 0;
-		int newHeight = 0;
-
-		if (im_ratio > model_ratio)
-		{
-			newHeight = _inputSize.height;
-			newWidth = (int)(newHeight / im_ratio);
-			*scaleFactor = (float)newWidth / image.cols;
-		}
-		else
-		{
-			newWidth = _inputSize.width;
-			newHeight = (int)(newWidth * im_ratio);
-			*scaleFactor = (float)newHeight / image.rows;
-		}
-
-		cv::Mat resizedImage;
-		cv::resize(image, resizedImage, cv::Size(newWidth, newHeight));
-
-		paddedImage = cv::Mat(_inputSize, CV_8UC3);
-		cv::Rect roi(cv::Point(0, 0), resizedImage.size());
-		resizedImage.copyTo(paddedImage(roi));
+		const int batchSize = std::min(_maxBatchSize, faceCount - offset);
+		for (int i = 0; i < batchSize; i++)
+			PrepareImage(faceImages[offset + i], i); // resized, normalized and written as NCHW into the session input in one pass
+
+		const std::vector<GenderAgeAttributes>& batchAttributes = RunNet(batchSize);
+		attributes.insert(attributes.end(), batchAttributes.begin(), batchAttributes.end());
 	}
 
-	// HWC to CHW
-	const float inputStdNorm = 1 / 128.0f;
-	const float inputMean = 127.5f;
-	const cv::Scalar meanNorm(inputMean, inputMean, inputMean);
+	return attributes;
+}
 
-	return cv::dnn::blobFromImage(paddedImage, inputStdNorm, _inputSize, meanNorm, true);
+void GenderAgeAnalyzer::PrepareImage(const cv::Mat& image, const int batchIndex)
+{
+	float scaleFactor = 1;
+	_preprocessor.Prepare(image, _session.GetInputData(batchIndex), &scaleFactor);
 }
 
-std::vector<float> GenderAgeAnalyzer::RunNet(const cv::Mat& floatImage)
+std::vector<GenderAgeAttributes> GenderAgeAnalyzer::RunNet(const int batchSize)
 {
-	Ort::AllocatorWithDefaultOptions allocator;
-
-	// prepare inputs
-	const char* inputName = _session.GetInputName(0, allocator);
-	std::vector<const char*> inputNames{ inputName };
-	Ort::TypeInfo inputTypeInfo = _session.GetInputTypeInfo(0);
-	auto inputTensorInfo = inputTypeInfo.GetTensorTypeAndShapeInfo();
-	ONNXTensorElementDataType inputType = inputTensorInfo.GetElementType();
-	std::vector<int64_t> inputDims = { 1, _inputDepth, _inputSize.width, _inputSize.height };
-	size_t inputTensorSize = Utils::VectorProduct(inputDims);
-
-	Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
-	const auto dataPointer = (float*)(floatImage.data);
-
-	std::vector<Ort::Value> inputTensors;
-	inputTensors.emplace_back(Ort::Value::CreateTensor<float>(memoryInfo, dataPointer, inputTensorSize, inputDims.data(), inputDims.size()));
-
-	// prepare outputs
-	const char* outputName = _session.GetOutputName(0, allocator);
-	std::vector<const char*> outputNames{ outputName };
-	Ort::TypeInfo outputTypeInfo = _session.GetOutputTypeInfo(0);
-	auto outputTensorInfo = outputTypeInfo.GetTensorTypeAndShapeInfo();
-	ONNXTensorElementDataType outputType = outputTensorInfo.GetElementType();
-	const auto outputDims = outputTensorInfo.GetShape();
-	size_t outputTensorSize = Utils::VectorProduct(outputDims);
-
-	std::vector<float> outputTensorValue(outputTensorSize); // reserve space for output values
-
-	std::vector<Ort::Value> outputTensors;
-	outputTensors.emplace_back(Ort::Value::CreateTensor<float>(memoryInfo, outputTensorValue.data(),
-		outputTensorValue.size(), outputDims.data(), outputDims.size()));
-
-	// inference
-	_session.Run(Ort::RunOptions{ nullptr }, inputNames.data(), inputTensors.data(), 1,
-		outputNames.data(), outputTensors.data(), 1);
-
-	return outputTensorValue;
+	_session.Run(batchSize);
+
+	std::vector<GenderAgeAttributes> attributes;
+	attributes.reserve(batchSize);
+	for (int i = 0; i < batchSize; i++)
+		attributes.emplace_back(GetResultFromTensorOutput(_session.GetOutputData(0, i), _session.GetSampleOutputSize(0)));
+
+	return attributes;
 }
 
-GenderAgeAttributes GenderAgeAnalyzer::GetResultFromTensorOutput(const std::vector<float>& tensorOutput) const
+GenderAgeAttributes GenderAgeAnalyzer::GetResultFromTensorOutput(const float* tensorOutput, const size_t tensorOutputSize) const
 {
 	GenderAgeAttributes attributes;
 
-	if (tensorOutput.size() != 3)
+	if (tensorOutputSize != 3)
 		return attributes;
 
 	bool isMale = false;
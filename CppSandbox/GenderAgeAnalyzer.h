@@ -1,21 +1,28 @@
 #pragma once
 
 #include "Structs.h"
-#include <onnxruntime_cxx_api.h>
+#include "InferenceSession.h"
+#include "ImagePreprocessor.h"
 
+// not thread safe, an instance serves one thread at a time (see InferencePool)
 class GenderAgeAnalyzer
 {
 private:
-	Ort::Session _session;
 	const cv::Size _inputSize = cv::Size(96,96);
 	const int _inputDepth = 3;
+	const int _maxBatchSize;
+	InferenceSession _session;
+	ImagePreprocessor _preprocessor;
 
 public:
-	GenderAgeAnalyzer(Ort::Env& env, const std::string& modelFilepath);
+	GenderAgeAnalyzer(Ort::Env& env, const std::string& modelFilepath, const int maxBatchSize = 32,
+		const InferenceOptions& options = InferenceOptions());
 	GenderAgeAttributes GetAttributes(const cv::Mat& faceImage);
+	// takes the aligned crops of the indexer as they are, each one is resampled to 96x96 once while it is written into the batch
+	std::vector<GenderAgeAttributes> GetAttributes(const std::vector<cv::Mat>& faceImages);
 
 private:
-	cv::Mat PrepareImage(const cv::Mat& image, float* scaleFactor) const;
-	std::vector<float> RunNet(const cv::Mat& floatImage);
-	GenderAgeAttributes GetResultFromTensorOutput(const std::vector<float>& tensorOutput) const;
+	void PrepareImage(const cv::Mat& image, const int batchIndex);
+	std::vector<GenderAgeAttributes> RunNet(const int batchSize);
+	GenderAgeAttributes GetResultFromTensorOutput(const float* tensorOutput, const size_t tensorOutputSize) const;
 };
\ No newline at end of file
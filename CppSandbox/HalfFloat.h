@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define OMFR_HAS_F16C
+#endif
+
+// IEEE 754 binary16 conversions, round to nearest even
+class HalfFloat
+{
+public:
+	inline static uint16_t FromFloat(const float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+
+		const uint32_t sign = (bits >> 16) & 0x8000;
+		const int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+		uint32_t mantissa = bits & 0x7fffff;
+
+		if (((bits >> 23) & 0xff) == 0xff) // inf, nan
+			return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+		if (exponent >= 31) // overflow to inf
+			return (uint16_t)(sign | 0x7c00);
+
+		if (exponent <= 0) // subnormal or zero
+		{
+			if (exponent < -10)
+				return (uint16_t)sign;
+
+			mantissa |= 0x800000;
+			const int shift = 14 - exponent;
+			uint32_t half = mantissa >> shift;
+			const uint32_t remainder = mantissa & ((1u << shift) - 1);
+			const uint32_t halfway = 1u << (shift - 1);
+			if (remainder > halfway || (remainder == halfway && (half & 1)))
+				half++;
+
+			return (uint16_t)(sign | half);
+		}
+
+		uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+		const uint32_t remainder = mantissa & 0x1fff;
+		if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+			half++; // may carry into the exponent, which is the correct rounding
+
+		return (uint16_t)(sign | half);
+	}
+
+	inline static float ToFloat(const uint16_t value)
+	{
+		const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+		const uint32_t exponent = (value >> 10) & 0x1f;
+		uint32_t mantissa = value & 0x3ff;
+
+		uint32_t bits;
+		if (exponent == 0)
+		{
+			if (mantissa == 0)
+				bits = sign;
+			else
+			{
+				// normalize the subnormal
+				int shift = 0;
+				while ((mantissa & 0x400) == 0)
+				{
+					mantissa <<= 1;
+					shift++;
+				}
+				mantissa &= 0x3ff;
+				bits = sign | ((uint32_t)(127 - 15 + 1 - shift) << 23) | (mantissa << 13);
+			}
+		}
+		else if (exponent == 31)
+			bits = sign | 0x7f800000 | (mantissa << 13);
+		else
+			bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+		float result;
+		std::memcpy(&result, &bits, sizeof(result));
+
+		return result;
+	}
+
+	inline static void FromFloat(const float* source, uint16_t* destination, const size_t count)
+	{
+		size_t i = 0;
+#ifdef OMFR_HAS_F16C
+		for (; i + 8 <= count; i += 8)
+			_mm_storeu_si128((__m128i*)(destination + i), _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+		for (; i < count; i++)
+			destination[i] = FromFloat(source[i]);
+	}
+
+	inline static void ToFloat(const uint16_t* source, float* destination, const size_t count)
+	{
+		size_t i = 0;
+#ifdef OMFR_HAS_F16C
+		for (; i + 8 <= count; i += 8)
+			_mm256_storeu_ps(destination + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(source + i))));
+#endif
+		for (; i < count; i++)
+			destination[i] = ToFloat(source[i]);
+	}
+
+	// dot product of a float32 vector with a binary16 one, widened in registers
+	inline static float Dot(const float* a, const uint16_t* b, const size_t size)
+	{
+		size_t i = 0;
+		float dot = 0;
+#if defined(OMFR_HAS_F16C) && defined(__AVX2__)
+		__m256 sum0 = _mm256_setzero_ps();
+		__m256 sum1 = _mm256_setzero_ps();
+		for (; i + 16 <= size; i += 16)
+		{
+			sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(b + i))), sum0);
+			sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(b + i + 8))), sum1);
+		}
+		const __m256 sum = _mm256_add_ps(sum0, sum1);
+		const __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		const __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+		dot = _mm_cvtss_f32(_mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1)));
+#endif
+		for (; i < size; i++)
+			dot += a[i] * ToFloat(b[i]);
+
+		return dot;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,550 @@
+#include "HnswIndex.h"
+#include "HalfFloat.h"
+#include "Metrics.h"
+#include <fstream>
+#include <queue>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+	const char HnswMagic[8] = { 'O', 'M', 'F', 'R', 'H', 'N', 'S', 'W' };
+
+	struct HnswHeader
+	{
+		char magic[8];
+		uint32_t version;
+		int32_t dimension;
+		int32_t m;
+		int32_t efConstruction;
+		int32_t maxLevel;
+		int32_t entryPoint;
+		uint64_t count;
+		uint64_t galleryChecksum;
+	};
+}
+
+HnswIndex::HnswIndex(const int dimension, const int m, const int efConstruction, const int efSearch)
+	: _dimension(dimension), _m(std::max(m, 2)), _maxLevel0LinkCount(_m * 2), _efConstruction(std::max(efConstruction, _m)),
+	_efSearch(std::max(efSearch, 1)), _levelMultiplier(1 / std::log((double)_m)), _entryPoint(-1), _maxLevel(-1), _removedCount(0),
+	_galleryChecksum(0), _visitedMark(0), _generator(42)
+{
+}
+
+void HnswIndex::Build(const FaceGallery& gallery)
+{
+	Reset(gallery.GetDimension());
+
+	FaceIndex index(_dimension);
+	for (size_t row = 0; row < gallery.GetCount(); row++)
+	{
+		gallery.ReadEmbedding(row, index.data());
+		Insert(index);
+	}
+
+	_galleryChecksum = gallery.GetChecksum();
+}
+
+void HnswIndex::Build(const std::vector<FaceIndex>& indexes)
+{
+	Reset(_dimension);
+
+	for (const FaceIndex& index : indexes)
+		Insert(index);
+}
+
+int HnswIndex::Insert(const FaceIndex& index)
+{
+	if (index.size() != _dimension)
+	{
+		std::cout << "index size " << index.size() << " does not match ANN index dimension " << _dimension << std::endl;
+		return -1;
+	}
+
+	const float norm = std::sqrt(GallerySearcher::Dot(index.data(), index.data(), _dimension));
+	const float inverseNorm = norm > 0 ? 1 / norm : 0;
+	_probe.resize(_dimension);
+	for (int i = 0; i < _dimension; i++)
+		_probe[i] = index[i] * inverseNorm;
+
+	_galleryChecksum = 0;
+
+	return Insert(_probe.data());
+}
+
+bool HnswIndex::Remove(const int id)
+{
+	if (id < 0 || id >= (int)GetCount() || _removed[id])
+		return false;
+
+	_galleryChecksum = 0;
+	_removed[id] = 1;
+	_removedCount++;
+
+	return true;
+}
+
+bool HnswIndex::Save(const std::string& filepath) const
+{
+	std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "failed to open " << filepath << " for writing" << std::endl;
+		return false;
+	}
+
+	HnswHeader header;
+	std::memcpy(header.magic, HnswMagic, sizeof(HnswMagic));
+	header.version = _version;
+	header.dimension = _dimension;
+	header.m = _m;
+	header.efConstruction = _efConstruction;
+	header.maxLevel = _maxLevel;
+	header.entryPoint = _entryPoint;
+	header.count = GetCount();
+	header.galleryChecksum = _galleryChecksum;
+
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)_vectors.data(), _vectors.size() * sizeof(float));
+	file.write((const char*)_levels.data(), _levels.size() * sizeof(int));
+	file.write((const char*)_removed.data(), _removed.size());
+	file.write((const char*)_level0Links.data(), _level0Links.size() * sizeof(int));
+	for (const std::vector<int>& links : _upperLinks)
+		file.write((const char*)links.data(), links.size() * sizeof(int));
+
+	return file.good();
+}
+
+bool HnswIndex::Load(const std::string& filepath)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cout << "failed to open ANN index " << filepath << std::endl;
+		return false;
+	}
+
+	HnswHeader header;
+	file.read((char*)&header, sizeof(header));
+	if (!file.good() || std::memcmp(header.magic, HnswMagic, sizeof(HnswMagic)) != 0 || header.version != _version
+		|| header.dimension <= 0 || header.m < 2)
+	{
+		std::cout << "ANN index " << filepath << " is corrupted or has an unsupported version" << std::endl;
+		return false;
+	}
+
+	_m = header.m;
+	_maxLevel0LinkCount = _m * 2;
+	_efConstruction = header.efConstruction;
+	_levelMultiplier = 1 / std::log((double)_m);
+	Reset(header.dimension);
+
+	const size_t count = (size_t)header.count;
+	_vectors.resize(count * _dimension);
+	_levels.resize(count);
+	_removed.resize(count);
+	_level0Links.resize(count * (_maxLevel0LinkCount + 1));
+	file.read((char*)_vectors.data(), _vectors.size() * sizeof(float));
+	file.read((char*)_levels.data(), _levels.size() * sizeof(int));
+	file.read((char*)_removed.data(), _removed.size());
+	file.read((char*)_level0Links.data(), _level0Links.size() * sizeof(int));
+
+	_upperLinks.resize(count);
+	for (size_t id = 0; id < count && file.good(); id++)
+	{
+		if (_levels[id] < 0 || _levels[id] > header.maxLevel)
+		{
+			std::cout << "ANN index " << filepath << " is corrupted" << std::endl;
+			Reset(_dimension);
+			return false;
+		}
+
+		_upperLinks[id].resize(_levels[id] * (_m + 1));
+		file.read((char*)_upperLinks[id].data(), _upperLinks[id].size() * sizeof(int));
+	}
+
+	if (!file.good() || header.entryPoint < -1 || header.entryPoint >= (int64_t)count)
+	{
+		std::cout << "ANN index " << filepath << " is truncated" << std::endl;
+		Reset(_dimension);
+		return false;
+	}
+
+	// a search follows every stored link without checks, so one bad id would read out of bounds
+	bool linksOk = header.entryPoint == -1 ? count == 0 : _levels[header.entryPoint] == header.maxLevel;
+	for (size_t id = 0; id < count && linksOk; id++)
+	{
+		for (int level = 0; level <= _levels[id] && linksOk; level++)
+			linksOk = AreLinksValid(GetLinks((int)id, level), level);
+	}
+	if (!linksOk)
+	{
+		std::cout << "ANN index " << filepath << " is corrupted" << std::endl;
+		Reset(_dimension);
+		return false;
+	}
+
+	_entryPoint = header.entryPoint;
+	_maxLevel = header.maxLevel;
+	_galleryChecksum = header.galleryChecksum;
+	_halfVectors.resize(_vectors.size());
+	HalfFloat::FromFloat(_vectors.data(), _halfVectors.data(), _vectors.size());
+	_visitedMarks.assign(count, 0);
+	_removedCount = std::count(_removed.begin(), _removed.end(), 1);
+
+	return true;
+}
+
+void HnswIndex::SetEfSearch(const int efSearch)
+{
+	_efSearch = std::max(efSearch, 1);
+}
+
+int HnswIndex::GetEfSearch() const
+{
+	return _efSearch;
+}
+
+size_t HnswIndex::GetCount() const
+{
+	return _levels.size();
+}
+
+size_t HnswIndex::GetActiveCount() const
+{
+	return GetCount() - _removedCount;
+}
+
+int HnswIndex::GetDimension() const
+{
+	return _dimension;
+}
+
+uint64_t HnswIndex::GetGalleryChecksum() const
+{
+	return _galleryChecksum;
+}
+
+std::vector<GalleryMatch> HnswIndex::Search(const FaceIndex& probe, const int k, const float minSimilarity)
+{
+	const StageTimer timer(MetricStage::Matching);
+	Metrics::Get().AddCount(MetricCounter::GallerySearches);
+
+	std::vector<GalleryMatch> matches;
+	if (k <= 0 || _entryPoint < 0 || probe.size() != _dimension)
+		return matches;
+
+	const float norm = std::sqrt(GallerySearcher::Dot(probe.data(), probe.data(), _dimension));
+	if (norm == 0)
+		return matches;
+
+	_probe.resize(_dimension);
+	for (int i = 0; i < _dimension; i++)
+		_probe[i] = probe[i] / norm;
+
+	const int entryPoint = SearchGreedy(_probe.data(), _entryPoint, _maxLevel, 1, true);
+	const std::vector<Candidate>& candidates = SearchLevel(_probe.data(), entryPoint, std::max(_efSearch, k), 0, true, true);
+
+	// exact re-ranking of the fp16 candidates
+	matches.reserve(candidates.size());
+	for (const Candidate& candidate : candidates)
+	{
+		const float similarity = GetSimilarity(_probe.data(), candidate.second);
+		if (similarity > minSimilarity)
+			matches.push_back({ (size_t)candidate.second, similarity });
+	}
+
+	std::sort(matches.begin(), matches.end(), [](const GalleryMatch& m1, const GalleryMatch& m2) { return m1.similarity > m2.similarity; });
+	if (matches.size() > k)
+		matches.resize(k);
+
+	if (!matches.empty())
+		Metrics::Get().AddCount(MetricCounter::FacesMatched);
+
+	return matches;
+}
+
+int HnswIndex::Insert(const float* vector)
+{
+	const int id = (int)GetCount();
+	const int level = GetRandomLevel();
+
+	_vectors.insert(_vectors.end(), vector, vector + _dimension);
+	_halfVectors.resize(_vectors.size());
+	HalfFloat::FromFloat(vector, _halfVectors.data() + (size_t)id * _dimension, _dimension);
+	_levels.emplace_back(level);
+	_removed.emplace_back(0);
+	_level0Links.resize(_level0Links.size() + _maxLevel0LinkCount + 1, 0);
+	_upperLinks.emplace_back(std::vector<int>(level * (_m + 1), 0));
+	_visitedMarks.emplace_back(0);
+
+	if (_entryPoint < 0)
+	{
+		_entryPoint = id;
+		_maxLevel = level;
+		return id;
+	}
+
+	const float* insertedVector = GetVector(id);
+	int entryPoint = SearchGreedy(insertedVector, _entryPoint, _maxLevel, level + 1, false);
+
+	for (int currentLevel = std::min(level, _maxLevel); currentLevel >= 0; currentLevel--)
+	{
+		std::vector<Candidate> candidates = SearchLevel(insertedVector, entryPoint, _efConstruction, currentLevel, false, false);
+		entryPoint = candidates[0].second;
+
+		SelectNeighbours(candidates, _m);
+
+		int* links = GetLinks(id, currentLevel);
+		links[0] = (int)candidates.size();
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			links[i + 1] = candidates[i].second;
+			ConnectNeighbour(candidates[i].second, id, currentLevel);
+		}
+	}
+
+	if (level > _maxLevel)
+	{
+		_entryPoint = id;
+		_maxLevel = level;
+	}
+
+	return id;
+}
+
+int HnswIndex::GetRandomLevel()
+{
+	std::uniform_real_distribution<double> distribution(std::numeric_limits<double>::min(), 1.0);
+
+	return (int)(-std::log(distribution(_generator)) * _levelMultiplier);
+}
+
+int* HnswIndex::GetLinks(const int id, const int level)
+{
+	if (level == 0)
+		return _level0Links.data() + (size_t)id * (_maxLevel0LinkCount + 1);
+
+	return _upperLinks[id].data() + (level - 1) * (_m + 1);
+}
+
+const int* HnswIndex::GetLinks(const int id, const int level) const
+{
+	if (level == 0)
+		return _level0Links.data() + (size_t)id * (_maxLevel0LinkCount + 1);
+
+	return _upperLinks[id].data() + (level - 1) * (_m + 1);
+}
+
+int HnswIndex::GetMaxLinkCount(const int level) const
+{
+	return level == 0 ? _maxLevel0LinkCount : _m;
+}
+
+const float* HnswIndex::GetVector(const int id) const
+{
+	return _vectors.data() + (size_t)id * _dimension;
+}
+
+const uint16_t* HnswIndex::GetHalfVector(const int id) const
+{
+	return _halfVectors.data() + (size_t)id * _dimension;
+}
+
+float HnswIndex::GetSimilarity(const float* vector, const int id) const
+{
+	return GallerySearcher::Dot(vector, GetVector(id), _dimension);
+}
+
+float HnswIndex::GetApproximateSimilarity(const float* vector, const int id) const
+{
+	return HalfFloat::Dot(vector, GetHalfVector(id), _dimension);
+}
+
+void HnswIndex::StartVisit()
+{
+	_visitedMark++;
+	if (_visitedMark == 0)
+	{
+		std::fill(_visitedMarks.begin(), _visitedMarks.end(), 0);
+		_visitedMark = 1;
+	}
+}
+
+// walks down the upper levels always moving to the most similar neighbour
+int HnswIndex::SearchGreedy(const float* vector, int entryPoint, const int fromLevel, const int toLevel, const bool approximate)
+{
+	float bestSimilarity = approximate ? GetApproximateSimilarity(vector, entryPoint) : GetSimilarity(vector, entryPoint);
+
+	for (int level = fromLevel; level >= toLevel; level--)
+	{
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			const int* links = GetLinks(entryPoint, level);
+			for (int i = 1; i <= links[0]; i++)
+			{
+				const int neighbour = links[i];
+				const float similarity = approximate ? GetApproximateSimilarity(vector, neighbour) : GetSimilarity(vector, neighbour);
+				if (similarity > bestSimilarity)
+				{
+					bestSimilarity = similarity;
+					entryPoint = neighbour;
+					changed = true;
+				}
+			}
+		}
+	}
+
+	return entryPoint;
+}
+
+// beam search on one level, returns up to ef candidates, most similar first
+std::vector<HnswIndex::Candidate> HnswIndex::SearchLevel(const float* vector, const int entryPoint, const int ef, const int level,
+	const bool approximate, const bool skipRemoved)
+{
+	StartVisit();
+
+	std::priority_queue<Candidate> candidates;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> results;
+
+	const float entrySimilarity = approximate ? GetApproximateSimilarity(vector, entryPoint) : GetSimilarity(vector, entryPoint);
+	candidates.emplace(entrySimilarity, entryPoint);
+	if (!skipRemoved || !_removed[entryPoint])
+		results.emplace(entrySimilarity, entryPoint);
+	_visitedMarks[entryPoint] = _visitedMark;
+
+	float lowerBound = results.empty() ? -std::numeric_limits<float>::max() : entrySimilarity;
+
+	while (!candidates.empty())
+	{
+		const Candidate current = candidates.top();
+		if (current.first < lowerBound && results.size() >= ef)
+			break;
+
+		candidates.pop();
+
+		const int* links = GetLinks(current.second, level);
+		for (int i = 1; i <= links[0]; i++)
+		{
+			const int neighbour = links[i];
+			if (_visitedMarks[neighbour] == _visitedMark)
+				continue;
+
+			_visitedMarks[neighbour] = _visitedMark;
+
+			const float similarity = approximate ? GetApproximateSimilarity(vector, neighbour) : GetSimilarity(vector, neighbour);
+			if (results.size() >= ef && similarity <= lowerBound)
+				continue;
+
+			candidates.emplace(similarity, neighbour);
+			if (!skipRemoved || !_removed[neighbour])
+				results.emplace(similarity, neighbour);
+			if (results.size() > ef)
+				results.pop();
+			if (!results.empty())
+				lowerBound = results.top().first;
+		}
+	}
+
+	std::vector<Candidate> sortedResults(results.size());
+	for (size_t i = sortedResults.size(); i > 0; i--)
+	{
+		sortedResults[i - 1] = results.top();
+		results.pop();
+	}
+
+	return sortedResults;
+}
+
+// keeps candidates that are closer to the new node than to any already selected neighbour,
+// which preserves links between clusters; candidates come sorted by similarity
+void HnswIndex::SelectNeighbours(std::vector<Candidate>& candidates, const int maxCount) const
+{
+	if (candidates.size() <= maxCount)
+		return;
+
+	std::vector<Candidate> selected;
+	selected.reserve(maxCount);
+
+	for (const Candidate& candidate : candidates)
+	{
+		if (selected.size() >= maxCount)
+			break;
+
+		bool keep = true;
+		for (const Candidate& other : selected)
+		{
+			if (GetSimilarity(GetVector(candidate.second), other.second) > candidate.first)
+			{
+				keep = false;
+				break;
+			}
+		}
+
+		if (keep)
+			selected.emplace_back(candidate);
+	}
+
+	candidates = std::move(selected);
+}
+
+void HnswIndex::ConnectNeighbour(const int id, const int neighbour, const int level)
+{
+	int* links = GetLinks(id, level);
+	const int maxLinkCount = GetMaxLinkCount(level);
+
+	if (links[0] < maxLinkCount)
+	{
+		links[links[0] + 1] = neighbour;
+		links[0]++;
+		return;
+	}
+
+	const float* vector = GetVector(id);
+	std::vector<Candidate> candidates;
+	candidates.reserve(maxLinkCount + 1);
+	candidates.emplace_back(GetSimilarity(vector, neighbour), neighbour);
+	for (int i = 1; i <= links[0]; i++)
+		candidates.emplace_back(GetSimilarity(vector, links[i]), links[i]);
+
+	std::sort(candidates.begin(), candidates.end(), std::greater<Candidate>());
+	SelectNeighbours(candidates, maxLinkCount);
+
+	links[0] = (int)candidates.size();
+	for (size_t i = 0; i < candidates.size(); i++)
+		links[i + 1] = candidates[i].second;
+}
+
+// unused slots past the count are not read, every neighbour has to exist on the level it is linked on
+bool HnswIndex::AreLinksValid(const int* links, const int level) const
+{
+	if (links[0] < 0 || links[0] > GetMaxLinkCount(level))
+		return false;
+
+	for (int i = 1; i <= links[0]; i++)
+	{
+		if (links[i] < 0 || links[i] >= (int)_levels.size() || _levels[links[i]] < level)
+			return false;
+	}
+
+	return true;
+}
+
+void HnswIndex::Reset(const int dimension)
+{
+	_dimension = dimension;
+	_entryPoint = -1;
+	_maxLevel = -1;
+	_removedCount = 0;
+	_galleryChecksum = 0;
+	_vectors.clear();
+	_halfVectors.clear();
+	_levels.clear();
+	_removed.clear();
+	_level0Links.clear();
+	_upperLinks.clear();
+	_visitedMarks.clear();
+	_visitedMark = 0;
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "GallerySearcher.h"
+#include <random>
+
+// Hierarchical navigable small world graph over L2-normalized face embeddings, ids are insertion order
+// (gallery rows when built from a FaceGallery). The graph is built on exact float32 vectors and walked
+// on fp16 copies, which halves the memory traffic of a search; the ef best candidates are then
+// re-ranked with exact cosine similarity. Removed ids stay in the graph for navigation only.
+// efSearch is the recall/latency knob: more candidates per query, higher recall, slower search.
+class HnswIndex
+{
+private:
+	static const uint32_t _version = 2;
+	int _dimension;
+	int _m;
+	int _maxLevel0LinkCount;
+	int _efConstruction;
+	int _efSearch;
+	double _levelMultiplier;
+	int _entryPoint;
+	int _maxLevel;
+	size_t _removedCount;
+	uint64_t _galleryChecksum;
+	std::vector<float> _vectors;
+	std::vector<uint16_t> _halfVectors;
+	std::vector<int> _levels;
+	std::vector<uchar> _removed;
+	std::vector<int> _level0Links; // per node: count, then up to 2 * m neighbours
+	std::vector<std::vector<int>> _upperLinks; // per node, per level above 0: count, then up to m neighbours
+	std::vector<uint32_t> _visitedMarks;
+	uint32_t _visitedMark;
+	std::mt19937 _generator;
+	std::vector<float> _probe;
+
+public:
+	HnswIndex(const int dimension = 512, const int m = 16, const int efConstruction = 200, const int efSearch = 64);
+
+	void Build(const FaceGallery& gallery);
+	void Build(const std::vector<FaceIndex>& indexes);
+	// returns the id of the new entry or -1 if the index has a wrong size
+	int Insert(const FaceIndex& index);
+	bool Remove(const int id);
+	bool Save(const std::string& filepath) const;
+	bool Load(const std::string& filepath);
+
+	void SetEfSearch(const int efSearch);
+	int GetEfSearch() const;
+	size_t GetCount() const;
+	size_t GetActiveCount() const;
+	int GetDimension() const;
+	// checksum of the FaceGallery the index was built from, 0 once entries were added or removed by hand
+	uint64_t GetGalleryChecksum() const;
+
+	// best matches first, GalleryMatch::row holds the id; minSimilarity is exclusive as in GallerySearcher::Search
+	std::vector<GalleryMatch> Search(const FaceIndex& probe, const int k, const float minSimilarity = -1);
+
+private:
+	typedef std::pair<float, int> Candidate; // similarity, id
+
+	int Insert(const float* vector);
+	int GetRandomLevel();
+	int* GetLinks(const int id, const int level);
+	const int* GetLinks(const int id, const int level) const;
+	int GetMaxLinkCount(const int level) const;
+	const float* GetVector(const int id) const;
+	const uint16_t* GetHalfVector(const int id) const;
+	float GetSimilarity(const float* vector, const int id) const;
+	float GetApproximateSimilarity(const float* vector, const int id) const;
+	void StartVisit();
+	int SearchGreedy(const float* vector, int entryPoint, const int fromLevel, const int toLevel, const bool approximate);
+	std::vector<Candidate> SearchLevel(const float* vector, const int entryPoint, const int ef, const int level,
+		const bool approximate, const bool skipRemoved);
+	void SelectNeighbours(std::vector<Candidate>& candidates, const int maxCount) const;
+	void ConnectNeighbour(const int id, const int neighbour, const int level);
+	bool AreLinksValid(const int* links, const int level) const;
+	void Reset(const int dimension);
+};
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "ImagePreprocessor.h"
+#include <immintrin.h>
+
+ImagePreprocessor::ImagePreprocessor(const cv::Size& inputSize, const float inputMean, const float inputStdNorm)
+	:_inputSize(inputSize), _inputMean(inputMean), _inputStdNorm(inputStdNorm), _tableSourceWidth(0), _tableTargetWidth(0)
+{
+}
+
+void ImagePreprocessor::Prepare(const cv::Mat& image, float* tensor, float* scaleFactor)
+{
+	const cv::Size& fittedSize = GetFittedSize(image.size(), scaleFactor);
+	UpdateColumnTables(image.cols, fittedSize.width);
+
+	const int planeSize = _inputSize.width * _inputSize.height;
+	float* planes[3] = { tensor, tensor + planeSize, tensor + planeSize * 2 }; // RGB
+	const float padValue = -_inputMean * _inputStdNorm;
+
+	// only the source columns touched by the horizontal taps are blended
+	const int spanBegin = _xOffsets[0];
+	const int spanEnd = _xNextOffsets[fittedSize.width - 1] + 3;
+
+	const float yScale = (float)image.rows / fittedSize.height;
+
+	for (int y = 0; y < fittedSize.height; y++)
+	{
+		// same pixel-center mapping as cv::resize with INTER_LINEAR
+		const float sy = (y + 0.5f) * yScale - 0.5f;
+		int y0 = (int)std::floor(sy);
+		float fy = sy - y0;
+		if (y0 < 0)
+		{
+			y0 = 0;
+			fy = 0;
+		}
+		if (y0 >= image.rows - 1)
+		{
+			y0 = image.rows - 1;
+			fy = 0;
+		}
+		const int y1 = std::min(y0 + 1, image.rows - 1);
+
+		BlendRows(image.ptr<uchar>(y0), image.ptr<uchar>(y1), fy, spanBegin, spanEnd);
+
+		float* rowPlanes[3] = { planes[0] + y * _inputSize.width, planes[1] + y * _inputSize.width, planes[2] + y * _inputSize.width };
+		WriteRow(rowPlanes, fittedSize.width);
+
+		for (int c = 0; c < 3; c++)
+			std::fill(rowPlanes[c] + fittedSize.width, rowPlanes[c] + _inputSize.width, padValue);
+	}
+
+	const int paddedRowsOffset = fittedSize.height * _inputSize.width;
+	for (int c = 0; c < 3; c++)
+		std::fill(planes[c] + paddedRowsOffset, planes[c] + planeSize, padValue);
+}
+
+const cv::Size& ImagePreprocessor::GetInputSize() const
+{
+	return _inputSize;
+}
+
+cv::Size ImagePreprocessor::GetFittedSize(const cv::Size& imageSize, float* scaleFactor) const
+{
+	const float im_ratio = (float)imageSize.height / imageSize.width;
+	const float model_ratio = (float)_inputSize.height / _inputSize.width;
+
+	int newWidth = 0;
+	int newHeight = 0;
+
+	if (im_ratio > model_ratio)
+	{
+		newHeight = _inputSize.height;
+		newWidth = std::max((int)(newHeight / im_ratio), 1);
+		*scaleFactor = (float)newWidth / imageSize.width;
+	}
+	else
+	{
+		newWidth = _inputSize.width;
+		newHeight = std::max((int)(newWidth * im_ratio), 1);
+		*scaleFactor = (float)newHeight / imageSize.height;
+	}
+
+	return cv::Size(newWidth, newHeight);
+}
+
+void ImagePreprocessor::UpdateColumnTables(const int sourceWidth, const int targetWidth)
+{
+	if (sourceWidth == _tableSourceWidth && targetWidth == _tableTargetWidth)
+		return;
+
+	_xOffsets.resize(targetWidth);
+	_xNextOffsets.resize(targetWidth);
+	_xWeights.resize(targetWidth);
+	_rowBuffer.resize(sourceWidth * 3);
+
+	const float xScale = (float)sourceWidth / targetWidth;
+
+	for (int x = 0; x < targetWidth; x++)
+	{
+		const float sx = (x + 0.5f) * xScale - 0.5f;
+		int x0 = (int)std::floor(sx);
+		float fx = sx - x0;
+		if (x0 < 0)
+		{
+			x0 = 0;
+			fx = 0;
+		}
+		if (x0 >= sourceWidth - 1)
+		{
+			x0 = sourceWidth - 1;
+			fx = 0;
+		}
+		const int x1 = std::min(x0 + 1, sourceWidth - 1);
+
+		_xOffsets[x] = x0 * 3;
+		_xNextOffsets[x] = x1 * 3;
+		_xWeights[x] = fx;
+	}
+
+	_tableSourceWidth = sourceWidth;
+	_tableTargetWidth = targetWidth;
+}
+
+// vertical pass with normalization folded in: ((p0 * (1 - w) + p1 * w) - mean) * norm
+void ImagePreprocessor::BlendRows(const uchar* row0, const uchar* row1, const float weight, const int begin, const int end)
+{
+	const float w0 = (1 - weight) * _inputStdNorm;
+	const float w1 = weight * _inputStdNorm;
+	const float bias = -_inputMean * _inputStdNorm;
+
+	float* buffer = _rowBuffer.data();
+	int k = begin;
+
+#if defined(__AVX2__)
+	const __m256 vw0 = _mm256_set1_ps(w0);
+	const __m256 vw1 = _mm256_set1_ps(w1);
+	const __m256 vbias = _mm256_set1_ps(bias);
+	for (; k + 8 <= end; k += 8)
+	{
+		const __m256 p0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(row0 + k))));
+		const __m256 p1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(row1 + k))));
+		const __m256 value = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p0, vw0), _mm256_mul_ps(p1, vw1)), vbias);
+		_mm256_storeu_ps(buffer + k, value);
+	}
+#elif defined(__SSE2__) || defined(_M_X64)
+	const __m128 vw0 = _mm_set1_ps(w0);
+	const __m128 vw1 = _mm_set1_ps(w1);
+	const __m128 vbias = _mm_set1_ps(bias);
+	const __m128i zero = _mm_setzero_si128();
+	for (; k + 4 <= end; k += 4)
+	{
+		int packed0;
+		int packed1;
+		std::memcpy(&packed0, row0 + k, sizeof(int));
+		std::memcpy(&packed1, row1 + k, sizeof(int));
+		const __m128i w0i = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed0), zero), zero);
+		const __m128i w1i = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed1), zero), zero);
+		const __m128 p0 = _mm_cvtepi32_ps(w0i);
+		const __m128 p1 = _mm_cvtepi32_ps(w1i);
+		_mm_storeu_ps(buffer + k, _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, vw0), _mm_mul_ps(p1, vw1)), vbias));
+	}
+#endif
+
+	for (; k < end; k++)
+		buffer[k] = row0[k] * w0 + row1[k] * w1 + bias;
+}
+
+// horizontal pass, BGR interleaved to RGB planes
+void ImagePreprocessor::WriteRow(float* planes[3], const int targetWidth)
+{
+	const float* buffer = _rowBuffer.data();
+	int x = 0;
+
+#if defined(__AVX2__)
+	for (; x + 8 <= targetWidth; x += 8)
+	{
+		const __m256i offsets = _mm256_loadu_si256((const __m256i*)(_xOffsets.data() + x));
+		const __m256i nextOffsets = _mm256_loadu_si256((const __m256i*)(_xNextOffsets.data() + x));
+		const __m256 weights = _mm256_loadu_ps(_xWeights.data() + x);
+
+		for (int c = 0; c < 3; c++)
+		{
+			const __m256i channel = _mm256_set1_epi32(c);
+			const __m256 left = _mm256_i32gather_ps(buffer, _mm256_add_epi32(offsets, channel), 4);
+			const __m256 right = _mm256_i32gather_ps(buffer, _mm256_add_epi32(nextOffsets, channel), 4);
+			const __m256 value = _mm256_add_ps(left, _mm256_mul_ps(_mm256_sub_ps(right, left), weights));
+			_mm256_storeu_ps(planes[2 - c] + x, value);
+		}
+	}
+#endif
+
+	for (; x < targetWidth; x++)
+	{
+		const float* left = buffer + _xOffsets[x];
+		const float* right = buffer + _xNextOffsets[x];
+		const float weight = _xWeights[x];
+
+		for (int c = 0; c < 3; c++)
+			planes[2 - c][x] = left[c] + (right[c] - left[c]) * weight;
+	}
+}
\ No newline at end of file
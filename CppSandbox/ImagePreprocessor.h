@@ -0,0 +1,32 @@
+#pragma once
+
+#include "CvInclude.h"
+
+// Fused replacement for resize + letterbox + cv::dnn::blobFromImage.
+// Bilinearly resizes a BGR CV_8UC3 image to fit the input size, pads the bottom/right with black,
+// swaps to RGB, normalizes and writes planar float (CHW) straight into a caller-owned tensor in one pass.
+// Scratch tables only grow, so repeated calls with the same source width do not allocate.
+class ImagePreprocessor
+{
+private:
+	const cv::Size _inputSize;
+	const float _inputMean;
+	const float _inputStdNorm;
+	int _tableSourceWidth;
+	int _tableTargetWidth;
+	std::vector<int> _xOffsets;
+	std::vector<int> _xNextOffsets;
+	std::vector<float> _xWeights;
+	std::vector<float> _rowBuffer;
+
+public:
+	ImagePreprocessor(const cv::Size& inputSize, const float inputMean = 127.5f, const float inputStdNorm = 1 / 128.0f);
+	void Prepare(const cv::Mat& image, float* tensor, float* scaleFactor);
+	const cv::Size& GetInputSize() const;
+
+private:
+	cv::Size GetFittedSize(const cv::Size& imageSize, float* scaleFactor) const;
+	void UpdateColumnTables(const int sourceWidth, const int targetWidth);
+	void BlendRows(const uchar* row0, const uchar* row1, const float weight, const int begin, const int end);
+	void WriteRow(float* planes[3], const int targetWidth);
+};
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Inference objects (detector, indexer, analyzer) keep their scratch and tensor buffers inside and are not thread safe:
+// one instance serves one call at a time. The pool makes a fixed number of instances available to any number of threads,
+// Acquire() blocks until one is free and the lease hands it back when it goes out of scope.
+// Pool size and InferenceOptions::intraOpThreadCount together pick the deployment trade-off:
+// one instance with many intra-op threads for the lowest latency of a single request,
+// or one instance per core with one intra-op thread each for the highest throughput of many requests.
+template <typename T>
+class InferencePool
+{
+public:
+	class Lease
+	{
+	private:
+		InferencePool* _pool;
+		T* _instance;
+
+	public:
+		Lease(InferencePool* pool, T* instance)
+			: _pool(pool), _instance(instance)
+		{
+		}
+
+		Lease(Lease&& other)
+			: _pool(other._pool), _instance(other._instance)
+		{
+			other._instance = nullptr;
+		}
+
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+		Lease& operator=(Lease&&) = delete;
+
+		~Lease()
+		{
+			if (_instance != nullptr)
+				_pool->Release(_instance);
+		}
+
+		T* operator->() const
+		{
+			return _instance;
+		}
+
+		T& operator*() const
+		{
+			return *_instance;
+		}
+	};
+
+private:
+	std::vector<std::unique_ptr<T>> _instances;
+	std::vector<T*> _freeInstances;
+	std::mutex _mutex;
+	std::condition_variable _instanceReleased;
+
+public:
+	// instances are created up front, on the calling thread
+	InferencePool(const int size, const std::function<std::unique_ptr<T>()>& create)
+	{
+		const int instanceCount = size > 0 ? size : 1;
+		_instances.reserve(instanceCount);
+		_freeInstances.reserve(instanceCount);
+		for (int i = 0; i < instanceCount; i++)
+		{
+			_instances.emplace_back(create());
+			_freeInstances.emplace_back(_instances.back().get());
+		}
+	}
+
+	InferencePool(const InferencePool&) = delete;
+	InferencePool& operator=(const InferencePool&) = delete;
+
+	// all leases have to be returned before the pool is destroyed
+	Lease Acquire()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_instanceReleased.wait(lock, [this]() { return !_freeInstances.empty(); });
+
+		T* instance = _freeInstances.back();
+		_freeInstances.pop_back();
+
+		return Lease(this, instance);
+	}
+
+	int GetSize() const
+	{
+		return (int)_instances.size();
+	}
+
+private:
+	void Release(T* instance)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_freeInstances.emplace_back(instance);
+		}
+
+		_instanceReleased.notify_one();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "InferenceSession.h"
+#include <numeric>
+#include <stdexcept>
+
+InferenceSession::InferenceSession(Ort::Env& env, const std::string& modelFilepath, const std::vector<int64_t>& sampleInputShape,
+	const int maxBatchSize, const std::vector<std::vector<int64_t>>& sampleOutputShapes, const InferenceOptions& options)
+	:_session(CreateSession(env, modelFilepath, options)),
+	_memoryInfo(Ort::MemoryInfo::CreateCpu(OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault)),
+	_maxBatchSize(std::max(maxBatchSize, 1))
+{
+	Ort::AllocatorWithDefaultOptions allocator;
+
+	char* inputName = _session.GetInputName(0, allocator);
+	_inputName = inputName;
+	allocator.Free(inputName);
+
+	const size_t numOutputNodes = _session.GetOutputCount();
+	_outputNames.reserve(numOutputNodes);
+	std::vector<size_t> modelOutputRanks;
+	modelOutputRanks.reserve(numOutputNodes);
+	for (int i = 0; i < numOutputNodes; i++)
+	{
+		char* outputName = _session.GetOutputName(i, allocator);
+		_outputNames.emplace_back(outputName);
+		allocator.Free(outputName);
+
+		modelOutputRanks.emplace_back(_session.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape().size());
+	}
+
+	const std::vector<std::vector<int64_t>>& outputShapes = sampleOutputShapes.empty() ? ReadSampleOutputShapes() : sampleOutputShapes;
+	if (outputShapes.size() != numOutputNodes)
+		throw std::runtime_error("output shape count does not match the model: " + modelFilepath);
+
+	// persistent buffers sized for the largest batch
+	_sampleInputSize = Utils::VectorProduct(sampleInputShape);
+	_inputBuffer.resize(_sampleInputSize * _maxBatchSize);
+
+	_sampleOutputSizes.reserve(numOutputNodes);
+	_outputBuffers.reserve(numOutputNodes);
+	for (int i = 0; i < numOutputNodes; i++)
+	{
+		_sampleOutputSizes.emplace_back(Utils::VectorProduct(outputShapes[i]));
+		_outputBuffers.emplace_back(std::vector<float>(_sampleOutputSizes[i] * _maxBatchSize));
+	}
+
+	// tensors are views over the buffers above, one binding per batch size
+	_tensors.reserve(_maxBatchSize * (numOutputNodes + 1));
+	_bindings.reserve(_maxBatchSize);
+	for (int batchSize = 1; batchSize <= _maxBatchSize; batchSize++)
+	{
+		Ort::IoBinding binding(_session);
+
+		std::vector<int64_t> inputDims = GetBatchShape(sampleInputShape, sampleInputShape.size() + 1, batchSize);
+		_tensors.emplace_back(Ort::Value::CreateTensor<float>(_memoryInfo, _inputBuffer.data(),
+			_sampleInputSize * batchSize, inputDims.data(), inputDims.size()));
+		binding.BindInput(_inputName.c_str(), _tensors.back());
+
+		for (int i = 0; i < numOutputNodes; i++)
+		{
+			std::vector<int64_t> outputDims = GetBatchShape(outputShapes[i], modelOutputRanks[i], batchSize);
+			_tensors.emplace_back(Ort::Value::CreateTensor<float>(_memoryInfo, _outputBuffers[i].data(),
+				_sampleOutputSizes[i] * batchSize, outputDims.data(), outputDims.size()));
+			binding.BindOutput(_outputNames[i].c_str(), _tensors.back());
+		}
+
+		_bindings.emplace_back(std::move(binding));
+	}
+}
+
+float* InferenceSession::GetInputData(const int sampleIndex)
+{
+	return _inputBuffer.data() + _sampleInputSize * sampleIndex;
+}
+
+size_t InferenceSession::GetSampleInputSize() const
+{
+	return _sampleInputSize;
+}
+
+size_t InferenceSession::GetOutputCount() const
+{
+	return _outputBuffers.size();
+}
+
+const float* InferenceSession::GetOutputData(const size_t outputIndex, const int sampleIndex) const
+{
+	return _outputBuffers[outputIndex].data() + _sampleOutputSizes[outputIndex] * sampleIndex;
+}
+
+size_t InferenceSession::GetSampleOutputSize(const size_t outputIndex) const
+{
+	return _sampleOutputSizes[outputIndex];
+}
+
+int InferenceSession::GetMaxBatchSize() const
+{
+	return _maxBatchSize;
+}
+
+void InferenceSession::Run(const int batchSize)
+{
+	_session.Run(Ort::RunOptions{ nullptr }, _bindings[batchSize - 1]);
+}
+
+std::vector<std::vector<int64_t>> InferenceSession::ReadSampleOutputShapes() const
+{
+	const size_t numOutputNodes = _session.GetOutputCount();
+
+	std::vector<std::vector<int64_t>> sampleShapes;
+	sampleShapes.reserve(numOutputNodes);
+
+	for (int i = 0; i < numOutputNodes; i++)
+	{
+		const std::vector<int64_t>& modelShape = _session.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+		std::vector<int64_t> sampleShape(modelShape.begin() + 1, modelShape.end()); // drop the batch dimension
+		for (const int64_t dim : sampleShape)
+		{
+			if (dim < 0)
+				throw std::runtime_error("model output has dynamic dimensions, sample output shapes must be provided");
+		}
+
+		sampleShapes.emplace_back(sampleShape);
+	}
+
+	return sampleShapes;
+}
+
+std::vector<int64_t> InferenceSession::GetBatchShape(const std::vector<int64_t>& sampleShape, const size_t modelRank,
+	const int batchSize)
+{
+	std::vector<int64_t> batchShape(sampleShape);
+
+	if (sampleShape.size() == modelRank)
+		batchShape[0] *= batchSize;
+	else
+		batchShape.insert(batchShape.begin(), batchSize);
+
+	return batchShape;
+}
\ No newline at end of file
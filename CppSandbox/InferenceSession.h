@@ -0,0 +1,44 @@
+#pragma once
+
+#include "OrtUtils.h"
+#include <vector>
+#include <string>
+
+// Owns an Ort::Session together with persistent input/output buffers that stay bound through Ort::IoBinding.
+// Names, shapes and bindings for every batch size up to maxBatchSize are created at construction,
+// so Run() performs no lookups and no heap allocation.
+// Sample shapes exclude the batch dimension. When a sample output shape has the same rank as the model output,
+// the batch is folded into its first dimension (e.g. flattened RetinaFace anchors), otherwise it is prepended.
+// The buffers make Run() stateful: an instance serves one thread at a time, concurrent callers need an instance each.
+class InferenceSession
+{
+private:
+	Ort::Session _session;
+	Ort::MemoryInfo _memoryInfo;
+	const int _maxBatchSize;
+	std::string _inputName;
+	std::vector<std::string> _outputNames;
+	size_t _sampleInputSize;
+	std::vector<size_t> _sampleOutputSizes;
+	std::vector<float> _inputBuffer;
+	std::vector<std::vector<float>> _outputBuffers;
+	std::vector<Ort::Value> _tensors;
+	std::vector<Ort::IoBinding> _bindings; // one per batch size
+
+public:
+	InferenceSession(Ort::Env& env, const std::string& modelFilepath, const std::vector<int64_t>& sampleInputShape,
+		const int maxBatchSize = 1, const std::vector<std::vector<int64_t>>& sampleOutputShapes = {},
+		const InferenceOptions& options = InferenceOptions());
+
+	float* GetInputData(const int sampleIndex = 0);
+	size_t GetSampleInputSize() const;
+	size_t GetOutputCount() const;
+	const float* GetOutputData(const size_t outputIndex, const int sampleIndex = 0) const;
+	size_t GetSampleOutputSize(const size_t outputIndex) const;
+	int GetMaxBatchSize() const;
+	void Run(const int batchSize);
+
+private:
+	std::vector<std::vector<int64_t>> ReadSampleOutputShapes() const;
+	static std::vector<int64_t> GetBatchShape(const std::vector<int64_t>& sampleShape, const size_t modelRank, const int batchSize);
+};
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <initializer_list>
+#include <utility>
+#include <cstddef>
+#include <stdexcept>
+
+// Vector-like container with a fixed capacity stored inside the object, for small per-face sets such as the five landmarks
+// that would otherwise be a heap allocation each and be copied with every Face. Copying it copies the elements only.
+// Adding past the capacity throws std::length_error in every build. Method names follow the standard containers,
+// so it replaces a std::vector in place.
+template <typename T, int Capacity>
+class InlineVector
+{
+private:
+	T _items[Capacity];
+	int _size;
+
+public:
+	InlineVector()
+		: _size(0)
+	{
+	}
+
+	InlineVector(std::initializer_list<T> items)
+		: _size(0)
+	{
+		for (const T& item : items)
+			push_back(item);
+	}
+
+	size_t size() const
+	{
+		return (size_t)_size;
+	}
+
+	bool empty() const
+	{
+		return _size == 0;
+	}
+
+	size_t capacity() const
+	{
+		return (size_t)Capacity;
+	}
+
+	// the storage is already there, kept for code written against std::vector
+	void reserve(const size_t count)
+	{
+		if (count > (size_t)Capacity)
+			throw std::length_error("InlineVector capacity exceeded");
+	}
+
+	void clear()
+	{
+		_size = 0;
+	}
+
+	void push_back(const T& item)
+	{
+		reserve(_size + 1);
+		_items[_size++] = item;
+	}
+
+	template <typename... Args>
+	void emplace_back(Args&&... args)
+	{
+		reserve(_size + 1);
+		_items[_size++] = T(std::forward<Args>(args)...);
+	}
+
+	T& operator[](const size_t index)
+	{
+		return _items[index];
+	}
+
+	const T& operator[](const size_t index) const
+	{
+		return _items[index];
+	}
+
+	T* data()
+	{
+		return _items;
+	}
+
+	const T* data() const
+	{
+		return _items;
+	}
+
+	T* begin()
+	{
+		return _items;
+	}
+
+	const T* begin() const
+	{
+		return _items;
+	}
+
+	T* end()
+	{
+		return _items + _size;
+	}
+
+	const T* end() const
+	{
+		return _items + _size;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <immintrin.h>
+
+// Symmetric int8 quantization with one scale per vector: value ~= q * scale, q in [-127, 127].
+// A row is the quantized values followed by the float scale at the next 4-byte boundary.
+class Int8Quantizer
+{
+public:
+	inline static size_t GetScaleOffset(const size_t size)
+	{
+		return (size + 3) / 4 * 4;
+	}
+
+	inline static size_t GetRowSize(const size_t size)
+	{
+		return GetScaleOffset(size) + sizeof(float);
+	}
+
+	inline static float Quantize(const float* source, int8_t* destination, const size_t size)
+	{
+		float maxValue = 0;
+		for (size_t i = 0; i < size; i++)
+			maxValue = std::max(maxValue, std::abs(source[i]));
+
+		const float scale = maxValue > 0 ? maxValue / 127 : 1;
+		const float inverseScale = 1 / scale;
+		for (size_t i = 0; i < size; i++)
+			destination[i] = (int8_t)std::max(std::min((int)std::lround(source[i] * inverseScale), 127), -127);
+
+		return scale;
+	}
+
+	inline static void QuantizeRow(const float* source, unsigned char* row, const size_t size)
+	{
+		const float scale = Quantize(source, (int8_t*)row, size);
+		std::memcpy(row + GetScaleOffset(size), &scale, sizeof(float));
+	}
+
+	inline static float GetScale(const unsigned char* row, const size_t size)
+	{
+		float scale;
+		std::memcpy(&scale, row + GetScaleOffset(size), sizeof(float));
+
+		return scale;
+	}
+
+	inline static void Dequantize(const unsigned char* row, float* destination, const size_t size)
+	{
+		const int8_t* values = (const int8_t*)row;
+		const float scale = GetScale(row, size);
+		for (size_t i = 0; i < size; i++)
+			destination[i] = values[i] * scale;
+	}
+
+	// integer dot product, exact as long as size < 2^17; maddubs takes unsigned x signed bytes, so |a| is multiplied
+	// by b with the sign of a moved over, the pair sums stay below 2 * 127 * 127 and never saturate
+	inline static int32_t Dot(const int8_t* a, const int8_t* b, const size_t size)
+	{
+		size_t i = 0;
+		int32_t dot = 0;
+
+#if defined(__AVX2__)
+		__m256i sum = _mm256_setzero_si256();
+#if !defined(__AVXVNNI__)
+		const __m256i ones = _mm256_set1_epi16(1);
+#endif
+		for (; i + 32 <= size; i += 32)
+		{
+			const __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+			const __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+			const __m256i absA = _mm256_abs_epi8(va);
+			const __m256i signedB = _mm256_sign_epi8(vb, va);
+#if defined(__AVXVNNI__)
+			sum = _mm256_dpbusd_avx_epi32(sum, absA, signedB);
+#else
+			sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(absA, signedB), ones));
+#endif
+		}
+
+		const __m128i sum4 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		const __m128i sum2 = _mm_add_epi32(sum4, _mm_shuffle_epi32(sum4, _MM_SHUFFLE(1, 0, 3, 2)));
+		dot = _mm_cvtsi128_si32(_mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1))));
+#endif
+
+		for (; i < size; i++)
+			dot += a[i] * b[i];
+
+		return dot;
+	}
+};
\ No newline at end of file
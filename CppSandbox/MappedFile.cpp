@@ -0,0 +1,155 @@
+#include "MappedFile.h"
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	Reset();
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+{
+	Reset();
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+	if (this == &other)
+		return *this;
+
+	Close();
+
+	_data = other._data;
+	_size = other._size;
+#ifdef _WIN32
+	_fileHandle = other._fileHandle;
+	_mappingHandle = other._mappingHandle;
+#else
+	_fileDescriptor = other._fileDescriptor;
+#endif
+	other.Reset();
+
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& filepath)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(fileHandle);
+		return false;
+	}
+
+	HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr)
+	{
+		CloseHandle(fileHandle);
+		return false;
+	}
+
+	const void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr)
+	{
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		return false;
+	}
+
+	_fileHandle = fileHandle;
+	_mappingHandle = mappingHandle;
+	_data = (const unsigned char*)view;
+	_size = (size_t)fileSize.QuadPart;
+#else
+	const int fileDescriptor = open(filepath.c_str(), O_RDONLY);
+	if (fileDescriptor < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	void* view = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fileDescriptor, 0);
+	if (view == MAP_FAILED)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+
+	_fileDescriptor = fileDescriptor;
+	_data = (const unsigned char*)view;
+	_size = (size_t)fileStat.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (_data == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle((HANDLE)_mappingHandle);
+	CloseHandle((HANDLE)_fileHandle);
+#else
+	munmap((void*)_data, _size);
+	close(_fileDescriptor);
+#endif
+
+	Reset();
+}
+
+const unsigned char* MappedFile::GetData() const
+{
+	return _data;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return _size;
+}
+
+bool MappedFile::IsOpen() const
+{
+	return _data != nullptr;
+}
+
+void MappedFile::Reset()
+{
+	_data = nullptr;
+	_size = 0;
+#ifdef _WIN32
+	_fileHandle = nullptr;
+	_mappingHandle = nullptr;
+#else
+	_fileDescriptor = -1;
+#endif
+}
\ No newline at end of file
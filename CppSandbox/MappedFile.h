@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file, the view stays valid until Close() or destruction.
+class MappedFile
+{
+private:
+	const unsigned char* _data;
+	size_t _size;
+#ifdef _WIN32
+	void* _fileHandle;
+	void* _mappingHandle;
+#else
+	int _fileDescriptor;
+#endif
+
+public:
+	MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other);
+	MappedFile& operator=(MappedFile&& other);
+	~MappedFile();
+
+	bool Open(const std::string& filepath);
+	void Close();
+	const unsigned char* GetData() const;
+	size_t GetSize() const;
+	bool IsOpen() const;
+
+private:
+	void Reset();
+};
\ No newline at end of file
@@ -0,0 +1,369 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <limits>
+
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+void LatencyHistogram::Record(const int64_t nanoseconds, const int threadIndex)
+{
+	Shard& shard = _shards[threadIndex % ShardCount];
+	shard.buckets[GetBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	shard.sumNanoseconds.fetch_add((uint64_t)std::max<int64_t>(nanoseconds, 0), std::memory_order_relaxed);
+}
+
+HistogramSnapshot LatencyHistogram::GetSnapshot(const std::string& name) const
+{
+	HistogramSnapshot snapshot;
+	snapshot.name = name;
+	snapshot.buckets.assign(BucketCount, 0);
+
+	// shards are read one by one while others may still record, so the total can be a few records off the buckets
+	uint64_t sumNanoseconds = 0;
+	for (const Shard& shard : _shards)
+	{
+		for (int i = 0; i < BucketCount; i++)
+			snapshot.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+		sumNanoseconds += shard.sumNanoseconds.load(std::memory_order_relaxed);
+	}
+
+	snapshot.count = 0;
+	for (const uint64_t bucket : snapshot.buckets)
+		snapshot.count += bucket;
+	snapshot.sumMicroseconds = sumNanoseconds / 1000.0;
+	snapshot.p50Microseconds = GetPercentile(snapshot.buckets, snapshot.count, 50);
+	snapshot.p95Microseconds = GetPercentile(snapshot.buckets, snapshot.count, 95);
+	snapshot.p99Microseconds = GetPercentile(snapshot.buckets, snapshot.count, 99);
+
+	return snapshot;
+}
+
+void LatencyHistogram::Reset()
+{
+	for (Shard& shard : _shards)
+	{
+		for (std::atomic<uint64_t>& bucket : shard.buckets)
+			bucket.store(0, std::memory_order_relaxed);
+		shard.sumNanoseconds.store(0, std::memory_order_relaxed);
+	}
+}
+
+double LatencyHistogram::GetBucketUpperBound(const int bucket)
+{
+	if (bucket >= BucketCount - 1)
+		return std::numeric_limits<double>::infinity();
+
+	return (double)(1ull << bucket);
+}
+
+int LatencyHistogram::GetBucket(const int64_t nanoseconds)
+{
+	uint64_t microseconds = nanoseconds > 0 ? nanoseconds / 1000 : 0;
+
+	int bucket = 0;
+	while (microseconds > 0 && bucket < BucketCount - 1)
+	{
+		microseconds >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+double LatencyHistogram::GetPercentile(const std::vector<uint64_t>& buckets, const uint64_t count, const double percentile)
+{
+	if (count == 0)
+		return 0;
+
+	const double rank = percentile / 100 * count;
+	uint64_t cumulativeCount = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		if (buckets[i] == 0 || cumulativeCount + buckets[i] < rank)
+		{
+			cumulativeCount += buckets[i];
+			continue;
+		}
+
+		const double lowerBound = i == 0 ? 0 : (double)(1ull << (i - 1));
+		const double upperBound = i == BucketCount - 1 ? lowerBound * 2 : GetBucketUpperBound(i);
+		const double fraction = (rank - cumulativeCount) / buckets[i];
+
+		return lowerBound + (upperBound - lowerBound) * fraction;
+	}
+
+	return (double)(1ull << (BucketCount - 1));
+}
+
+Metrics::Metrics()
+	: _enabled(true), _tracing(false), _traceWriters(0), _traceEventCount(0), _traceCapacity(0)
+{
+	for (std::atomic<uint64_t>& counter : _counters)
+		counter.store(0);
+	for (std::atomic<int64_t>& queueDepth : _queueDepths)
+		queueDepth.store(0);
+}
+
+Metrics& Metrics::Get()
+{
+	static Metrics metrics;
+
+	return metrics;
+}
+
+void Metrics::SetEnabled(const bool enabled)
+{
+	_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Metrics::IsEnabled() const
+{
+	return _enabled.load(std::memory_order_relaxed);
+}
+
+void Metrics::RecordStage(const MetricStage stage, const Clock::time_point& begin, const Clock::time_point& end)
+{
+	if (!IsEnabled())
+		return;
+
+	const int threadIndex = GetThreadIndex();
+	const int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+	_stages[(int)stage].Record(nanoseconds, threadIndex);
+
+	// frames span several worker threads, the trace only holds the calls made on one
+	if (_tracing.load(std::memory_order_relaxed) && stage != MetricStage::Frame)
+		AddTraceEvent(stage, threadIndex, begin, end);
+}
+
+void Metrics::AddCount(const MetricCounter counter, const uint64_t value)
+{
+	if (IsEnabled())
+		_counters[(int)counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void Metrics::SetQueueDepth(const int queue, const size_t depth)
+{
+	if (IsEnabled())
+		_queueDepths[queue].store((int64_t)depth, std::memory_order_relaxed);
+}
+
+MetricsSnapshot Metrics::GetSnapshot() const
+{
+	MetricsSnapshot snapshot;
+
+	for (int i = 0; i < StageCount; i++)
+		snapshot.stages.emplace_back(_stages[i].GetSnapshot(GetStageName((MetricStage)i)));
+
+	for (int i = 0; i < CounterCount; i++)
+		snapshot.counters.emplace_back(GetCounterName((MetricCounter)i), _counters[i].load(std::memory_order_relaxed));
+
+	for (int i = 0; i < QueueCount; i++)
+		snapshot.queueDepths.emplace_back(GetQueueName(i), _queueDepths[i].load(std::memory_order_relaxed));
+
+	return snapshot;
+}
+
+void Metrics::Reset()
+{
+	for (LatencyHistogram& stage : _stages)
+		stage.Reset();
+	for (std::atomic<uint64_t>& counter : _counters)
+		counter.store(0, std::memory_order_relaxed);
+}
+
+bool Metrics::StartTrace(const std::string& filepath, const size_t maxEventCount)
+{
+	std::lock_guard<std::mutex> lock(_traceMutex);
+	if (_tracing)
+	{
+		std::cout << "a trace is already being captured to " << _traceFilepath << std::endl;
+		return false;
+	}
+
+	// no writer touches the buffer while tracing is off
+	if (_traceCapacity != maxEventCount)
+	{
+		_traceEvents.reset(new TraceEvent[maxEventCount]);
+		_traceCapacity = maxEventCount;
+	}
+
+	for (size_t i = 0; i < _traceCapacity; i++)
+		_traceEvents[i].written.store(false, std::memory_order_relaxed);
+
+	_traceFilepath = filepath;
+	_traceEventCount = 0;
+	_traceBegin = Clock::now();
+	_tracing = true;
+
+	return true;
+}
+
+bool Metrics::StopTrace()
+{
+	std::lock_guard<std::mutex> lock(_traceMutex);
+	if (!_tracing)
+		return false;
+
+	// writers check the flag after announcing themselves, so once they are gone no event is being written
+	_tracing = false;
+	while (_traceWriters > 0)
+		std::this_thread::yield();
+
+	const size_t eventCount = std::min(_traceEventCount.load(), _traceCapacity);
+	if (_traceEventCount > _traceCapacity)
+		std::cout << "trace buffer full, " << _traceEventCount - _traceCapacity << " events were dropped" << std::endl;
+
+	return WriteTrace(eventCount);
+}
+
+std::string Metrics::ToPrometheusText(const MetricsSnapshot& snapshot)
+{
+	std::ostringstream stream;
+
+	stream << "# HELP omfr_stage_duration_seconds Duration of a single call of a pipeline stage." << std::endl;
+	stream << "# TYPE omfr_stage_duration_seconds histogram" << std::endl;
+	for (const HistogramSnapshot& stage : snapshot.stages)
+	{
+		uint64_t cumulativeCount = 0;
+		for (int i = 0; i < LatencyHistogram::BucketCount; i++)
+		{
+			cumulativeCount += stage.buckets[i];
+			stream << "omfr_stage_duration_seconds_bucket{stage=\"" << stage.name << "\",le=\"";
+			if (i == LatencyHistogram::BucketCount - 1)
+				stream << "+Inf";
+			else
+				stream << LatencyHistogram::GetBucketUpperBound(i) / 1e6;
+			stream << "\"} " << cumulativeCount << std::endl;
+		}
+		stream << "omfr_stage_duration_seconds_sum{stage=\"" << stage.name << "\"} " << stage.sumMicroseconds / 1e6 << std::endl;
+		stream << "omfr_stage_duration_seconds_count{stage=\"" << stage.name << "\"} " << stage.count << std::endl;
+	}
+
+	for (const auto& counter : snapshot.counters)
+	{
+		stream << "# TYPE omfr_" << counter.first << "_total counter" << std::endl;
+		stream << "omfr_" << counter.first << "_total " << counter.second << std::endl;
+	}
+
+	stream << "# HELP omfr_queue_depth Frames waiting in the input queue of a pipeline stage." << std::endl;
+	stream << "# TYPE omfr_queue_depth gauge" << std::endl;
+	for (const auto& queueDepth : snapshot.queueDepths)
+		stream << "omfr_queue_depth{queue=\"" << queueDepth.first << "\"} " << queueDepth.second << std::endl;
+
+	return stream.str();
+}
+
+std::string Metrics::ToJson(const MetricsSnapshot& snapshot)
+{
+	std::ostringstream stream;
+
+	stream << "{\"stages\": [";
+	for (size_t i = 0; i < snapshot.stages.size(); i++)
+	{
+		const HistogramSnapshot& stage = snapshot.stages[i];
+		stream << (i > 0 ? ", " : "") << "{\"name\": \"" << stage.name << "\", \"count\": " << stage.count
+			<< ", \"sumMicroseconds\": " << stage.sumMicroseconds << ", \"p50Microseconds\": " << stage.p50Microseconds
+			<< ", \"p95Microseconds\": " << stage.p95Microseconds << ", \"p99Microseconds\": " << stage.p99Microseconds
+			<< ", \"buckets\": [";
+		for (size_t j = 0; j < stage.buckets.size(); j++)
+			stream << (j > 0 ? ", " : "") << stage.buckets[j];
+		stream << "]}";
+	}
+
+	stream << "], \"counters\": {";
+	for (size_t i = 0; i < snapshot.counters.size(); i++)
+		stream << (i > 0 ? ", " : "") << "\"" << snapshot.counters[i].first << "\": " << snapshot.counters[i].second;
+
+	stream << "}, \"queueDepths\": {";
+	for (size_t i = 0; i < snapshot.queueDepths.size(); i++)
+		stream << (i > 0 ? ", " : "") << "\"" << snapshot.queueDepths[i].first << "\": " << snapshot.queueDepths[i].second;
+	stream << "}}";
+
+	return stream.str();
+}
+
+void Metrics::AddTraceEvent(const MetricStage stage, const int threadIndex, const Clock::time_point& begin,
+	const Clock::time_point& end)
+{
+	_traceWriters++;
+
+	if (_tracing)
+	{
+		const size_t slot = _traceEventCount.fetch_add(1, std::memory_order_relaxed);
+		if (slot < _traceCapacity)
+		{
+			TraceEvent& event = _traceEvents[slot];
+			event.stage = stage;
+			event.threadIndex = threadIndex;
+			event.beginNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - _traceBegin).count();
+			event.durationNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+			event.written.store(true, std::memory_order_release);
+		}
+	}
+
+	_traceWriters--;
+}
+
+// Chrome trace event format, one complete ("X") event per call with times in microseconds
+bool Metrics::WriteTrace(const size_t eventCount) const
+{
+	std::ofstream file(_traceFilepath);
+	if (!file.is_open())
+	{
+		std::cout << "failed to open " << _traceFilepath << " for writing" << std::endl;
+		return false;
+	}
+
+	file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+	bool first = true;
+	for (size_t i = 0; i < eventCount; i++)
+	{
+		const TraceEvent& event = _traceEvents[i];
+		if (!event.written.load(std::memory_order_acquire))
+			continue;
+
+		file << (first ? "" : ",\n") << "{\"name\": \"" << GetStageName(event.stage) << "\", \"cat\": \"omfr\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+			<< event.threadIndex << ", \"ts\": " << event.beginNanoseconds / 1000.0 << ", \"dur\": " << event.durationNanoseconds / 1000.0 << "}";
+		first = false;
+	}
+	file << std::endl << "]}" << std::endl;
+
+	return file.good();
+}
+
+int Metrics::GetThreadIndex()
+{
+	static std::atomic<int> nextThreadIndex(0);
+	thread_local const int threadIndex = nextThreadIndex++;
+
+	return threadIndex;
+}
+
+const char* Metrics::GetStageName(const MetricStage stage)
+{
+	static const char* const names[StageCount] = { "detection", "normalization", "indexing", "attributes", "matching", "frame" };
+
+	return names[(int)stage];
+}
+
+const char* Metrics::GetCounterName(const MetricCounter counter)
+{
+	static const char* const names[CounterCount] = { "frames_completed", "frames_dropped", "faces_detected", "faces_normalized",
+		"faces_indexed", "faces_analyzed", "gallery_searches", "faces_matched", "frames_failed" };
+
+	return names[(int)counter];
+}
+
+// the FacePipeline stages, whose input queues these are
+const char* Metrics::GetQueueName(const int queue)
+{
+	static const char* const names[QueueCount] = { "detection", "normalization", "indexing", "attributes", "matching" };
+
+	return names[queue];
+}
\ No newline at end of file
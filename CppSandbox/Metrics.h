@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// Timed stages. Frame is the latency of a pipeline frame from submission to its callback, the others are single calls.
+enum class MetricStage
+{
+	Detection = 0,
+	Normalization = 1,
+	Indexing = 2,
+	Attributes = 3,
+	Matching = 4,
+	Frame = 5
+};
+
+enum class MetricCounter
+{
+	FramesCompleted = 0,
+	FramesDropped = 1,
+	FacesDetected = 2,
+	FacesNormalized = 3,
+	FacesIndexed = 4,
+	FacesAnalyzed = 5,
+	GallerySearches = 6, // probes searched
+	FacesMatched = 7, // probes with at least one match above the threshold
+	FramesFailed = 8 // frames a FacePipeline stage threw on
+};
+
+struct HistogramSnapshot
+{
+	std::string name;
+	uint64_t count;
+	double sumMicroseconds;
+	double p50Microseconds;
+	double p95Microseconds;
+	double p99Microseconds;
+	std::vector<uint64_t> buckets;
+};
+
+struct MetricsSnapshot
+{
+	std::vector<HistogramSnapshot> stages;
+	std::vector<std::pair<std::string, uint64_t>> counters;
+	std::vector<std::pair<std::string, int64_t>> queueDepths; // FacePipeline stage inputs
+};
+
+// Latencies in power-of-two microsecond buckets: bucket 0 holds everything under 1 us, bucket i everything under 2^i us,
+// the last one everything above. Threads add to one of ShardCount copies picked by their thread index, so a record is
+// a few relaxed atomic adds on a cache line that is rarely shared; percentiles are interpolated within buckets.
+class LatencyHistogram
+{
+public:
+	static const int BucketCount = 28;
+	static const int ShardCount = 8;
+
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> buckets[BucketCount];
+		std::atomic<uint64_t> sumNanoseconds;
+	};
+
+	Shard _shards[ShardCount];
+
+public:
+	LatencyHistogram();
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	void Record(const int64_t nanoseconds, const int threadIndex);
+	HistogramSnapshot GetSnapshot(const std::string& name) const;
+	void Reset();
+
+	// +Inf for the last bucket
+	static double GetBucketUpperBound(const int bucket);
+
+private:
+	static int GetBucket(const int64_t nanoseconds);
+	static double GetPercentile(const std::vector<uint64_t>& buckets, const uint64_t count, const double percentile);
+};
+
+// Process-wide stage latencies, face counters and queue depths, recorded by the detector, normalizer, indexer, analyzer,
+// gallery searchers and FacePipeline. Recording never takes a lock: a stage costs two clock reads and a few relaxed atomic
+// adds, far below 1% of the millisecond stages it measures, so it stays on in production; SetEnabled(false) skips even that.
+// A Chrome trace (chrome://tracing, Perfetto) of every timed call can be captured between StartTrace() and StopTrace().
+class Metrics
+{
+public:
+	static const int StageCount = 6;
+	static const int CounterCount = 9;
+	static const int QueueCount = 5;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct TraceEvent
+	{
+		std::atomic<bool> written;
+		MetricStage stage;
+		int threadIndex;
+		int64_t beginNanoseconds;
+		int64_t durationNanoseconds;
+	};
+
+	std::atomic<bool> _enabled;
+	LatencyHistogram _stages[StageCount];
+	std::atomic<uint64_t> _counters[CounterCount];
+	std::atomic<int64_t> _queueDepths[QueueCount];
+
+	// trace events go into a preallocated buffer, writers only claim a slot; events past its end are dropped
+	std::mutex _traceMutex; // start and stop only
+	std::atomic<bool> _tracing;
+	std::atomic<int> _traceWriters;
+	std::atomic<size_t> _traceEventCount;
+	std::unique_ptr<TraceEvent[]> _traceEvents;
+	size_t _traceCapacity;
+	Clock::time_point _traceBegin;
+	std::string _traceFilepath;
+
+	Metrics();
+
+public:
+	Metrics(const Metrics&) = delete;
+	Metrics& operator=(const Metrics&) = delete;
+
+	static Metrics& Get();
+
+	void SetEnabled(const bool enabled);
+	bool IsEnabled() const;
+
+	void RecordStage(const MetricStage stage, const Clock::time_point& begin, const Clock::time_point& end);
+	void AddCount(const MetricCounter counter, const uint64_t value = 1);
+	void SetQueueDepth(const int queue, const size_t depth);
+
+	MetricsSnapshot GetSnapshot() const;
+	void Reset();
+
+	bool StartTrace(const std::string& filepath, const size_t maxEventCount = 1 << 20);
+	// writes the captured events to the file given to StartTrace
+	bool StopTrace();
+
+	static std::string ToPrometheusText(const MetricsSnapshot& snapshot);
+	static std::string ToJson(const MetricsSnapshot& snapshot);
+
+private:
+	void AddTraceEvent(const MetricStage stage, const int threadIndex, const Clock::time_point& begin, const Clock::time_point& end);
+	bool WriteTrace(const size_t eventCount) const;
+	static int GetThreadIndex();
+	static const char* GetStageName(const MetricStage stage);
+	static const char* GetCounterName(const MetricCounter counter);
+	static const char* GetQueueName(const int queue);
+};
+
+// times the enclosing scope as one call of a stage
+class StageTimer
+{
+private:
+	const MetricStage _stage;
+	const bool _enabled;
+	const std::chrono::steady_clock::time_point _begin;
+
+public:
+	StageTimer(const MetricStage stage)
+		: _stage(stage), _enabled(Metrics::Get().IsEnabled()),
+		_begin(_enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+	{
+	}
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+	~StageTimer()
+	{
+		if (_enabled)
+			Metrics::Get().RecordStage(_stage, _begin, std::chrono::steady_clock::now());
+	}
+};
\ No newline at end of file
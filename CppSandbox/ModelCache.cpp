@@ -0,0 +1,152 @@
+#include "ModelCache.h"
+#include "OrtUtils.h"
+#include "MappedFile.h"
+#include <thread>
+#include <mutex>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+	const uint64_t HashSeed = 0xcbf29ce484222325ull;
+	const uint64_t HashPrime = 0x100000001b3ull;
+
+	struct FileHash
+	{
+		fs::file_time_type writeTime;
+		uintmax_t size;
+		uint64_t hash;
+	};
+
+	// every session of a model asks for its key, the file is only hashed again when it changed
+	std::mutex fileHashesMutex;
+	std::map<std::string, FileHash> fileHashes;
+}
+
+std::string ModelCache::GetCachedModelFilepath(const std::string& modelFilepath, const InferenceOptions& options,
+	const std::vector<ExecutionProvider>& providers)
+{
+	if (options.optimizedModelFolder.empty())
+		return std::string();
+
+	uint64_t modelHash;
+	if (!HashFile(modelFilepath, &modelHash))
+		return std::string();
+
+	std::ostringstream filename;
+	filename << fs::path(modelFilepath).stem().string() << "." << std::hex << std::setw(16) << std::setfill('0')
+		<< Mix(modelHash, HashOptions(options, providers)) << ".onnx";
+
+	return (fs::path(options.optimizedModelFolder) / filename.str()).string();
+}
+
+std::string ModelCache::GetTemporaryFilepath(const std::string& cachedModelFilepath)
+{
+	// unique between the threads of this process and, through the clock, between processes
+	const uint64_t threadHash = std::hash<std::thread::id>()(std::this_thread::get_id());
+	const uint64_t time = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+
+	std::ostringstream filepath;
+	filepath << cachedModelFilepath << "." << std::hex << Mix(threadHash, time) << ".tmp";
+
+	return filepath.str();
+}
+
+bool ModelCache::Publish(const std::string& temporaryFilepath, const std::string& cachedModelFilepath)
+{
+	if (!fs::exists(temporaryFilepath))
+		return false;
+
+	// renaming over an existing file fails on Windows, the graph that is already there is just as good
+	if (std::rename(temporaryFilepath.c_str(), cachedModelFilepath.c_str()) == 0)
+		return true;
+
+	std::remove(temporaryFilepath.c_str());
+
+	return fs::exists(cachedModelFilepath);
+}
+
+void ModelCache::Remove(const std::string& cachedModelFilepath)
+{
+	std::remove(cachedModelFilepath.c_str());
+}
+
+// FNV-1a over 64-bit words, the models are hundreds of megabytes and hashed on every start
+bool ModelCache::HashFile(const std::string& filepath, uint64_t* hash)
+{
+	std::error_code error;
+	const fs::file_time_type writeTime = fs::last_write_time(filepath, error);
+	const uintmax_t fileSize = fs::file_size(filepath, error);
+	if (error)
+		return false;
+
+	{
+		std::lock_guard<std::mutex> lock(fileHashesMutex);
+		const auto cached = fileHashes.find(filepath);
+		if (cached != fileHashes.end() && cached->second.writeTime == writeTime && cached->second.size == fileSize)
+		{
+			*hash = cached->second.hash;
+			return true;
+		}
+	}
+
+	MappedFile file;
+	if (!file.Open(filepath))
+		return false;
+
+	const unsigned char* data = file.GetData();
+	const size_t size = file.GetSize();
+
+	uint64_t fileHash = Mix(HashSeed, size);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		fileHash = Mix(fileHash, word);
+	}
+	for (; i < size; i++)
+		fileHash = Mix(fileHash, data[i]);
+
+	*hash = fileHash;
+
+	std::lock_guard<std::mutex> lock(fileHashesMutex);
+	fileHashes[filepath] = FileHash{ writeTime, fileSize, fileHash };
+
+	return true;
+}
+
+uint64_t ModelCache::HashOptions(const InferenceOptions& options, const std::vector<ExecutionProvider>& providers)
+{
+	uint64_t hash = Mix(HashSeed, ORT_API_VERSION);
+	hash = Mix(hash, (uint64_t)options.optimizationLevel);
+	for (const ExecutionProvider provider : providers)
+		hash = Mix(hash, (uint64_t)provider + 1);
+
+	return Mix(hash, GetCpuFeatures());
+}
+
+// the CPU kernels and layout transformations picked at ORT_ENABLE_ALL depend on these, a graph optimized on an
+// AVX-512 machine must not be loaded on an AVX2 one
+uint64_t ModelCache::GetCpuFeatures()
+{
+	const int features[] = { CV_CPU_AVX2, CV_CPU_FMA3, CV_CPU_AVX_512F, CV_CPU_AVX_512BW, CV_CPU_AVX_512VNNI };
+
+	uint64_t mask = 0;
+	for (size_t i = 0; i < sizeof(features) / sizeof(features[0]); i++)
+	{
+		if (cv::checkHardwareSupport(features[i]))
+			mask |= 1ull << i;
+	}
+
+	return mask;
+}
+
+uint64_t ModelCache::Mix(const uint64_t hash, const uint64_t value)
+{
+	return (hash ^ value) * HashPrime;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct InferenceOptions;
+enum class ExecutionProvider;
+
+// Names and publishes the optimized graphs kept in InferenceOptions::optimizedModelFolder.
+// A cached graph is named after its model and a key hashed from the model file contents, the onnxruntime API version,
+// the optimization level, the providers the session was actually built with and the vector extensions of the CPU,
+// so a changed model, runtime, configuration, provider fallback or machine never picks up a stale graph. Graphs are written to a temporary file and renamed into place
+// once complete, so processes starting at the same time never load a partial file.
+class ModelCache
+{
+public:
+	// empty when caching is off or the model cannot be read; providers are the ones appended to the session, without the CPU
+	static std::string GetCachedModelFilepath(const std::string& modelFilepath, const InferenceOptions& options,
+		const std::vector<ExecutionProvider>& providers);
+	static std::string GetTemporaryFilepath(const std::string& cachedModelFilepath);
+	// moves a completely written graph into place, a graph published by another process in the meantime is kept
+	static bool Publish(const std::string& temporaryFilepath, const std::string& cachedModelFilepath);
+	static void Remove(const std::string& cachedModelFilepath);
+
+private:
+	static bool HashFile(const std::string& filepath, uint64_t* hash);
+	static uint64_t HashOptions(const InferenceOptions& options, const std::vector<ExecutionProvider>& providers);
+	static uint64_t GetCpuFeatures();
+	static uint64_t Mix(const uint64_t hash, const uint64_t value);
+};
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "NonMaxSuppressor.h"
+#include <numeric>
+#include <immintrin.h>
+
+NonMaxSuppressor::NonMaxSuppressor(const NmsMethod method, const int gridCandidateCount, const float softSigma,
+	const float softMinScore)
+	:_method(method), _gridCandidateCount(gridCandidateCount), _softSigma(softSigma), _softMinScore(softMinScore)
+{
+}
+
+const std::vector<int>& NonMaxSuppressor::Apply(const std::vector<cv::Rect2f>& boxes, const std::vector<float>& scores,
+	const float overlapThreshold)
+{
+	_keptIndexes.clear();
+	_keptScores.clear();
+
+	if (boxes.empty())
+		return _keptIndexes;
+
+	SortByScore(boxes, scores);
+
+	const bool useGrid = _method == NmsMethod::Grid || (_method == NmsMethod::Auto && (int)boxes.size() > _gridCandidateCount);
+
+	if (_method == NmsMethod::SoftGaussian)
+		ApplySoft(scores);
+	else if (useGrid)
+		ApplyGrid(overlapThreshold);
+	else
+		ApplyBitmask(overlapThreshold);
+
+	if (_method != NmsMethod::SoftGaussian)
+	{
+		for (const int index : _keptIndexes)
+			_keptScores.emplace_back(scores[index]);
+	}
+
+	return _keptIndexes;
+}
+
+const std::vector<float>& NonMaxSuppressor::GetKeptScores() const
+{
+	return _keptScores;
+}
+
+void NonMaxSuppressor::SortByScore(const std::vector<cv::Rect2f>& boxes, const std::vector<float>& scores)
+{
+	const int count = (int)boxes.size();
+
+	_order.resize(count);
+	std::iota(_order.begin(), _order.end(), 0);
+	std::sort(_order.begin(), _order.end(), [&scores](int i1, int i2) {return scores[i1] > scores[i2]; });
+
+	// structure-of-arrays copy padded to a multiple of 8 with boxes that never overlap anything
+	const int paddedCount = (count + 7) / 8 * 8;
+	const float farAway = -1e30f;
+	_x1.assign(paddedCount, farAway);
+	_y1.assign(paddedCount, farAway);
+	_x2.assign(paddedCount, farAway);
+	_y2.assign(paddedCount, farAway);
+	_areas.assign(paddedCount, 0);
+
+	for (int i = 0; i < count; i++)
+	{
+		const cv::Rect2f& box = boxes[_order[i]];
+		_x1[i] = box.x;
+		_y1[i] = box.y;
+		_x2[i] = box.x + box.width;
+		_y2[i] = box.y + box.height;
+		_areas[i] = (box.width + 1) * (box.height + 1);
+	}
+}
+
+// suppression matrix: bit j of row i is set when box j overlaps box i, the greedy pass then only ORs rows
+void NonMaxSuppressor::ApplyBitmask(const float overlapThreshold)
+{
+	const int count = (int)_order.size();
+	const int wordCount = (count + 63) / 64;
+
+	_suppressionMatrix.assign((size_t)count * wordCount, 0);
+	_removed.assign(wordCount, 0);
+
+	for (int i = 0; i < count; i++)
+		FillSuppressionRow(i, wordCount, overlapThreshold);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (_removed[i / 64] & (1ull << (i % 64)))
+			continue;
+
+		_keptIndexes.emplace_back(_order[i]);
+
+		const uint64_t* row = _suppressionMatrix.data() + (size_t)i * wordCount;
+		for (int w = i / 64; w < wordCount; w++)
+			_removed[w] |= row[w];
+	}
+}
+
+void NonMaxSuppressor::FillSuppressionRow(const int row, const int wordCount, const float overlapThreshold)
+{
+	const int count = (int)_order.size();
+	uchar* rowBytes = (uchar*)(_suppressionMatrix.data() + (size_t)row * wordCount);
+
+	// blocks start 8-aligned, bits at or before the row itself are never read by the greedy pass
+	int j = (row + 1) / 8 * 8;
+
+#if defined(__AVX2__)
+	const __m256 x1 = _mm256_set1_ps(_x1[row]);
+	const __m256 y1 = _mm256_set1_ps(_y1[row]);
+	const __m256 x2 = _mm256_set1_ps(_x2[row]);
+	const __m256 y2 = _mm256_set1_ps(_y2[row]);
+	const __m256 area = _mm256_set1_ps(_areas[row]);
+	const __m256 threshold = _mm256_set1_ps(overlapThreshold);
+	const __m256 one = _mm256_set1_ps(1);
+	const __m256 zero = _mm256_setzero_ps();
+
+	for (; j < count; j += 8)
+	{
+		const __m256 xx1 = _mm256_max_ps(x1, _mm256_loadu_ps(_x1.data() + j));
+		const __m256 yy1 = _mm256_max_ps(y1, _mm256_loadu_ps(_y1.data() + j));
+		const __m256 xx2 = _mm256_min_ps(x2, _mm256_loadu_ps(_x2.data() + j));
+		const __m256 yy2 = _mm256_min_ps(y2, _mm256_loadu_ps(_y2.data() + j));
+
+		const __m256 w = _mm256_max_ps(zero, _mm256_add_ps(_mm256_sub_ps(xx2, xx1), one));
+		const __m256 h = _mm256_max_ps(zero, _mm256_add_ps(_mm256_sub_ps(yy2, yy1), one));
+		const __m256 intersection = _mm256_mul_ps(w, h);
+		const __m256 unionArea = _mm256_sub_ps(_mm256_add_ps(area, _mm256_loadu_ps(_areas.data() + j)), intersection);
+
+		// intersection / union >= threshold without the division
+		const __m256 overlaps = _mm256_cmp_ps(intersection, _mm256_mul_ps(threshold, unionArea), _CMP_GE_OQ);
+		rowBytes[j / 8] = (uchar)_mm256_movemask_ps(overlaps);
+	}
+#endif
+
+	for (; j < count; j++)
+	{
+		if (GetOverlap(row, j) >= overlapThreshold)
+			rowBytes[j / 8] |= (uchar)(1 << (j % 8));
+	}
+}
+
+// boxes are bucketed into every grid cell they cover, each kept box only visits its own cells
+void NonMaxSuppressor::ApplyGrid(const float overlapThreshold)
+{
+	const int count = (int)_order.size();
+	const int maxCellsPerAxis = 64;
+
+	float minX = _x1[0];
+	float minY = _y1[0];
+	float maxX = _x2[0];
+	float maxY = _y2[0];
+	float sumSize = 0;
+	for (int i = 0; i < count; i++)
+	{
+		minX = std::min(minX, _x1[i]);
+		minY = std::min(minY, _y1[i]);
+		maxX = std::max(maxX, _x2[i]);
+		maxY = std::max(maxY, _y2[i]);
+		sumSize += std::max(_x2[i] - _x1[i], _y2[i] - _y1[i]);
+	}
+
+	const float meanSize = std::max(sumSize / count, 1.0f);
+	const int columns = std::max(1, std::min(maxCellsPerAxis, (int)std::ceil((maxX - minX) / meanSize)));
+	const int rows = std::max(1, std::min(maxCellsPerAxis, (int)std::ceil((maxY - minY) / meanSize)));
+	const float cellWidth = std::max((maxX - minX) / columns, 1.0f);
+	const float cellHeight = std::max((maxY - minY) / rows, 1.0f);
+
+	// the far edge is extended by the inclusive pixel, boxes less than a pixel apart still overlap
+	auto getCellRange = [&](const int i, int* c1, int* r1, int* c2, int* r2)
+	{
+		*c1 = std::min(columns - 1, (int)((_x1[i] - minX) / cellWidth));
+		*r1 = std::min(rows - 1, (int)((_y1[i] - minY) / cellHeight));
+		*c2 = std::min(columns - 1, (int)((_x2[i] + 1 - minX) / cellWidth));
+		*r2 = std::min(rows - 1, (int)((_y2[i] + 1 - minY) / cellHeight));
+	};
+
+	// compressed cell lists: count, prefix sum, fill
+	_cellStarts.assign(columns * rows + 1, 0);
+	for (int i = 0; i < count; i++)
+	{
+		int c1, r1, c2, r2;
+		getCellRange(i, &c1, &r1, &c2, &r2);
+		for (int r = r1; r <= r2; r++)
+		{
+			for (int c = c1; c <= c2; c++)
+				_cellStarts[r * columns + c + 1]++;
+		}
+	}
+
+	std::partial_sum(_cellStarts.begin(), _cellStarts.end(), _cellStarts.begin());
+	_cellItems.resize(_cellStarts.back());
+
+	_cellOffsets.assign(_cellStarts.begin(), _cellStarts.end() - 1);
+	for (int i = 0; i < count; i++)
+	{
+		int c1, r1, c2, r2;
+		getCellRange(i, &c1, &r1, &c2, &r2);
+		for (int r = r1; r <= r2; r++)
+		{
+			for (int c = c1; c <= c2; c++)
+				_cellItems[_cellOffsets[r * columns + c]++] = i;
+		}
+	}
+
+	_suppressed.assign(count, 0);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (_suppressed[i])
+			continue;
+
+		_keptIndexes.emplace_back(_order[i]);
+
+		int c1, r1, c2, r2;
+		getCellRange(i, &c1, &r1, &c2, &r2);
+		for (int r = r1; r <= r2; r++)
+		{
+			for (int c = c1; c <= c2; c++)
+			{
+				const int cell = r * columns + c;
+				for (int k = _cellStarts[cell]; k < _cellStarts[cell + 1]; k++)
+				{
+					const int j = _cellItems[k];
+					if (j > i && !_suppressed[j] && GetOverlap(i, j) >= overlapThreshold)
+						_suppressed[j] = 1;
+				}
+			}
+		}
+	}
+}
+
+// gaussian soft-NMS: overlapping boxes are decayed instead of removed, boxes below the minimum score are dropped
+void NonMaxSuppressor::ApplySoft(const std::vector<float>& scores)
+{
+	const int count = (int)_order.size();
+
+	_softScores.resize(count);
+	for (int i = 0; i < count; i++)
+		_softScores[i] = scores[_order[i]];
+
+	_suppressed.assign(count, 0);
+
+	while (true)
+	{
+		int best = -1;
+		for (int j = 0; j < count; j++)
+		{
+			if (!_suppressed[j] && (best < 0 || _softScores[j] > _softScores[best]))
+				best = j;
+		}
+
+		if (best < 0 || _softScores[best] < _softMinScore)
+			break;
+
+		_suppressed[best] = 1;
+		_keptIndexes.emplace_back(_order[best]);
+		_keptScores.emplace_back(_softScores[best]);
+
+		for (int j = 0; j < count; j++)
+		{
+			if (_suppressed[j])
+				continue;
+
+			const float overlap = GetOverlap(best, j);
+			_softScores[j] *= std::exp(-(overlap * overlap) / _softSigma);
+			if (_softScores[j] < _softMinScore)
+				_suppressed[j] = 1;
+		}
+	}
+}
+
+float NonMaxSuppressor::GetOverlap(const int i, const int j) const
+{
+	const float xx1 = std::max(_x1[i], _x1[j]);
+	const float yy1 = std::max(_y1[i], _y1[j]);
+	const float xx2 = std::min(_x2[i], _x2[j]);
+	const float yy2 = std::min(_y2[i], _y2[j]);
+
+	const float w = std::max(0.0f, xx2 - xx1 + 1);
+	const float h = std::max(0.0f, yy2 - yy1 + 1);
+	const float intersectionArea = w * h;
+
+	return intersectionArea / (_areas[i] + _areas[j] - intersectionArea);
+}
+
+std::vector<int> NonMaxSuppressor::ApplyReference(const std::vector<cv::Rect2f>& facesSortedByScore, const float overlapTheshold)
+{
+	const size_t faceCount = facesSortedByScore.size();
+	std::vector<float> areas;
+	areas.reserve(faceCount);
+
+	for (int i = 0; i < faceCount; i++)
+	{
+		const cv::Rect2f& box = facesSortedByScore[i];
+		areas.emplace_back((box.width + 1) * (box.height + 1));
+	}
+
+	std::vector<int> order(faceCount);
+	std::iota(order.begin(), order.end(), 0); // [0 - faceCount-1]
+
+	std::vector<int> validBoxIndexes;
+	validBoxIndexes.reserve(faceCount);
+
+	while (order.size() > 0)
+	{
+		const int index = order[0];
+		validBoxIndexes.emplace_back(index);
+
+		const size_t remainingSize = order.size() - 1;
+
+		const cv::Rect2f& trueBox = facesSortedByScore[index];
+		const float trueBoxX2 = trueBox.x + trueBox.width;
+		const float trueBoxY2 = trueBox.y + trueBox.height;
+
+		std::vector<int> newOrder;
+		newOrder.reserve(remainingSize);
+
+		for (int i = 1; i < order.size(); i++)
+		{
+			const int currentIndex = order[i];
+			const cv::Rect2f& currentBox = facesSortedByScore[currentIndex];
+			const float currentBoxX2 = currentBox.x + currentBox.width;
+			const float currentBoxY2 = currentBox.y + currentBox.height;
+
+			const float xx1 = std::max(trueBox.x, currentBox.x);
+			const float yy1 = std::max(trueBox.y, currentBox.y);
+			const float xx2 = std::min(trueBoxX2, currentBoxX2);
+			const float yy2 = std::min(trueBoxY2, currentBoxY2);
+
+			const float w = std::max(0.0f, xx2 - xx1 + 1);
+			const float h = std::max(0.0f, yy2 - yy1 + 1);
+			const float intersectionArea = w * h;
+
+			const float overlap = intersectionArea / (areas[index] + areas[currentIndex] - intersectionArea);
+			if (overlap < overlapTheshold)
+				newOrder.emplace_back(currentIndex);
+		}
+
+		order = newOrder;
+	}
+
+	return validBoxIndexes;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "CvInclude.h"
+#include <cstdint>
+
+enum class NmsMethod
+{
+	Auto = 0, // bitmask for small candidate sets, grid above gridCandidateCount
+	Bitmask = 1,
+	Grid = 2,
+	SoftGaussian = 3
+};
+
+// Greedy non-maximum suppression over boxes in x, y, width, height form.
+// Boxes are processed in score order without copying the inputs, overlap uses the same
+// inclusive-pixel IoU as the original detector loop. Scratch buffers are reused between calls.
+class NonMaxSuppressor
+{
+private:
+	const NmsMethod _method;
+	const int _gridCandidateCount;
+	const float _softSigma;
+	const float _softMinScore;
+	std::vector<int> _order;
+	std::vector<float> _x1;
+	std::vector<float> _y1;
+	std::vector<float> _x2;
+	std::vector<float> _y2;
+	std::vector<float> _areas;
+	std::vector<uint64_t> _suppressionMatrix;
+	std::vector<uint64_t> _removed;
+	std::vector<int> _cellStarts;
+	std::vector<int> _cellOffsets;
+	std::vector<int> _cellItems;
+	std::vector<uchar> _suppressed;
+	std::vector<float> _softScores;
+	std::vector<int> _keptIndexes;
+	std::vector<float> _keptScores;
+
+public:
+	NonMaxSuppressor(const NmsMethod method = NmsMethod::Auto, const int gridCandidateCount = 4096,
+		const float softSigma = 0.5f, const float softMinScore = 0.001f);
+
+	// returns indexes into boxes/scores of the kept candidates, highest score first
+	const std::vector<int>& Apply(const std::vector<cv::Rect2f>& boxes, const std::vector<float>& scores, const float overlapThreshold);
+	// scores of the kept candidates, decayed when soft-NMS is used
+	const std::vector<float>& GetKeptScores() const;
+
+	// the original O(n^2) loop over boxes already sorted by score, kept as a baseline for validation and benchmarks
+	static std::vector<int> ApplyReference(const std::vector<cv::Rect2f>& facesSortedByScore, const float overlapTheshold);
+
+private:
+	void SortByScore(const std::vector<cv::Rect2f>& boxes, const std::vector<float>& scores);
+	void ApplyBitmask(const float overlapThreshold);
+	void ApplyGrid(const float overlapThreshold);
+	void ApplySoft(const std::vector<float>& scores);
+	void FillSuppressionRow(const int row, const int wordCount, const float overlapThreshold);
+	float GetOverlap(const int i, const int j) const;
+};
\ No newline at end of file
@@ -2,29 +2,234 @@
 
 #include <onnxruntime_cxx_api.h>
 #include "Utils.h"
+#include "ModelCache.h"
+#ifdef OMFR_USE_DNNL
+#include <dnnl_provider_factory.h>
+#endif
 
-inline Ort::Session CreateSession(Ort::Env& env, const std::string modelPath)
+// Execution providers in order of preference. The CPU provider always comes last and takes whatever the others
+// cannot run, and a session that fails to build with the preferred providers is built again on the CPU alone.
+// oneDNN and XNNPACK need an onnxruntime built with them: OMFR_USE_DNNL needs dnnl_provider_factory.h,
+// OMFR_USE_XNNPACK onnxruntime 1.14 or newer. Providers missing at runtime are skipped with a message.
+enum class ExecutionProvider
+{
+	Cpu = 0,
+	Cuda = 1,
+	Dnnl = 2,
+	Xnnpack = 3
+};
+
+// Threads of one session. intraOpThreadCount is the number of cores a single Run() may use, counting the calling thread;
+// interOpThreadCount above 1 also runs independent branches of the graph in parallel.
+// With the defaults every Run() stays on its calling thread, see InferencePool for sharing instances between threads.
+struct InferenceOptions
+{
+	std::vector<ExecutionProvider> providers = { ExecutionProvider::Cuda };
+	int cudaDeviceId = 0;
+	int intraOpThreadCount = 1;
+	int interOpThreadCount = 1;
+	// the arena keeps freed blocks for reuse, the memory pattern preallocates what the first Run() needed;
+	// both trade memory for fewer allocations with fixed input shapes
+	bool enableCpuMemArena = true;
+	bool enableMemPattern = true;
+	GraphOptimizationLevel optimizationLevel = GraphOptimizationLevel::ORT_ENABLE_ALL;
+	// when set, optimized graphs are cached in this folder (see ModelCache) and loaded from there on later starts,
+	// which skips the optimization; a graph is only valid for the providers and hardware it was optimized for
+	std::string optimizedModelFolder;
+};
+
+inline std::basic_string<ORTCHAR_T> GetOrtPath(const std::string& path)
+{
+#ifdef _WIN32
+	return Utils::StringToWstring(path, path.size());
+#else
+	return path;
+#endif
+}
+
+inline bool IsProviderAvailable(const std::string& providerName)
+{
+	const std::vector<std::string>& availableProviders = Ort::GetAvailableProviders();
+
+	return std::find(availableProviders.begin(), availableProviders.end(), providerName) != availableProviders.end();
+}
+
+// the requested providers this build and machine can offer, in order of preference and without the CPU
+inline std::vector<ExecutionProvider> GetUsableProviders(const InferenceOptions& options)
+{
+	std::vector<ExecutionProvider> providers;
+	for (const ExecutionProvider provider : options.providers)
+	{
+		switch (provider)
+		{
+		case ExecutionProvider::Cuda:
+			if (IsProviderAvailable("CUDAExecutionProvider"))
+				providers.emplace_back(provider);
+			else
+				std::cout << "CUDA execution provider is not available, skipping" << std::endl;
+			break;
+		case ExecutionProvider::Dnnl:
+#ifdef OMFR_USE_DNNL
+			providers.emplace_back(provider);
+#else
+			std::cout << "oneDNN execution provider is not built in, skipping" << std::endl;
+#endif
+			break;
+		case ExecutionProvider::Xnnpack:
+#ifdef OMFR_USE_XNNPACK
+			providers.emplace_back(provider);
+#else
+			std::cout << "XNNPACK execution provider is not built in, skipping" << std::endl;
+#endif
+			break;
+		default:
+			break;
+		}
+	}
+
+	return providers;
+}
+
+inline void AppendExecutionProviders(const InferenceOptions& options, const std::vector<ExecutionProvider>& providers,
+	Ort::SessionOptions& sessionOptions, std::vector<ExecutionProvider>* appendedProviders)
+{
+	for (const ExecutionProvider provider : providers)
+	{
+		try
+		{
+			switch (provider)
+			{
+			case ExecutionProvider::Cuda:
+			{
+				OrtCUDAProviderOptions cudaOptions;
+				cudaOptions.device_id = options.cudaDeviceId;
+				sessionOptions.AppendExecutionProvider_CUDA(cudaOptions);
+				break;
+			}
+#ifdef OMFR_USE_DNNL
+			case ExecutionProvider::Dnnl:
+				Ort::ThrowOnError(OrtSessionOptionsAppendExecutionProvider_Dnnl(sessionOptions, options.enableCpuMemArena ? 1 : 0));
+				break;
+#endif
+#ifdef OMFR_USE_XNNPACK
+			case ExecutionProvider::Xnnpack:
+				sessionOptions.AppendExecutionProvider("XNNPACK", { { "intra_op_num_threads", std::to_string(options.intraOpThreadCount) } });
+				break;
+#endif
+			default:
+				continue;
+			}
+
+			appendedProviders->emplace_back(provider);
+		}
+		catch (const Ort::Exception& exception)
+		{
+			std::cout << "failed to add an execution provider, skipping: " << exception.what() << std::endl;
+		}
+	}
+}
+
+// appendedProviders receives the providers the session really has, which is what an optimized graph depends on
+inline Ort::SessionOptions CreateSessionOptions(const InferenceOptions& options, const std::vector<ExecutionProvider>& providers,
+	const bool loadsOptimizedModel, const std::string& optimizedModelFilepath, std::vector<ExecutionProvider>* appendedProviders)
 {
 	Ort::SessionOptions sessionOptions;
-	sessionOptions.SetIntraOpNumThreads(1);
-	bool useCUDA = true;
-	if (useCUDA)
+	sessionOptions.SetIntraOpNumThreads(std::max(options.intraOpThreadCount, 1));
+	sessionOptions.SetInterOpNumThreads(std::max(options.interOpThreadCount, 1));
+	sessionOptions.SetExecutionMode(options.interOpThreadCount > 1 ? ExecutionMode::ORT_PARALLEL : ExecutionMode::ORT_SEQUENTIAL);
+
+	if (options.enableCpuMemArena)
+		sessionOptions.EnableCpuMemArena();
+	else
+		sessionOptions.DisableCpuMemArena();
+
+	if (options.enableMemPattern)
+		sessionOptions.EnableMemPattern();
+	else
+		sessionOptions.DisableMemPattern();
+
+	appendedProviders->clear();
+	AppendExecutionProviders(options, providers, sessionOptions, appendedProviders);
+
+	// an optimized model is loaded as it is, otherwise it is optimized and saved if a file is given
+	if (loadsOptimizedModel)
+		sessionOptions.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+	else
+	{
+		sessionOptions.SetGraphOptimizationLevel(options.optimizationLevel);
+		if (!optimizedModelFilepath.empty())
+			sessionOptions.SetOptimizedModelFilePath(GetOrtPath(optimizedModelFilepath).c_str());
+	}
+
+	return sessionOptions;
+}
+
+// builds the session with the given providers, or on the CPU alone if that fails
+inline Ort::Session CreateSessionWithFallback(Ort::Env& env, const std::string& modelPath, const InferenceOptions& options,
+	const std::vector<ExecutionProvider>& providers, const std::string& optimizedModelFilepath,
+	std::vector<ExecutionProvider>* appendedProviders)
+{
+	if (!providers.empty())
+	{
+		try
+		{
+			return Ort::Session(env, GetOrtPath(modelPath).c_str(), CreateSessionOptions(options, providers, false,
+				optimizedModelFilepath, appendedProviders));
+		}
+		catch (const Ort::Exception& exception)
+		{
+			std::cout << "failed to create a session for " << modelPath << " with the requested providers, falling back to CPU: "
+				<< exception.what() << std::endl;
+		}
+	}
+
+	return Ort::Session(env, GetOrtPath(modelPath).c_str(), CreateSessionOptions(options, std::vector<ExecutionProvider>(), false,
+		optimizedModelFilepath, appendedProviders));
+}
+
+// with an optimized model folder the optimized graph is taken from the model cache, or optimized once and added to it;
+// a cached graph is only loaded with the providers it was optimized for, a fallback to the CPU optimizes again
+inline Ort::Session CreateSession(Ort::Env& env, const std::string modelPath, const InferenceOptions& options = InferenceOptions())
+{
+	const std::vector<ExecutionProvider>& providers = GetUsableProviders(options);
+	std::vector<ExecutionProvider> appendedProviders;
+
+	const std::string& cachedModelFilepath = ModelCache::GetCachedModelFilepath(modelPath, options, providers);
+	if (cachedModelFilepath.empty())
+		return CreateSessionWithFallback(env, modelPath, options, providers, std::string(), &appendedProviders);
+
+	if (fs::exists(cachedModelFilepath))
 	{
-		OrtCUDAProviderOptions cuda_options;
-		cuda_options.device_id = 0;
-		sessionOptions.AppendExecutionProvider_CUDA(cuda_options);
+		try
+		{
+			Ort::SessionOptions sessionOptions = CreateSessionOptions(options, providers, true, std::string(), &appendedProviders);
+			if (appendedProviders == providers)
+				return Ort::Session(env, GetOrtPath(cachedModelFilepath).c_str(), sessionOptions);
+		}
+		catch (const Ort::Exception& exception)
+		{
+			std::cout << "cached model " << cachedModelFilepath << " cannot be loaded, optimizing " << modelPath << " again: "
+				<< exception.what() << std::endl;
+			ModelCache::Remove(cachedModelFilepath);
+		}
 	}
 
-	// Sets graph optimization level
-	// Available levels are
-	// ORT_DISABLE_ALL -> To disable all optimizations
-	// ORT_ENABLE_BASIC -> To enable basic optimizations (Such as redundant node
-	// removals) ORT_ENABLE_EXTENDED -> To enable extended optimizations
-	// (Includes level 1 + more complex optimizations like node fusions)
-	// ORT_ENABLE_ALL -> To Enable All possible optimizations
-	sessionOptions.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+	fs::create_directories(options.optimizedModelFolder);
+	const std::string& temporaryFilepath = ModelCache::GetTemporaryFilepath(cachedModelFilepath);
 
-	std::wstring modelFilepathW = Utils::StringToWstring(modelPath, modelPath.size());
+	try
+	{
+		Ort::Session session = CreateSessionWithFallback(env, modelPath, options, providers, temporaryFilepath, &appendedProviders);
+
+		// after a fallback the graph is published under the key of the providers it was optimized for
+		ModelCache::Publish(temporaryFilepath, appendedProviders == providers ? cachedModelFilepath
+			: ModelCache::GetCachedModelFilepath(modelPath, options, appendedProviders));
 
-	return Ort::Session(env, modelFilepathW.c_str(), sessionOptions);
+		return session;
+	}
+	catch (const Ort::Exception&)
+	{
+		ModelCache::Remove(temporaryFilepath);
+		throw;
+	}
 }
\ No newline at end of file
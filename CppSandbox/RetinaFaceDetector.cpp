@@ -1,195 +1,269 @@
 #include "RetinaFaceDetector.h"
-#include "OrtUtils.h"
+#include "Utils.h"
+#include "Metrics.h"
 #include <numeric>
+#include <immintrin.h>
+
+RetinaFaceDetector::DetectorInput::DetectorInput(Ort::Env& env, const std::string& modelFilepath, const cv::Size& inputSize,
+	const int inputDepth, const int maxBatchSize, const std::vector<std::vector<int64_t>>& outputShapes,
+	const InferenceOptions& options)
+	:size(inputSize),
+	session(env, modelFilepath, { inputDepth, inputSize.height, inputSize.width }, maxBatchSize, outputShapes, options),
+	preprocessor(inputSize)
+{
+}
 
-RetinaFaceDetector::RetinaFaceDetector(Ort::Env& env, const std::string& modelFilepath)
-	:_session(CreateSession(env, modelFilepath))
+RetinaFaceDetector::RetinaFaceDetector(Ort::Env& env, const std::string& modelFilepath, const NmsMethod nmsMethod,
+	const int maxBatchSize, const std::vector<cv::Size>& inputSizes, const InferenceOptions& options)
+	:_maxBatchSize(std::max(maxBatchSize, 1)), _nms(nmsMethod)
 {
-	_inputSize = cv::Size(640, 640);
-	for (auto stride : _featStrideFpn)
+	int maxAnchorCount = 0;
+	for (const cv::Size& inputSize : inputSizes)
 	{
-		const int height = _inputSize.height / stride;
-		const int width = _inputSize.width / stride;
-		AnchorKey key = { height, width, stride };
-		Anchor anchor = CreateAnchor(key, _numAnchors);
-		_anchors[key] = anchor;
+		_inputs.emplace_back(new DetectorInput(env, modelFilepath, inputSize, _inputDepth, _maxBatchSize,
+			GetOutputShapes(inputSize), options));
+
+		for (auto stride : _featStrideFpn)
+		{
+			const int height = inputSize.height / stride;
+			const int width = inputSize.width / stride;
+			AnchorKey key = { width, height, stride };
+			if (_anchors.count(key) > 0)
+				continue;
+
+			Anchor anchor = CreateAnchor(key, _numAnchors);
+			maxAnchorCount = std::max(maxAnchorCount, (int)anchor.centersX.size());
+			_anchors[key] = anchor;
+		}
 	}
+
+	_positiveIndexes.resize(maxAnchorCount);
+	_scaleFactors.resize(_maxBatchSize);
 }
 
-std::vector<Face> RetinaFaceDetector::Detect(const cv::Mat& image, const float detectionThreshold, const float overlapThreshold)
+std::vector<Face> RetinaFaceDetector::Detect(const cv::Mat& image, const float detectionThreshold, const float overlapThreshold,
+	const int inputSizeIndex)
 {
+	const StageTimer timer(MetricStage::Detection);
+	DetectorInput& input = *_inputs[inputSizeIndex];
+
 	float scaleFactor;
-	const cv::Mat& preparedImage = PrepareImage(image, &scaleFactor); // 4-dim float
+	PrepareImage(input, image, 0, &scaleFactor); // written straight into the session input
 
-	const std::vector<std::vector<float>>& outputTensorValues = RunNet(preparedImage);
-	const FaceDetectionResult& result = GetResultFromTensorOutput(outputTensorValues, detectionThreshold, scaleFactor);
-	const std::vector<Face>& faces = ConvertOutput(result, overlapThreshold, image.size());
+	RunNet(input, 1);
+	GetResultFromTensorOutput(input, 0, detectionThreshold, scaleFactor, &_result);
+	const std::vector<Face>& faces = ConvertOutput(_result, overlapThreshold, image.size());
+	Metrics::Get().AddCount(MetricCounter::FacesDetected, faces.size());
 
 	return faces;
 }
 
-cv::Mat RetinaFaceDetector::PrepareImage(const cv::Mat& image, float* scaleFactor) const
+std::vector<std::vector<Face>> RetinaFaceDetector::Detect(const std::vector<cv::Mat>& images, const float detectionThreshold,
+	const float overlapThreshold, const int inputSizeIndex)
 {
-	const float im_ratio = (float)image.rows / image.cols;
-	const float model_ratio = (float)_inputSize.height / _inputSize.width;
+	const StageTimer timer(MetricStage::Detection);
+	const std::vector<std::vector<Face>>& faces = DetectImages(images.data(), (int)images.size(), detectionThreshold, overlapThreshold,
+		inputSizeIndex);
+	for (const std::vector<Face>& imageFaces : faces)
+		Metrics::Get().AddCount(MetricCounter::FacesDetected, imageFaces.size());
 
-	int newWidth = 0;
-	int newHeight = 0;
+	return faces;
+}
+
+std::vector<Face> RetinaFaceDetector::DetectInRegions(const cv::Mat& image, const std::vector<cv::Rect2f>& regions,
+	const float detectionThreshold, const float overlapThreshold, const int inputSizeIndex, const float regionScale)
+{
+	const StageTimer timer(MetricStage::Detection);
+	const std::vector<Face>& faces = DetectRegions(image, regions, detectionThreshold, overlapThreshold, inputSizeIndex, regionScale);
+	Metrics::Get().AddCount(MetricCounter::FacesDetected, faces.size());
 
-	if (im_ratio > model_ratio)
+	return faces;
+}
+
+std::vector<std::vector<Face>> RetinaFaceDetector::DetectImages(const cv::Mat* images, const int imageCount,
+	const float detectionThreshold, const float overlapThreshold, const int inputSizeIndex)
+{
+	DetectorInput& input = *_inputs[inputSizeIndex];
+
+	std::vector<std::vector<Face>> faces;
+	faces.reserve(imageCount);
+
+	for (int offset = 0; offset < imageCount; offset += _maxBatchSize)
 	{
-		newHeight = _inputSize.height;
-		newWidth = (int)(newHeight / im_ratio);
-		*scaleFactor = (float)newWidth / image.cols;
+		const int batchSize = std::min(_maxBatchSize, imageCount - offset);
+
+		for (int i = 0; i < batchSize; i++)
+			PrepareImage(input, images[offset + i], i, &_scaleFactors[i]);
+
+		RunNet(input, batchSize);
+
+		for (int i = 0; i < batchSize; i++)
+		{
+			GetResultFromTensorOutput(input, i, detectionThreshold, _scaleFactors[i], &_result);
+			faces.emplace_back(ConvertOutput(_result, overlapThreshold, images[offset + i].size()));
+		}
 	}
-	else
+
+	return faces;
+}
+
+std::vector<Face> RetinaFaceDetector::DetectRegions(const cv::Mat& image, const std::vector<cv::Rect2f>& regions,
+	const float detectionThreshold, const float overlapThreshold, const int inputSizeIndex, const float regionScale)
+{
+	const cv::Rect imageRect(0, 0, image.cols, image.rows);
+
+	_pixelRegions.clear();
+	_regionCrops.clear();
+	for (const cv::Rect2f& region : regions)
+	{
+		const float width = region.width * regionScale * image.cols;
+		const float height = region.height * regionScale * image.rows;
+		const float centerX = (region.x + region.width / 2) * image.cols;
+		const float centerY = (region.y + region.height / 2) * image.rows;
+		const cv::Rect pixelRegion = cv::Rect((int)(centerX - width / 2), (int)(centerY - height / 2), (int)width, (int)height) & imageRect;
+		if (pixelRegion.area() == 0)
+			continue;
+
+		_pixelRegions.emplace_back(pixelRegion);
+		_regionCrops.emplace_back(image(pixelRegion));
+	}
+
+	std::vector<std::vector<Face>> regionFaces = DetectImages(_regionCrops.data(), (int)_regionCrops.size(), detectionThreshold,
+		overlapThreshold, inputSizeIndex);
+	_regionCrops.clear(); // the crop headers would keep the frame alive until the next call
+
+	// back to image coordinates in place, landmarks are relative to the box and stay as they are
+	_regionCandidates.clear();
+	_regionBoxes.clear();
+	_regionScores.clear();
+	for (size_t i = 0; i < regionFaces.size(); i++)
+	{
+		const cv::Rect& pixelRegion = _pixelRegions[i];
+		for (Face& face : regionFaces[i])
+		{
+			face.box.x = (pixelRegion.x + face.box.x * pixelRegion.width) / image.cols;
+			face.box.y = (pixelRegion.y + face.box.y * pixelRegion.height) / image.rows;
+			face.box.width = face.box.width * pixelRegion.width / image.cols;
+			face.box.height = face.box.height * pixelRegion.height / image.rows;
+
+			_regionBoxes.emplace_back(face.box.x * image.cols, face.box.y * image.rows, face.box.width * image.cols,
+				face.box.height * image.rows);
+			_regionScores.emplace_back(face.score);
+			_regionCandidates.emplace_back(&face);
+		}
+	}
+
+	std::vector<Face> faces;
+	if (regionFaces.size() < 2)
 	{
-		newWidth = _inputSize.width;
-		newHeight = (int)(newWidth * im_ratio);
-		*scaleFactor = (float)newHeight / image.rows;
+		faces.reserve(_regionCandidates.size());
+		for (Face* candidate : _regionCandidates)
+			faces.emplace_back(std::move(*candidate));
+
+		return faces;
 	}
 
-	cv::Mat resizedImage;
-	cv::resize(image, resizedImage, cv::Size(newWidth, newHeight));
+	const std::vector<int>& keptIndexes = _nms.Apply(_regionBoxes, _regionScores, overlapThreshold);
 
-	cv::Mat paddedImage = cv::Mat(_inputSize, CV_8UC3);
-	cv::Rect roi(cv::Point(0, 0), resizedImage.size());
-	resizedImage.copyTo(paddedImage(roi));
+	faces.reserve(keptIndexes.size());
+	for (const int index : keptIndexes)
+		faces.emplace_back(std::move(*_regionCandidates[index]));
 
-	// HWC to CHW
-	const float inputStdNorm = 1 / 128.0f;
-	const float inputMean = 127.5f;
-	const cv::Scalar meanNorm(inputMean, inputMean, inputMean);
+	return faces;
+}
 
-	return cv::dnn::blobFromImage(paddedImage, inputStdNorm, _inputSize, meanNorm, true);
+int RetinaFaceDetector::GetMaxBatchSize() const
+{
+	return _maxBatchSize;
 }
 
-std::vector<std::vector<float>> RetinaFaceDetector::RunNet(const cv::Mat& floatImage)
+int RetinaFaceDetector::GetInputSizeCount() const
 {
-	Ort::AllocatorWithDefaultOptions allocator;
-
-	// prepare inputs
-	size_t numInputNodes = _session.GetInputCount();
-	const char* inputName = _session.GetInputName(0, allocator);
-	std::vector<const char*> inputNames{ inputName };
-	Ort::TypeInfo inputTypeInfo = _session.GetInputTypeInfo(0);
-	auto inputTensorInfo = inputTypeInfo.GetTensorTypeAndShapeInfo();
-	ONNXTensorElementDataType inputType = inputTensorInfo.GetElementType();
-	std::vector<int64_t> inputDims = { 1, _inputDepth, _inputSize.width, _inputSize.height };
-	size_t inputTensorSize = Utils::VectorProduct(inputDims);
-
-	Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtAllocatorType::OrtArenaAllocator, OrtMemType::OrtMemTypeDefault);
-	const auto dataPointer = (float*)(floatImage.data);
-
-	std::vector<Ort::Value> inputTensors;
-	inputTensors.emplace_back(Ort::Value::CreateTensor<float>(memoryInfo, dataPointer, inputTensorSize, inputDims.data(), inputDims.size()));
-
-	// prepare outputs
-	size_t numOutputNodes = _session.GetOutputCount();
-	std::vector<const char*> outputNames;
-	outputNames.reserve(numOutputNodes);
-	std::vector<std::vector<int64_t>> outputDims;
-	outputDims.reserve(numOutputNodes);
-	std::vector<std::vector<float>> outputTensorValues;
-	outputTensorValues.reserve(numOutputNodes);
-	std::vector<Ort::Value> outputTensors;
-	outputTensors.reserve(numOutputNodes);
-
-	for (int i = 0; i < numOutputNodes; i++)
-	{
-		const char* outputName = _session.GetOutputName(i, allocator);
-		outputNames.emplace_back(outputName);
+	return (int)_inputs.size();
+}
 
-		Ort::TypeInfo outputTypeInfo = _session.GetOutputTypeInfo(i);
-		auto outputTensorInfo = outputTypeInfo.GetTensorTypeAndShapeInfo();
-		outputDims.emplace_back(outputTensorInfo.GetShape());
+const cv::Size& RetinaFaceDetector::GetInputSize(const int inputSizeIndex) const
+{
+	return _inputs[inputSizeIndex]->size;
+}
+
+void RetinaFaceDetector::PrepareImage(DetectorInput& input, const cv::Mat& image, const int batchIndex, float* scaleFactor)
+{
+	input.preprocessor.Prepare(image, input.session.GetInputData(batchIndex), scaleFactor);
+}
 
-		size_t outputTensorSize = Utils::VectorProduct(outputDims[i]);
-		outputTensorValues.emplace_back(std::vector<float>(outputTensorSize)); // reserve space for output values
+std::vector<std::vector<int64_t>> RetinaFaceDetector::GetOutputShapes(const cv::Size& inputSize) const
+{
+	// scores, then boxes, then landmarks, one output per stride, anchors flattened into the first dimension
+	const int valueCounts[3] = { 1, 4, _lmPointCount * 2 };
 
-		outputTensors.emplace_back(Ort::Value::CreateTensor<float>(memoryInfo, outputTensorValues[i].data(),
-			outputTensorValues[i].size(), outputDims[i].data(), outputDims[i].size()));
+	std::vector<std::vector<int64_t>> outputShapes;
+	for (const int valueCount : valueCounts)
+	{
+		for (const int stride : _featStrideFpn)
+		{
+			const int anchorCount = (inputSize.height / stride) * (inputSize.width / stride) * _numAnchors;
+			outputShapes.push_back({ anchorCount, valueCount });
+		}
 	}
 
-	// inference
-	_session.Run(Ort::RunOptions{ nullptr }, inputNames.data(), inputTensors.data(), numInputNodes,
-		outputNames.data(), outputTensors.data(), numOutputNodes);
+	return outputShapes;
+}
 
-	return outputTensorValues;
+void RetinaFaceDetector::RunNet(DetectorInput& input, const int batchSize)
+{
+	input.session.Run(batchSize);
 }
 
-FaceDetectionResult RetinaFaceDetector::GetResultFromTensorOutput(const std::vector<std::vector<float>>& outputTensorValues,
-	const float threshold, const float scaleFactor) const
+void RetinaFaceDetector::GetResultFromTensorOutput(const DetectorInput& input, const int batchIndex, const float threshold,
+	const float scaleFactor, FaceDetectionResult* result)
 {
 	const int fmc = 3;
 	const bool useLandmarks = true;
-	const int numAnchors = 2;
 
-	FaceDetectionResult result;
+	result->Clear();
 
 	const int layerCount = sizeof(_featStrideFpn) / sizeof(int);
 	for (int i = 0; i < layerCount; i++)
 	{
 		// parse scores
-		const std::vector<float>& scores = outputTensorValues[i];
+		const float* scores = input.session.GetOutputData(i, batchIndex);
+		const int scoreCount = (int)input.session.GetSampleOutputSize(i);
 
-		std::vector<int> positiveIndexes;
-		positiveIndexes.reserve(scores.size());
-		for (int j = 0; j < scores.size(); j++)
-		{
-			if (scores[j] >= threshold)
-				positiveIndexes.emplace_back(j);
-		}
+		int* positiveIndexes = _positiveIndexes.data();
+		const int positiveIndexCount = FindPositiveIndexes(scores, scoreCount, threshold, positiveIndexes);
 
-		result.scores.reserve(scores.size());
-		for (int j = 0; j < positiveIndexes.size(); j++)
-			result.scores.emplace_back(scores[positiveIndexes[j]]);
+		for (int j = 0; j < positiveIndexCount; j++)
+			result->scores.emplace_back(scores[positiveIndexes[j]]);
 
 		// get anchor
 		const int stride = _featStrideFpn[i];
-		const int height = _inputSize.height / stride;
-		const int width = _inputSize.width / stride;
-		AnchorKey key = { height, width, stride };
-		Anchor anchor = _anchors.at(key);
+		const int height = input.size.height / stride;
+		const int width = input.size.width / stride;
+		AnchorKey key = { width, height, stride };
+		const Anchor& anchor = _anchors.at(key);
 
 		// parse boxes
-		const std::vector<float>& boxPredictions = outputTensorValues[i + fmc];
-		const std::vector<cv::Rect2f>& boxes = ConvertDistancesToGoodBoxes(anchor, boxPredictions, positiveIndexes, stride, scaleFactor);
-		result.boxes.insert(result.boxes.end(), boxes.begin(), boxes.end());
+		const float* boxPredictions = input.session.GetOutputData(i + fmc, batchIndex);
+		ConvertDistancesToGoodBoxes(anchor, boxPredictions, positiveIndexes, positiveIndexCount, stride, scaleFactor, &result->boxes);
 
 		if (useLandmarks)
 		{
 			// parse landmarks
-			const std::vector<float>& lmPredictions = outputTensorValues[i + fmc * 2];
-			const std::vector<Landmarks>& landmarks = ConvertDistancesToGoodLms(anchor, lmPredictions, positiveIndexes, stride, scaleFactor);
-			result.landmarks.insert(result.landmarks.end(), landmarks.begin(), landmarks.end());
+			const float* lmPredictions = input.session.GetOutputData(i + fmc * 2, batchIndex);
+			ConvertDistancesToGoodLms(anchor, lmPredictions, positiveIndexes, positiveIndexCount, stride, scaleFactor, &result->landmarks);
 		}
 	}
-
-	return result;
 }
 
 std::vector<Face> RetinaFaceDetector::ConvertOutput(const FaceDetectionResult& result, const float overlapThreshold,
-	const cv::Size& imageSize) const
+	const cv::Size& imageSize)
 {
 	const size_t faceCount = result.boxes.size();
 
-	std::vector<int> indexesSortedByScore = Utils::Argsort(result.scores);
-	std::reverse(indexesSortedByScore.begin(), indexesSortedByScore.end());
-
-	std::vector<cv::Rect2f> boxesSortedByScore;
-	boxesSortedByScore.reserve(faceCount);
-	for (int i = 0; i < faceCount; i++)
-		boxesSortedByScore.emplace_back(result.boxes[indexesSortedByScore[i]]);
-
-	const size_t lmsCount = result.landmarks.size();
-
-	std::vector<Landmarks> lmsSortedByScore;
-	lmsSortedByScore.reserve(lmsCount);
-	for (int i = 0; i < lmsCount; i++)
-		lmsSortedByScore.emplace_back(result.landmarks[indexesSortedByScore[i]]);
-
-	std::vector<int> validFacesIndexes = ApplyNms(boxesSortedByScore, overlapThreshold);
+	// kept candidates come back highest score first, as indexes into the unsorted result
+	const std::vector<int>& validFacesIndexes = _nms.Apply(result.boxes, result.scores, overlapThreshold);
+	const std::vector<float>& validFaceScores = _nms.GetKeptScores();
 
 	const size_t validFaceCount = validFacesIndexes.size();
 
@@ -203,162 +277,111 @@ std::vector<Face> RetinaFaceDetector::ConvertOutput(const FaceDetectionResult& r
 	{
 		const int index = validFacesIndexes[i];
 
-		const cv::Rect2f& absBox = boxesSortedByScore[index];
+		const cv::Rect2f& absBox = result.boxes[index];
 		cv::Rect2f relBox(absBox.x / width, absBox.y / height, absBox.width / width, absBox.height / height);
 		if (relBox.x + relBox.width > 1)
 			relBox.width = 1 - relBox.x;
 		if (relBox.y + relBox.height > 1)
 			relBox.height = 1 - relBox.y;
 
-		const int lmCount = index < lmsSortedByScore.size() ? lmsSortedByScore[index].size() : 0;
-		Landmarks relLandmarks;
-		relLandmarks.reserve(lmCount);
+		// built in place, the landmarks live inside the Face
+		validFaces.emplace_back();
+		Face& face = validFaces.back();
+		face.box = relBox;
+		face.score = validFaceScores[i];
+
+		const bool hasLandmarks = result.landmarks.size() == faceCount * _lmPointCount;
+		const int lmCount = hasLandmarks ? _lmPointCount : 0;
 		for (int j = 0; j < lmCount; j++)
 		{
-			const cv::Point2f& absPoint = lmsSortedByScore[index][j];
-			const cv::Point2f relPoint((absPoint.x - absBox.x) / absBox.width, (absPoint.y - absBox.y) / absBox.height);
-			relLandmarks.emplace_back(relPoint);
+			const cv::Point2f& absPoint = result.landmarks[index * _lmPointCount + j];
+			face.landmarks.emplace_back((absPoint.x - absBox.x) / absBox.width, (absPoint.y - absBox.y) / absBox.height);
 		}
-
-		Face face;
-		face.box = relBox;
-		face.score = result.scores[index];
-		face.landmarks = relLandmarks;
-
-		validFaces.emplace_back(face);
 	}
 
 	return validFaces;
 }
 
-std::vector<cv::Rect2f> RetinaFaceDetector::ConvertDistancesToGoodBoxes(const Anchor& anchorCenters,
-	const std::vector<float>& boxPredictions, const std::vector<int>& positiveIndexes, const int stride, const float scaleFactor) const
+int RetinaFaceDetector::FindPositiveIndexes(const float* scores, const int scoreCount, const float threshold,
+	int* positiveIndexes) const
 {
-	const int boxPointCount = 4;
-	const size_t positiveIndexCount = positiveIndexes.size();
-
-	std::vector<cv::Rect2f> boxes;
-	boxes.reserve(positiveIndexCount);
+	int positiveIndexCount = 0;
+	int j = 0;
 
-	for (int i = 0; i < positiveIndexCount; i++)
+#if defined(__AVX2__)
+	// most anchors are negative, so whole blocks of 8 are rejected with a single compare
+	const __m256 thresholds = _mm256_set1_ps(threshold);
+	for (; j + 8 <= scoreCount; j += 8)
 	{
-		const int index = positiveIndexes[i];
-
-		const int boxOffset = boxPointCount * index;
-		const std::vector<float>& currentAnchor = anchorCenters[index];
-
-		const float x1 = (currentAnchor[0] - boxPredictions[boxOffset + 0] * stride) / scaleFactor;
-		const float y1 = (currentAnchor[1] - boxPredictions[boxOffset + 1] * stride) / scaleFactor;
-		const float x2 = (currentAnchor[0] + boxPredictions[boxOffset + 2] * stride) / scaleFactor;
-		const float y2 = (currentAnchor[1] + boxPredictions[boxOffset + 3] * stride) / scaleFactor;
-
-		cv::Rect2f box;
-		box.x = x1;
-		box.y = y1;
-		box.width = x2 - x1;
-		box.height = y2 - y1;
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(scores + j), thresholds, _CMP_GE_OQ));
+		for (int bit = 0; mask != 0; bit++, mask >>= 1)
+		{
+			if (mask & 1)
+				positiveIndexes[positiveIndexCount++] = j + bit;
+		}
+	}
+#endif
 
-		boxes.emplace_back(box);
+	for (; j < scoreCount; j++)
+	{
+		if (scores[j] >= threshold)
+			positiveIndexes[positiveIndexCount++] = j;
 	}
 
-	return boxes;
+	return positiveIndexCount;
 }
 
-std::vector<Landmarks> RetinaFaceDetector::ConvertDistancesToGoodLms(const Anchor& anchorCenters,
-	const std::vector<float>& lmPredictions, const std::vector<int>& positiveIndexes, const int stride, const float scaleFactor) const
+void RetinaFaceDetector::ConvertDistancesToGoodBoxes(const Anchor& anchorCenters, const float* boxPredictions,
+	const int* positiveIndexes, const int positiveIndexCount, const int stride, const float scaleFactor,
+	std::vector<cv::Rect2f>* boxes) const
 {
-	const int lmPointCount = 5;
-	const size_t positiveIndexCount = positiveIndexes.size();
+	const int boxPointCount = 4;
+	const float* centersX = anchorCenters.centersX.data();
+	const float* centersY = anchorCenters.centersY.data();
 
-	std::vector<Landmarks> lms;
-	lms.reserve(positiveIndexCount);
+	// x1 = (cx - l * stride) / scale, y1 = (cy - t * stride) / scale, x2 = (cx + r * stride) / scale, y2 = (cy + b * stride) / scale
+	const __m128 signedStride = _mm_setr_ps(-(float)stride, -(float)stride, (float)stride, (float)stride);
+	const __m128 inverseScale = _mm_set1_ps(1 / scaleFactor);
 
 	for (int i = 0; i < positiveIndexCount; i++)
 	{
 		const int index = positiveIndexes[i];
 
-		const int lmsOffset = lmPointCount * index;
-		const std::vector<float>& currentAnchor = anchorCenters[index];
-
-		std::vector<cv::Point2f> lmSet;
-		lmSet.reserve(lmPointCount);
-
-		for (int j = 0; j < lmPointCount; j++)
-		{
-			const int lmsIndex = (lmsOffset + j) * 2;
-
-			const float x = (currentAnchor[0] + lmPredictions[lmsIndex + 0] * stride) / scaleFactor;
-			const float y = (currentAnchor[1] + lmPredictions[lmsIndex + 1] * stride) / scaleFactor;
+		const __m128 centers = _mm_setr_ps(centersX[index], centersY[index], centersX[index], centersY[index]);
+		const __m128 distances = _mm_loadu_ps(boxPredictions + boxPointCount * index);
+		const __m128 corners = _mm_mul_ps(_mm_add_ps(centers, _mm_mul_ps(distances, signedStride)), inverseScale);
 
-			lmSet.emplace_back(cv::Point2f(x, y));
-		}
+		float values[4];
+		_mm_storeu_ps(values, corners);
 
-		lms.emplace_back(lmSet);
+		boxes->emplace_back(values[0], values[1], values[2] - values[0], values[3] - values[1]);
 	}
-
-	return lms;
 }
 
-std::vector<int> RetinaFaceDetector::ApplyNms(const std::vector<cv::Rect2f>& facesSortedByScore, const float overlapTheshold) const
+void RetinaFaceDetector::ConvertDistancesToGoodLms(const Anchor& anchorCenters, const float* lmPredictions,
+	const int* positiveIndexes, const int positiveIndexCount, const int stride, const float scaleFactor,
+	std::vector<cv::Point2f>* lms) const
 {
-	const size_t faceCount = facesSortedByScore.size();
-	std::vector<float> areas;
-	areas.reserve(faceCount);
-
-	for (int i = 0; i < faceCount; i++)
-	{
-		const cv::Rect2f& box = facesSortedByScore[i];
-		areas.emplace_back((box.width + 1) * (box.height + 1));
-	}
-
-	std::vector<int> order(faceCount);
-	std::iota(order.begin(), order.end(), 0); // [0 - faceCount-1]
-
-	std::vector<int> validBoxIndexes;
-	validBoxIndexes.reserve(faceCount);
+	const float* centersX = anchorCenters.centersX.data();
+	const float* centersY = anchorCenters.centersY.data();
+	const float inverseScale = 1 / scaleFactor;
 
-	while (order.size() > 0)
+	for (int i = 0; i < positiveIndexCount; i++)
 	{
-		const int index = order[0];
-		validBoxIndexes.emplace_back(index);
-
-		const size_t remainingSize = order.size() - 1;
-
-		std::vector<float> overlaps;
-		overlaps.reserve(remainingSize);
-
-		const cv::Rect2f& trueBox = facesSortedByScore[index];
-		const float trueBoxX2 = trueBox.x + trueBox.width;
-		const float trueBoxY2 = trueBox.y + trueBox.height;
+		const int index = positiveIndexes[i];
 
-		std::vector<int> newOrder;
-		newOrder.reserve(remainingSize);
+		const float* predictions = lmPredictions + index * _lmPointCount * 2;
+		const float centerX = centersX[index];
+		const float centerY = centersY[index];
 
-		for (int i = 1; i < order.size(); i++)
+		for (int j = 0; j < _lmPointCount; j++)
 		{
-			const int currentIndex = order[i];
-			const cv::Rect2f& currentBox = facesSortedByScore[currentIndex];
-			const float currentBoxX2 = currentBox.x + currentBox.width;
-			const float currentBoxY2 = currentBox.y + currentBox.height;
-
-			const float xx1 = std::max(trueBox.x, currentBox.x);
-			const float yy1 = std::max(trueBox.y, currentBox.y);
-			const float xx2 = std::min(trueBoxX2, currentBoxX2);
-			const float yy2 = std::min(trueBoxY2, currentBoxY2);
-
-			const float w = std::max(0.0f, xx2 - xx1 + 1);
-			const float h = std::max(0.0f, yy2 - yy1 + 1);
-			const float intersectionArea = w * h;
-
-			const float overlap = intersectionArea / (areas[index] + areas[currentIndex] - intersectionArea);
-			if (overlap < overlapTheshold)
-				newOrder.emplace_back(currentIndex);
-		}
+			const float x = (centerX + predictions[j * 2 + 0] * stride) * inverseScale;
+			const float y = (centerY + predictions[j * 2 + 1] * stride) * inverseScale;
 
-		order = newOrder;
+			lms->emplace_back(x, y);
+		}
 	}
-
-	return validBoxIndexes;
 }
 
 Anchor RetinaFaceDetector::CreateAnchor(const AnchorKey& key, const int anchorCount)
@@ -367,7 +390,8 @@ Anchor RetinaFaceDetector::CreateAnchor(const AnchorKey& key, const int anchorCo
 
 	const int totalSize = key.width * key.height * anchorCount;
 
-	anchor.reserve(totalSize);
+	anchor.centersX.reserve(totalSize);
+	anchor.centersY.reserve(totalSize);
 
 	for (int j = 0; j < key.height; j++)
 	{
@@ -379,12 +403,8 @@ Anchor RetinaFaceDetector::CreateAnchor(const AnchorKey& key, const int anchorCo
 
 			for (int k = 0; k < anchorCount; k++)
 			{
-				std::vector<float> values;
-				values.reserve(2);
-				values.emplace_back(x);
-				values.emplace_back(y);
-
-				anchor.emplace_back(values);
+				anchor.centersX.emplace_back((float)x);
+				anchor.centersY.emplace_back((float)y);
 			}
 		}
 	}
@@ -1,32 +1,76 @@
 #pragma once
 
 #include "Structs.h"
-#include <onnxruntime_cxx_api.h>
+#include "InferenceSession.h"
+#include "ImagePreprocessor.h"
+#include "NonMaxSuppressor.h"
 
+// Detection cost scales with the input area, so besides the full input size the detector can run at reduced sizes
+// (e.g. 320x320 for cameras where faces are large) or only on regions around known faces.
+// Every input size has its own session and anchors, sizes are addressed by their index in the constructor list.
+// Detection reuses the instance's buffers, so an instance serves one thread at a time (see InferencePool).
 class RetinaFaceDetector
 {
 private:
-	Ort::Session _session;
-	cv::Size _inputSize;
+	struct DetectorInput
+	{
+		const cv::Size size;
+		InferenceSession session;
+		ImagePreprocessor preprocessor;
+
+		DetectorInput(Ort::Env& env, const std::string& modelFilepath, const cv::Size& inputSize, const int inputDepth,
+			const int maxBatchSize, const std::vector<std::vector<int64_t>>& outputShapes, const InferenceOptions& options);
+	};
+
 	const int _inputDepth = 3;
 	std::map<AnchorKey, Anchor> _anchors;
 	const int _featStrideFpn[3] = { 8, 16, 32 };
 	const int _numAnchors = 2;
+	const int _lmPointCount = 5;
+	const int _maxBatchSize;
+	std::vector<std::unique_ptr<DetectorInput>> _inputs;
+	NonMaxSuppressor _nms;
+	FaceDetectionResult _result;
+	std::vector<int> _positiveIndexes;
+	std::vector<float> _scaleFactors;
+	std::vector<cv::Rect> _pixelRegions;
+	std::vector<cv::Mat> _regionCrops;
+	std::vector<Face*> _regionCandidates;
+	std::vector<cv::Rect2f> _regionBoxes;
+	std::vector<float> _regionScores;
 
 public:
-	RetinaFaceDetector(Ort::Env& env, const std::string& modelFilepath);
-	std::vector<Face> Detect(const cv::Mat& image, const float detectionThreshold, const float overlapThreshold);
+	RetinaFaceDetector(Ort::Env& env, const std::string& modelFilepath, const NmsMethod nmsMethod = NmsMethod::Auto,
+		const int maxBatchSize = 1, const std::vector<cv::Size>& inputSizes = { cv::Size(640, 640) },
+		const InferenceOptions& options = InferenceOptions());
+	std::vector<Face> Detect(const cv::Mat& image, const float detectionThreshold, const float overlapThreshold,
+		const int inputSizeIndex = 0);
+	// runs up to maxBatchSize images per inference, faces are returned per image in input order
+	std::vector<std::vector<Face>> Detect(const std::vector<cv::Mat>& images, const float detectionThreshold,
+		const float overlapThreshold, const int inputSizeIndex = 0);
+	// detects only inside the given regions (relative to the image), each region enlarged by regionScale around its center;
+	// faces found in overlapping regions are merged
+	std::vector<Face> DetectInRegions(const cv::Mat& image, const std::vector<cv::Rect2f>& regions, const float detectionThreshold,
+		const float overlapThreshold, const int inputSizeIndex = 0, const float regionScale = 2.0f);
+	int GetMaxBatchSize() const;
+	int GetInputSizeCount() const;
+	const cv::Size& GetInputSize(const int inputSizeIndex) const;
 
 private:
+	std::vector<std::vector<Face>> DetectImages(const cv::Mat* images, const int imageCount, const float detectionThreshold,
+		const float overlapThreshold, const int inputSizeIndex);
+	std::vector<Face> DetectRegions(const cv::Mat& image, const std::vector<cv::Rect2f>& regions, const float detectionThreshold,
+		const float overlapThreshold, const int inputSizeIndex, const float regionScale);
 	Anchor CreateAnchor(const AnchorKey& key, const int anchorCount);
-	cv::Mat PrepareImage(const cv::Mat& image, float* scaleFactor) const;
-	std::vector<std::vector<float>> RunNet(const cv::Mat& floatImage);
-	FaceDetectionResult GetResultFromTensorOutput(const std::vector<std::vector<float>>& outputTensorValues, const float threshold,
-		const float scaleFactor) const;
-	std::vector<Face> ConvertOutput(const FaceDetectionResult& result, const float overlapThreshold, const cv::Size& imageSize) const;
-	std::vector<cv::Rect2f> ConvertDistancesToGoodBoxes(const Anchor& anchorCenters, const std::vector<float>& boxPredictions,
-		const std::vector<int>& positiveIndexes, const int stride, const float scaleFactor) const;
-	std::vector<Landmarks> ConvertDistancesToGoodLms(const Anchor& anchorCenters, const std::vector<float>& lmPredictions,
-		const std::vector<int>& positiveIndexes, const int stride, const float scaleFactor) const;
-	std::vector<int> ApplyNms(const std::vector<cv::Rect2f>& facesSortedByScore, const float overlapTheshold) const;
+	void PrepareImage(DetectorInput& input, const cv::Mat& image, const int batchIndex, float* scaleFactor);
+	std::vector<std::vector<int64_t>> GetOutputShapes(const cv::Size& inputSize) const;
+	void RunNet(DetectorInput& input, const int batchSize);
+	void GetResultFromTensorOutput(const DetectorInput& input, const int batchIndex, const float threshold, const float scaleFactor,
+		FaceDetectionResult* result);
+	std::vector<Face> ConvertOutput(const FaceDetectionResult& result, const float overlapThreshold, const cv::Size& imageSize);
+	int FindPositiveIndexes(const float* scores, const int scoreCount, const float threshold, int* positiveIndexes) const;
+	void ConvertDistancesToGoodBoxes(const Anchor& anchorCenters, const float* boxPredictions, const int* positiveIndexes,
+		const int positiveIndexCount, const int stride, const float scaleFactor, std::vector<cv::Rect2f>* boxes) const;
+	void ConvertDistancesToGoodLms(const Anchor& anchorCenters, const float* lmPredictions, const int* positiveIndexes,
+		const int positiveIndexCount, const int stride, const float scaleFactor, std::vector<cv::Point2f>* lms) const;
 };
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include "StreamIngestor.h"
+#include <algorithm>
+#include <cctype>
+
+StreamIngestor::StreamIngestor(Ort::Env& env, const FacePipelineConfig& pipelineConfig, const FaceGallery& gallery,
+	const std::vector<std::string>& sources, const FrameCallback& callback, const StreamIngestorConfig& config)
+	: _config(config), _callback(callback), _stopping(false),
+	_pipeline(env, GetPipelineConfig(pipelineConfig), gallery, [this](std::unique_ptr<PipelineFrame> frame) { OnFrameProcessed(std::move(frame)); })
+{
+	for (const std::string& source : sources)
+	{
+		std::unique_ptr<IngestStream> stream(new IngestStream());
+		stream->source = source;
+		stream->inFlightFrames = 0;
+		stream->decodedFrames = 0;
+		stream->submittedFrames = 0;
+		stream->skippedFrames = 0;
+		stream->completedFrames = 0;
+		stream->finished = false;
+
+		// a plain number is a local camera index
+		const bool isCameraIndex = !source.empty() && std::all_of(source.begin(), source.end(), ::isdigit);
+		const bool opened = isCameraIndex ? stream->capture.open(std::stoi(source)) : stream->capture.open(source);
+		if (!opened || !stream->capture.isOpened())
+		{
+			std::cout << "failed to open stream " << source << std::endl;
+			stream->finished = true;
+		}
+
+		_streams.emplace_back(std::move(stream));
+	}
+}
+
+StreamIngestor::~StreamIngestor()
+{
+	Stop();
+}
+
+bool StreamIngestor::Start()
+{
+	if (!_pipeline.Start())
+		return false;
+
+	for (int streamId = 0; streamId < _streams.size(); streamId++)
+	{
+		IngestStream& stream = *_streams[streamId];
+		if (!stream.finished && !stream.decoder.joinable())
+			stream.decoder = std::thread(&StreamIngestor::Decode, this, streamId);
+	}
+
+	return true;
+}
+
+void StreamIngestor::WaitForStreams()
+{
+	JoinDecoders();
+	_pipeline.Flush();
+}
+
+void StreamIngestor::Stop()
+{
+	_stopping = true;
+	JoinDecoders();
+	_pipeline.Stop();
+}
+
+std::vector<StreamStats> StreamIngestor::GetStreamStats() const
+{
+	std::vector<StreamStats> stats;
+	stats.reserve(_streams.size());
+
+	for (const auto& stream : _streams)
+		stats.push_back({ stream->source, stream->decodedFrames, stream->submittedFrames, stream->skippedFrames, stream->completedFrames, stream->finished });
+
+	return stats;
+}
+
+FacePipelineStats StreamIngestor::GetPipelineStats() const
+{
+	return _pipeline.GetStats();
+}
+
+// skipping happens at the input only, so the pipeline never blocks a decoder
+FacePipelineConfig StreamIngestor::GetPipelineConfig(const FacePipelineConfig& pipelineConfig)
+{
+	FacePipelineConfig config = pipelineConfig;
+	config.dropPolicy = FrameDropPolicy::DropNewest;
+
+	return config;
+}
+
+void StreamIngestor::Decode(const int streamId)
+{
+	IngestStream& stream = *_streams[streamId];
+
+	const double sourceFps = stream.capture.get(cv::CAP_PROP_FPS);
+	const bool pace = _config.paceToSourceFps && sourceFps > 0;
+	const auto framePeriod = std::chrono::microseconds(pace ? (long long)(1000000 / sourceFps) : 0);
+	auto nextFrameTime = std::chrono::steady_clock::now();
+
+	while (!_stopping)
+	{
+		cv::Mat image;
+		if (!stream.capture.read(image) || image.empty())
+			break;
+
+		stream.decodedFrames++;
+
+		if (pace)
+		{
+			std::this_thread::sleep_until(nextFrameTime);
+			nextFrameTime += framePeriod;
+
+			// a stalled source does not get to burst afterwards
+			const auto now = std::chrono::steady_clock::now();
+			if (nextFrameTime < now)
+				nextFrameTime = now;
+		}
+
+		if (stream.inFlightFrames >= _config.maxInFlightFramesPerStream)
+		{
+			stream.skippedFrames++;
+			continue;
+		}
+
+		stream.inFlightFrames++;
+		if (_pipeline.Submit(image, streamId))
+			stream.submittedFrames++;
+		else
+		{
+			stream.inFlightFrames--;
+			stream.skippedFrames++;
+		}
+	}
+
+	stream.capture.release();
+	stream.finished = true;
+}
+
+void StreamIngestor::OnFrameProcessed(std::unique_ptr<PipelineFrame> frame)
+{
+	IngestStream& stream = *_streams[frame->streamId];
+	stream.inFlightFrames--;
+	stream.completedFrames++;
+
+	_callback(std::move(frame));
+}
+
+void StreamIngestor::JoinDecoders()
+{
+	for (auto& stream : _streams)
+	{
+		if (stream->decoder.joinable())
+			stream->decoder.join();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "FacePipeline.h"
+
+struct StreamIngestorConfig
+{
+	int maxInFlightFramesPerStream = 2;
+	bool paceToSourceFps = true; // files are read like live cameras, at their own frame rate
+};
+
+struct StreamStats
+{
+	std::string source;
+	uint64_t decodedFrames;
+	uint64_t submittedFrames;
+	uint64_t skippedFrames;
+	uint64_t completedFrames;
+	bool finished;
+};
+
+// Decodes many video sources (files, URLs, camera indexes) on one thread each and feeds all of them into a single
+// FacePipeline, so every stream shares the same detector/indexer/analyzer sessions.
+// When the pipeline falls behind, streams skip frames instead of queueing them: a stream never has more than
+// maxInFlightFramesPerStream frames inside the pipeline and frames that do not fit into the pipeline input are skipped,
+// which keeps every stream close to real time and stops one busy camera from starving the others.
+class StreamIngestor
+{
+public:
+	typedef FacePipeline::FrameCallback FrameCallback;
+
+private:
+	struct IngestStream
+	{
+		std::string source;
+		cv::VideoCapture capture;
+		std::thread decoder;
+		std::atomic<int> inFlightFrames;
+		std::atomic<uint64_t> decodedFrames;
+		std::atomic<uint64_t> submittedFrames;
+		std::atomic<uint64_t> skippedFrames;
+		std::atomic<uint64_t> completedFrames;
+		std::atomic<bool> finished;
+	};
+
+	const StreamIngestorConfig _config;
+	const FrameCallback _callback;
+	std::vector<std::unique_ptr<IngestStream>> _streams;
+	std::atomic<bool> _stopping;
+	FacePipeline _pipeline;
+
+public:
+	// streams whose source cannot be opened are reported and stay finished, the callback is called from pipeline workers
+	StreamIngestor(Ort::Env& env, const FacePipelineConfig& pipelineConfig, const FaceGallery& gallery,
+		const std::vector<std::string>& sources, const FrameCallback& callback, const StreamIngestorConfig& config = StreamIngestorConfig());
+	StreamIngestor(const StreamIngestor&) = delete;
+	StreamIngestor& operator=(const StreamIngestor&) = delete;
+	~StreamIngestor();
+
+	// starts the pipeline, then one decoder per opened stream; false if the pipeline cannot create its models
+	bool Start();
+	// waits until all sources are exhausted and their frames processed
+	void WaitForStreams();
+	void Stop();
+
+	std::vector<StreamStats> GetStreamStats() const;
+	FacePipelineStats GetPipelineStats() const;
+
+private:
+	static FacePipelineConfig GetPipelineConfig(const FacePipelineConfig& pipelineConfig);
+	void Decode(const int streamId);
+	void OnFrameProcessed(std::unique_ptr<PipelineFrame> frame);
+	void JoinDecoders();
+};
\ No newline at end of file
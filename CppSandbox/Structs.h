@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <tuple>
 #include "CvInclude.h"
 
 enum Gender
@@ -10,15 +11,29 @@ enum Gender
 	Female = 2
 };
 
-typedef std::vector<std::vector<float>> Anchor;
 typedef std::vector<float> FaceIndex;
 typedef std::pair<Gender, int> GenderAgeAttributes;
 
+// anchor centers in structure-of-arrays layout, one entry per anchor
+struct Anchor
+{
+	std::vector<float> centersX;
+	std::vector<float> centersY;
+};
+
+// flat decoding buffers, landmarks hold a fixed number of points per face
 struct FaceDetectionResult
 {
 	std::vector<float> scores;
 	std::vector<cv::Rect2f> boxes;
-	std::vector<Landmarks> landmarks;
+	std::vector<cv::Point2f> landmarks;
+
+	void Clear()
+	{
+		scores.clear();
+		boxes.clear();
+		landmarks.clear();
+	}
 };
 
 struct Face
@@ -32,6 +47,7 @@ struct Face
 	float similarity;
 	Gender gender;
 	int age;
+	int trackId = -1; // set by FaceTracker
 };
 
 struct AnchorKey
@@ -43,5 +59,5 @@ struct AnchorKey
 
 inline bool operator<(const AnchorKey& l, const AnchorKey& r)
 {
-	return (l.width < r.width || (l.height == r.height && l.stride < r.stride));
+	return std::tie(l.width, l.height, l.stride) < std::tie(r.width, r.height, r.stride);
 }
\ No newline at end of file
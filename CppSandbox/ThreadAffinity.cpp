@@ -0,0 +1,38 @@
+#include "ThreadAffinity.h"
+#include <thread>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+int ThreadAffinity::GetCoreCount()
+{
+	const int coreCount = (int)std::thread::hardware_concurrency();
+
+	return coreCount > 0 ? coreCount : 1;
+}
+
+bool ThreadAffinity::PinCurrentThread(const int core)
+{
+	const int coreIndex = core % GetCoreCount();
+
+#ifdef _WIN32
+	// affinity masks address the cores of the current processor group only
+	const bool pinned = coreIndex < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << coreIndex) != 0;
+#else
+	cpu_set_t cores;
+	CPU_ZERO(&cores);
+	CPU_SET(coreIndex, &cores);
+	const bool pinned = pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores) == 0;
+#endif
+
+	if (!pinned)
+		std::cout << "failed to pin thread to core " << coreIndex << std::endl;
+
+	return pinned;
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+// Pins threads to logical cores. With one intra-op thread onnxruntime runs a model on the calling thread,
+// so pinning the callers keeps every inference on its own core and its caches warm.
+class ThreadAffinity
+{
+public:
+	static int GetCoreCount();
+	// returns false if the platform refused, the thread then keeps running wherever the scheduler puts it
+	static bool PinCurrentThread(const int core);
+};
\ No newline at end of file
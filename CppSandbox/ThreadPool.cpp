@@ -0,0 +1,130 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(const int threadCount)
+	: _task(nullptr), _taskCount(0), _nextTask(0), _unfinishedTasks(0), _busyWorkers(0), _generation(0), _stopping(false)
+{
+	const int hardwareThreadCount = std::max((int)std::thread::hardware_concurrency(), 1);
+	const int totalThreadCount = threadCount > 0 ? threadCount : hardwareThreadCount;
+
+	_threads.reserve(totalThreadCount - 1);
+	for (int i = 1; i < totalThreadCount; i++)
+		_threads.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_tasksAvailable.notify_all();
+
+	for (std::thread& thread : _threads)
+		thread.join();
+}
+
+int ThreadPool::GetThreadCount() const
+{
+	return (int)_threads.size() + 1;
+}
+
+void ThreadPool::Run(const int taskCount, const std::function<void(const int)>& task)
+{
+	if (taskCount <= 0)
+		return;
+
+	if (taskCount == 1 || _threads.empty())
+	{
+		for (int i = 0; i < taskCount; i++)
+			task(i);
+		return;
+	}
+
+	std::lock_guard<std::mutex> runLock(_runMutex);
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_task = &task;
+		_taskCount = taskCount;
+		_nextTask = 0;
+		_unfinishedTasks = taskCount;
+		_generation++;
+	}
+	_tasksAvailable.notify_all();
+
+	RunTasks(task, taskCount);
+
+	// workers that woke up late may still be reading the task counter, wait for them to leave as well
+	std::exception_ptr exception;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_tasksFinished.wait(lock, [this]() { return _unfinishedTasks == 0 && _busyWorkers == 0; });
+		_task = nullptr;
+		std::swap(exception, _exception);
+	}
+
+	if (exception)
+		std::rethrow_exception(exception);
+}
+
+void ThreadPool::WorkerLoop()
+{
+	uint64_t seenGeneration = 0;
+
+	while (true)
+	{
+		const std::function<void(const int)>* task = nullptr;
+		int taskCount = 0;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_tasksAvailable.wait(lock, [this, seenGeneration]() { return _stopping || _generation != seenGeneration; });
+			if (_stopping)
+				return;
+
+			seenGeneration = _generation;
+			// the loop may already be over if this worker was slow to wake up
+			if (_task == nullptr)
+				continue;
+
+			task = _task;
+			taskCount = _taskCount;
+			_busyWorkers++;
+		}
+
+		RunTasks(*task, taskCount);
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_busyWorkers--;
+		}
+		_tasksFinished.notify_all();
+	}
+}
+
+void ThreadPool::RunTasks(const std::function<void(const int)>& task, const int taskCount)
+{
+	while (true)
+	{
+		const int taskIndex = _nextTask.fetch_add(1);
+		if (taskIndex >= taskCount)
+			return;
+
+		try
+		{
+			task(taskIndex);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_exception)
+				_exception = std::current_exception();
+		}
+
+		if (_unfinishedTasks.fetch_sub(1) == 1)
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_tasksFinished.notify_all();
+		}
+	}
+}
\ No newline at end of file
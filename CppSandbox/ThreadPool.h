@@ -0,0 +1,47 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <cstdint>
+#include <exception>
+
+// Fixed set of worker threads for data-parallel loops.
+// Run() hands out task indexes from a shared counter, the calling thread takes tasks as well
+// and returns once all of them are finished. One pool serves one caller at a time: concurrent Run() calls
+// from other threads wait for the running one, and a task must not call Run() on its own pool.
+// A task that throws does not stop the others; Run() rethrows the first exception once all tasks are finished.
+class ThreadPool
+{
+private:
+	std::vector<std::thread> _threads;
+	std::mutex _runMutex; // held by the caller for the whole of Run()
+	std::mutex _mutex;
+	std::condition_variable _tasksAvailable;
+	std::condition_variable _tasksFinished;
+	const std::function<void(const int)>* _task;
+	int _taskCount;
+	std::atomic<int> _nextTask;
+	std::atomic<int> _unfinishedTasks;
+	int _busyWorkers;
+	uint64_t _generation;
+	std::exception_ptr _exception; // first exception thrown by a task of the current Run()
+	bool _stopping;
+
+public:
+	// threadCount includes the calling thread, 0 uses all hardware threads
+	ThreadPool(const int threadCount = 0);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+
+	int GetThreadCount() const;
+	void Run(const int taskCount, const std::function<void(const int)>& task);
+
+private:
+	void WorkerLoop();
+	void RunTasks(const std::function<void(const int)>& task, const int taskCount);
+};
\ No newline at end of file
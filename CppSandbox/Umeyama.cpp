@@ -1,124 +1,53 @@
 #include "Umeyama.h"
 
-cv::Mat Umeyama::GetSimilarTransform(const cv::Mat& src, const cv::Mat& dst) const
+cv::Matx23f Umeyama::GetSimilarTransform(const cv::Point2f* src, const cv::Point2f* dst, const int pointCount)
 {
-	const int num = src.rows;
-	const int dim = src.cols;
-
-	const cv::Mat& src_mean = MeanAxis0(src);
-	const cv::Mat& dst_mean = MeanAxis0(dst);
-	const cv::Mat& src_demean = ElementwiseMinus(src, src_mean);
-	const cv::Mat& dst_demean = ElementwiseMinus(dst, dst_mean);
-	const cv::Mat& A = (dst_demean.t() * src_demean) / static_cast<float>(num);
-	cv::Mat d(dim, 1, CV_32F);
-	d.setTo(1.0f);
-	if (cv::determinant(A) < 0)
-		d.at<float>(dim - 1, 0) = -1;
-
-	const cv::Mat& T = cv::Mat::eye(dim + 1, dim + 1, CV_32F);
-	cv::Mat U;
-	cv::Mat S;
-	cv::Mat V;
-	cv::SVD::compute(A, S, U, V);
-
-	const int rank = MatrixRank(A);
-	if (rank == dim - 1)
+	if (pointCount <= 0)
+		return cv::Matx23f(1, 0, 0, 0, 1, 0);
+
+	double srcMeanX = 0;
+	double srcMeanY = 0;
+	double dstMeanX = 0;
+	double dstMeanY = 0;
+	for (int i = 0; i < pointCount; i++)
 	{
-		if (cv::determinant(U) * cv::determinant(V) > 0)
-			T.rowRange(0, dim).colRange(0, dim) = U * V;
-		else
-		{
-			const int s = d.at<float>(dim - 1, 0) = -1;
-			d.at<float>(dim - 1, 0) = -1;
-
-			T.rowRange(0, dim).colRange(0, dim) = U * V;
-			const cv::Mat& diag_ = cv::Mat::diag(d);
-			const cv::Mat& twp = diag_ * V; //np.dot(np.diag(d), V.T)
-			const cv::Mat& B = cv::Mat::zeros(3, 3, CV_8UC1);
-			const cv::Mat& C = B.diag(0);
-			T.rowRange(0, dim).colRange(0, dim) = U * twp;
-			d.at<float>(dim - 1, 0) = s;
-		}
+		srcMeanX += src[i].x;
+		srcMeanY += src[i].y;
+		dstMeanX += dst[i].x;
+		dstMeanY += dst[i].y;
 	}
-	else if (rank != 0)
+	srcMeanX /= pointCount;
+	srcMeanY /= pointCount;
+	dstMeanX /= pointCount;
+	dstMeanY /= pointCount;
+
+	// with A = sum(dst * src^T) of the demeaned points, the rotation that maximizes trace(R^T A) is the angle of
+	// (A11 + A22, A21 - A12) and trace(S D) is its length, which Umeyama divides by the source variance for the scale;
+	// a reflection is never chosen, like the determinant correction of the SVD form
+	double dotSum = 0; // A11 + A22
+	double crossSum = 0; // A21 - A12
+	double srcVariance = 0;
+	for (int i = 0; i < pointCount; i++)
 	{
-		const cv::Mat& diag = cv::Mat::diag(d);
-		const cv::Mat& twp = diag * V.t(); //np.dot(np.diag(d), V.T)
-		const cv::Mat& res = U * twp; // U
-		T.rowRange(0, dim).colRange(0, dim) = -U.t() * twp;
+		const double srcX = src[i].x - srcMeanX;
+		const double srcY = src[i].y - srcMeanY;
+		const double dstX = dst[i].x - dstMeanX;
+		const double dstY = dst[i].y - dstMeanY;
+
+		dotSum += dstX * srcX + dstY * srcY;
+		crossSum += dstY * srcX - dstX * srcY;
+		srcVariance += srcX * srcX + srcY * srcY;
 	}
 
-	const cv::Mat& var = VarAxis0(src_demean);
-	const float val = cv::sum(var).val[0];
-	cv::Mat res;
-	cv::multiply(d, S, res);
-	const float scale = 1.0 / val * cv::sum(res).val[0];
-	T.rowRange(0, dim).colRange(0, dim) = -T.rowRange(0, dim).colRange(0, dim).t();
-	const cv::Mat& temp1 = T.rowRange(0, dim).colRange(0, dim); // T[:dim, :dim]
-	const cv::Mat& temp2 = src_mean.t(); //src_mean.T
-	const cv::Mat& temp3 = temp1 * temp2; // np.dot(T[:dim, :dim], src_mean.T)
-	const cv::Mat& temp4 = scale * temp3;
-	T.rowRange(0, dim).colRange(dim, dim + 1) = -(temp4 - dst_mean.t());
-	T.rowRange(0, dim).colRange(0, dim) *= scale;
-
-	return T;
-}
-
-const cv::Mat Umeyama::MeanAxis0(const cv::Mat& src) const
-{
-	const int num = src.rows;
-	const int dim = src.cols;
-
-	// x1 y1
-	// x2 y2
-
-	cv::Mat output(1, dim, CV_32F);
-	float* op = (float*)output.data;
+	if (srcVariance <= 0)
+		return cv::Matx23f(1, 0, 0, 0, 1, 0);
 
-	for (int i = 0; i < dim; i++)
-	{
-		float sum = 0;
-		for (int j = 0; j < num; j++)
-			sum += src.at<float>(j, i);
-
-		op[i] = sum / num;
-	}
+	// scale * cos(angle) and scale * sin(angle)
+	const double a = dotSum / srcVariance;
+	const double b = crossSum / srcVariance;
 
-	return output;
-}
-
-const cv::Mat Umeyama::ElementwiseMinus(const cv::Mat& m1, const cv::Mat& m2) const
-{
-	cv::Mat output(m1.rows, m1.cols, m1.type());
-
-	assert(m2.cols == m1.cols);
-	if (m2.cols == m1.cols)
-	{
-		for (int i = 0; i < m1.rows; i++)
-		{
-			for (int j = 0; j < m2.cols; j++)
-				output.at<float>(i, j) = m1.at<float>(i, j) - m1.at<float>(0, j);
-		}
-	}
-
-	return output;
-}
-
-const cv::Mat Umeyama::VarAxis0(const cv::Mat& src) const
-{
-	const cv::Mat& mat = ElementwiseMinus(src, MeanAxis0(src));
-	cv::multiply(mat, mat, mat);
-
-	return MeanAxis0(mat);
-}
-
-const int Umeyama::MatrixRank(const cv::Mat& m) const
-{
-	cv::Mat w;
-	cv::Mat u;
-	cv::Mat vt;
-	cv::SVD::compute(m, w, u, vt);
-	cv::Mat1b nonZeroSingularValues = w > 0.0001;
+	const double translationX = dstMeanX - (a * srcMeanX - b * srcMeanY);
+	const double translationY = dstMeanY - (b * srcMeanX + a * srcMeanY);
 
-	return countNonZero(nonZeroSingularValues);
+	return cv::Matx23f((float)a, (float)-b, (float)translationX, (float)b, (float)a, (float)translationY);
 }
\ No newline at end of file
@@ -2,14 +2,13 @@
 
 #include "CvInclude.h"
 
+// Least-squares similarity transform (rotation, uniform scale, translation) that maps the source points onto
+// the destination points, Umeyama's estimate as done by skimage.transform.SimilarityTransform.
+// In 2-D the SVD of the cross-covariance has a closed form: the best rotation and scale come straight from
+// two sums over the demeaned points, so an estimate is two passes over the points without any allocation.
 class Umeyama
 {
 public:
-	cv::Mat GetSimilarTransform(const cv::Mat& src, const cv::Mat& dst) const;
-
-private:
-	const cv::Mat MeanAxis0(const cv::Mat& src) const;
-	const cv::Mat ElementwiseMinus(const cv::Mat& m1, const cv::Mat& m2) const;
-	const cv::Mat VarAxis0(const cv::Mat& src) const;
-	const int MatrixRank(const cv::Mat& m) const;
+	// returns the identity when the source points all coincide
+	static cv::Matx23f GetSimilarTransform(const cv::Point2f* src, const cv::Point2f* dst, const int pointCount);
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <locale>
 #include <codecvt>
 #include <filesystem>
+#include "Structs.h"
 
 namespace fs = std::experimental::filesystem;
 
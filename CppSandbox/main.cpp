@@ -8,19 +8,33 @@
 #include "ArcFace50Indexer.h"
 #include "FaceComparer.h"
 #include "GenderAgeAnalyzer.h"
+#include "NonMaxSuppressor.h"
+#include "FaceGallery.h"
+#include "GallerySearcher.h"
+#include "HnswIndex.h"
+#include "StreamIngestor.h"
+#include "Metrics.h"
+#include "AtomicFile.h"
+#include <mutex>
+#include <future>
 
 namespace fs = std::experimental::filesystem;
 
 std::map<std::string, FaceIndex> ReadDataBaseFromFile(const std::string& databasePath, const int indexSize);
-void IndexFaces(ArcFace50Indexer& indexer, std::vector<Face>& faces, const std::vector<cv::Mat>& normalizedFaces,
-	const cv::Size& arcFaceTargetSize);
-void CompareFaces(const FaceComparer& comparer, std::vector<Face>& faces, const std::map<std::string, FaceIndex>& database,
-	const int indexSize, const float comparisonThreshold);
-void FillAttributes(GenderAgeAnalyzer& analyzer, std::vector<Face>& faces);
-void RetinaFacePerformanceTest(const cv::Mat& image, RetinaFaceDetector& detector, const float detectionThreshold,
-	const float overlapThreshold);
-void NormalizationPerformanceTest(const cv::Mat& image, const ArcFaceNormalizer& normalizer, const std::vector<Face>& faces);
-void IndexingPerformanceTest(ArcFace50Indexer& indexer, const std::vector<Face>& faces);
+FaceGallery LoadGallery(const std::string& galleryFilepath, const std::string& databasePath, const int indexSize);
+bool IsGalleryStale(const std::string& galleryFilepath, const std::string& databasePath);
+int BuildGallery(const std::string& databasePath, const std::string& galleryFilepath, const int indexSize, const EmbeddingType type);
+int AppendGallery(const std::string& galleryFilepath, const std::string& databasePath, const int indexSize);
+int BuildAnnIndex(const std::string& galleryFilepath, const std::string& annIndexFilepath);
+int ReportQuantizationAccuracy(const std::string& databasePath, const int indexSize);
+int ProcessStreams(Ort::Env& env, const FacePipelineConfig& pipelineConfig, const FaceGallery& gallery,
+	const std::vector<std::string>& sources, const std::string& metricsFilepath, const std::string& traceFilepath);
+void WriteMetrics(const std::string& metricsFilepath);
+void IndexFaces(ArcFace50Indexer& indexer, std::vector<Face>& faces, const std::vector<cv::Mat>& normalizedFaces);
+void CompareFaces(GallerySearcher& searcher, HnswIndex* annIndex, std::vector<Face>& faces, const FaceGallery& gallery,
+	const float comparisonThreshold);
+void FillAttributes(std::vector<Face>& faces, const std::vector<GenderAgeAttributes>& attributes);
+void QuantizationAccuracyReport(const std::vector<FaceIndex>& indexes, const std::vector<FaceIndex>& heldOutProbes, const int indexSize);
 void DrawFaces(const cv::Mat& image, const std::vector<Face>& faces,
 	const fs::path& imagePath, const std::string& imageFacesFolder);
 void SaveNormalizationResult(const std::vector<cv::Mat>& normalizedFaces, const fs::path& imagePath,
@@ -29,22 +43,26 @@ void SaveIndexingResult(const std::vector<Face>& faces, const std::string& image
 
 int main(int argc, char* argv[])
 {
-#ifdef NDEBUG
-	if (argc < 2)
+	const int indexSize = 512;
+
+	// gallery tools: --build-gallery <database folder> <gallery file> [fp16|int8], --append-gallery <gallery file> <database folder>,
+	// --build-ann <gallery file> <ANN index file>, --quantization-report <database folder>
+	if (argc >= 4 && std::string(argv[1]) == "--build-gallery")
 	{
-		std::cout << "image name not provided" << std::endl;
-		return -1;
+		const std::string& typeName = argc >= 5 ? argv[4] : "";
+		const EmbeddingType type = typeName == "fp16" ? EmbeddingType::Float16 : typeName == "int8" ? EmbeddingType::Int8 : EmbeddingType::Float32;
+		return BuildGallery(argv[2], argv[3], indexSize, type);
 	}
+	if (argc >= 3 && std::string(argv[1]) == "--quantization-report")
+		return ReportQuantizationAccuracy(argv[2], indexSize);
+	if (argc >= 4 && std::string(argv[1]) == "--append-gallery")
+		return AppendGallery(argv[2], argv[3], indexSize);
+	if (argc >= 4 && std::string(argv[1]) == "--build-ann")
+		return BuildAnnIndex(argv[2], argv[3]);
 
-	const std::string& imageFilepath = argv[1];
-	std::cout << "image name: " << imageFilepath << std::endl;
-	std::cout << std::endl;
-#else
-	std::string imageFilepath = "images/sh.jpg";
-#endif
-
-	const int indexSize = 512;
 	const std::string databasePath("database");
+	const std::string galleryFilepath("database.gallery");
+	const std::string annIndexFilepath("database.hnsw");
 	const std::string detectorModelFilepath("models/det_10g.onnx");
 	const std::string indexerModelFilepath("models/w600k_r50.onnx");
 	const std::string genderAgeModelFilepath("models/genderage.onnx");
@@ -52,190 +70,131 @@ int main(int argc, char* argv[])
 	const float detectionThreshold = 0.5f;
 	const float overlapThreshold = 0.4f;
 	const float comparisonThreshold = 0.3f;
+	const int maxIndexingBatchSize = 32;
+	const int maxAttributeBatchSize = 32;
 
-	const std::map<std::string, FaceIndex>& database = ReadDataBaseFromFile(databasePath, indexSize);
-
-	const cv::Mat& image = cv::imread(imageFilepath);
-
-	Ort::Env env(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "inference");
-
-	RetinaFaceDetector detector(env, detectorModelFilepath);
-	std::vector<Face> faces = detector.Detect(image, detectionThreshold, overlapThreshold);
-
-	ArcFaceNormalizer normalizer;
-	const std::vector<cv::Mat>& normalizedFaces = normalizer.GetNormalizedFaces(image, faces);
-
-	ArcFace50Indexer indexer(env, indexerModelFilepath);
-	IndexFaces(indexer, faces, normalizedFaces, arcFaceTargetSize);
-
-	GenderAgeAnalyzer genderAgeAnalyzer(env, genderAgeModelFilepath);
-	FillAttributes(genderAgeAnalyzer, faces);
-
-	FaceComparer comparer;
-	CompareFaces(comparer, faces, database, indexSize, comparisonThreshold);
-
-	const fs::path imagePath(imageFilepath);
-	const std::string& faceFolderName = "faces";
-	Utils::CreateDirectory(faceFolderName);
-	const std::string& imageFacesFolder = faceFolderName + "/" + imagePath.stem().string();
-	Utils::CreateDirectory(imageFacesFolder, true);
-
-	DrawFaces(image, faces, imagePath, imageFacesFolder);
-	SaveNormalizationResult(normalizedFaces, imagePath, imageFacesFolder);
-	SaveIndexingResult(faces, imageFacesFolder);
-
-	RetinaFacePerformanceTest(image, detector, detectionThreshold, overlapThreshold);
-	NormalizationPerformanceTest(image, normalizer, faces);
-	IndexingPerformanceTest(indexer, faces);
-}
-
-void RetinaFacePerformanceTest(const cv::Mat& image, RetinaFaceDetector& detector, const float detectionThreshold,
-	const float overlapThreshold)
-{
-	std::cout << "starting RetinaFace performance test..." << std::endl;
-
-	const int numTests = 100;
-	std::vector<int> runTimes;
-	runTimes.reserve(numTests);
-
-	auto lastUpdated = std::chrono::steady_clock::now();
-	int testsRun = 0;
-	const int emulatedFps = 30;
-	const float msBetweenFrames = 1000 / emulatedFps;
+	// sessions prefer CUDA and fall back to the CPU, optimized graphs are kept next to the models
+	InferenceOptions inferenceOptions;
+	inferenceOptions.optimizedModelFolder = "models/optimized";
 
-	std::vector<Face> faces;
-	faces.reserve(500);
+	const FaceGallery& gallery = LoadGallery(galleryFilepath, databasePath, indexSize);
 
-	while (testsRun < numTests)
+	// the ANN index is optional, it is only used while it covers the whole gallery
+	HnswIndex annIndex(indexSize);
+	bool useAnnIndex = fs::exists(annIndexFilepath) && annIndex.Load(annIndexFilepath);
+	if (useAnnIndex && (annIndex.GetCount() != gallery.GetCount() || annIndex.GetGalleryChecksum() != gallery.GetChecksum()))
 	{
-		const auto current = std::chrono::steady_clock::now();
-		const auto lastRunMsElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(current - lastUpdated).count();
-		if (lastRunMsElapsed < msBetweenFrames)
-			continue;
-
-		lastUpdated = std::chrono::steady_clock::now();
-
-		const auto begin = std::chrono::steady_clock::now();
-		faces = detector.Detect(image, detectionThreshold, overlapThreshold);
-		const auto end = std::chrono::steady_clock::now();
-		const auto msElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
-		runTimes.emplace_back((int)msElapsed);
-
-		testsRun++;
+		std::cout << "ANN index " << annIndexFilepath << " was built from another gallery, rebuild it with --build-ann" << std::endl;
+		useAnnIndex = false;
 	}
 
-	const long minTime = *std::min_element(runTimes.begin(), runTimes.end());
-	const long maxTime = *std::max_element(runTimes.begin(), runTimes.end());
-	const float avgTime = std::accumulate(runTimes.begin(), runTimes.end(), 0) / (float)numTests;
-	const float potentialFps = 1000.0f / avgTime;
-
-	std::cout << "finished RetinaFace performance test:" << std::endl;
-	std::cout << "image size: " << image.cols << "x" << image.rows << std::endl;
-	std::cout << "face count: " << faces.size() << std::endl;
-	std::cout << "min detection time: " << minTime << " ms" << std::endl;
-	std::cout << "max detection time: " << maxTime << " ms" << std::endl;
-	std::cout << "avg detection time: " << avgTime << " ms" << " (fps=" << potentialFps << ")" << std::endl;
-	std::cout << std::endl;
-}
-
-void NormalizationPerformanceTest(const cv::Mat& image, const ArcFaceNormalizer& normalizer, const std::vector<Face>& faces)
-{
-	std::cout << "starting normalization performance test..." << std::endl;
-
-	const int numTests = 100;
-	std::vector<int> runTimes;
-	runTimes.reserve(numTests);
-
-	auto lastUpdated = std::chrono::steady_clock::now();
-	int testsRun = 0;
-	const int emulatedFps = 30;
-	const float msBetweenFrames = 1000 / emulatedFps;
-
-	std::vector<cv::Mat> normalizedFaces;
-	normalizedFaces.reserve(500);
+	Ort::Env env(OrtLoggingLevel::ORT_LOGGING_LEVEL_WARNING, "inference");
 
-	while (testsRun < numTests)
+	FacePipelineConfig pipelineConfig;
+	pipelineConfig.detectorModelFilepath = detectorModelFilepath;
+	pipelineConfig.indexerModelFilepath = indexerModelFilepath;
+	pipelineConfig.genderAgeModelFilepath = genderAgeModelFilepath;
+	pipelineConfig.detectionThreshold = detectionThreshold;
+	pipelineConfig.overlapThreshold = overlapThreshold;
+	pipelineConfig.comparisonThreshold = comparisonThreshold;
+	pipelineConfig.maxIndexingBatchSize = maxIndexingBatchSize;
+	pipelineConfig.maxAttributeBatchSize = maxAttributeBatchSize;
+	pipelineConfig.inferenceOptions = inferenceOptions;
+
+	// stream mode: --streams [--metrics <Prometheus text file>] [--trace <Chrome trace file>] <video file, URL or camera index>...
+	if (argc >= 3 && std::string(argv[1]) == "--streams")
 	{
-		const auto current = std::chrono::steady_clock::now();
-		const auto lastRunMsElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(current - lastUpdated).count();
-		if (lastRunMsElapsed < msBetweenFrames)
-			continue;
-
-		lastUpdated = std::chrono::steady_clock::now();
+		std::vector<std::string> sources;
+		std::string metricsFilepath;
+		std::string traceFilepath;
+		for (int i = 2; i < argc; i++)
+		{
+			const std::string argument = argv[i];
+			if (argument == "--metrics" && i + 1 < argc)
+				metricsFilepath = argv[++i];
+			else if (argument == "--trace" && i + 1 < argc)
+				traceFilepath = argv[++i];
+			else
+				sources.emplace_back(argument);
+		}
 
-		const auto begin = std::chrono::steady_clock::now();
-		normalizedFaces = normalizer.GetNormalizedFaces(image, faces);
-		const auto end = std::chrono::steady_clock::now();
-		const auto msElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
-		runTimes.emplace_back((int)msElapsed);
+		return ProcessStreams(env, pipelineConfig, gallery, sources, metricsFilepath, traceFilepath);
+	}
 
-		testsRun++;
+	// single image mode only detects, indexes and matches; timings and configuration comparisons are in CppBenchmark
+#ifdef NDEBUG
+	if (argc < 2)
+	{
+		std::cout << "image name not provided" << std::endl;
+		return -1;
 	}
 
-	const long minTime = *std::min_element(runTimes.begin(), runTimes.end());
-	const long maxTime = *std::max_element(runTimes.begin(), runTimes.end());
-	const float avgTime = std::accumulate(runTimes.begin(), runTimes.end(), 0) / (float)numTests;
-	const float potentialFps = 1000.0f / avgTime;
-
-	std::cout << "finished normalization performance test:" << std::endl;
-	std::cout << "image size: " << image.cols << "x" << image.rows << std::endl;
-	std::cout << "face count: " << normalizedFaces.size() << std::endl;
-	std::cout << "min normalization time: " << minTime << " ms" << std::endl;
-	std::cout << "max normalization time: " << maxTime << " ms" << std::endl;
-	std::cout << "avg normalization time: " << avgTime << " ms" << " (fps=" << potentialFps << ")" << std::endl;
+	const std::string& imageFilepath = argv[1];
+	std::cout << "image name: " << imageFilepath << std::endl;
 	std::cout << std::endl;
-}
+#else
+	std::string imageFilepath = "images/sh.jpg";
+#endif
 
-void IndexingPerformanceTest(ArcFace50Indexer& indexer, const std::vector<Face>& faces)
-{
-	std::cout << "starting indexing performance test..." << std::endl;
+	const cv::Mat& image = cv::imread(imageFilepath);
 
-	const int numTests = 100;
-	std::vector<int> runTimes;
-	runTimes.reserve(numTests);
+	// the sessions load independently, so startup waits for the slowest model instead of the sum of all three
+	const auto loadBegin = std::chrono::steady_clock::now();
+	std::future<std::unique_ptr<RetinaFaceDetector>> detectorLoad = std::async(std::launch::async, [&]()
+	{
+		return std::unique_ptr<RetinaFaceDetector>(new RetinaFaceDetector(env, detectorModelFilepath, NmsMethod::Auto, 1,
+			{ pipelineConfig.detectionInputSize }, inferenceOptions));
+	});
+	std::future<std::unique_ptr<ArcFace50Indexer>> indexerLoad = std::async(std::launch::async, [&]()
+	{
+		return std::unique_ptr<ArcFace50Indexer>(new ArcFace50Indexer(env, indexerModelFilepath, maxIndexingBatchSize, inferenceOptions));
+	});
+	std::future<std::unique_ptr<GenderAgeAnalyzer>> genderAgeAnalyzerLoad = std::async(std::launch::async, [&]()
+	{
+		return std::unique_ptr<GenderAgeAnalyzer>(new GenderAgeAnalyzer(env, genderAgeModelFilepath, maxAttributeBatchSize,
+			inferenceOptions));
+	});
 
-	auto lastUpdated = std::chrono::steady_clock::now();
-	int testsRun = 0;
-	const int emulatedFps = 30;
-	const float msBetweenFrames = 1000 / emulatedFps;
+	const std::unique_ptr<RetinaFaceDetector> detectorInstance = detectorLoad.get();
+	const std::unique_ptr<ArcFace50Indexer> indexerInstance = indexerLoad.get();
+	const std::unique_ptr<GenderAgeAnalyzer> genderAgeAnalyzerInstance = genderAgeAnalyzerLoad.get();
+	RetinaFaceDetector& detector = *detectorInstance;
+	ArcFace50Indexer& indexer = *indexerInstance;
+	GenderAgeAnalyzer& genderAgeAnalyzer = *genderAgeAnalyzerInstance;
 
-	FaceIndex index;
+	const auto loadEnd = std::chrono::steady_clock::now();
+	std::cout << "models loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(loadEnd - loadBegin).count() << " ms"
+		<< std::endl;
 
-	int i = 0;
+	std::vector<Face> faces = detector.Detect(image, detectionThreshold, overlapThreshold);
 
-	while (testsRun < numTests)
-	{
-		const auto current = std::chrono::steady_clock::now();
-		const auto lastRunMsElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(current - lastUpdated).count();
-		if (lastRunMsElapsed < msBetweenFrames)
-			continue;
+	// crowded frames are normalized and matched face-parallel, indexing and attributes run as batches
+	ThreadPool threadPool;
+	const ArcFaceNormalizer normalizer(&threadPool);
+	const std::vector<cv::Mat>& normalizedFaces = normalizer.GetAlignedFaces(image, faces, arcFaceTargetSize);
 
-		lastUpdated = std::chrono::steady_clock::now();
+	// both models read the same crops and own their sessions, so the attribute batch runs while the faces are indexed
+	std::future<std::vector<GenderAgeAttributes>> attributesRun = std::async(std::launch::async, [&genderAgeAnalyzer, &normalizedFaces]()
+	{
+		return genderAgeAnalyzer.GetAttributes(normalizedFaces);
+	});
 
-		if (i == faces.size())
-			i = 0;
+	IndexFaces(indexer, faces, normalizedFaces);
 
-		const auto begin = std::chrono::steady_clock::now();
-		index = indexer.GetIndex(faces[i].normImage);
-		const auto end = std::chrono::steady_clock::now();
-		const auto msElapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
-		runTimes.emplace_back((int)msElapsed);
+	FillAttributes(faces, attributesRun.get());
 
-		testsRun++;
-		i++;
-	}
+	GallerySearcher searcher(gallery, &threadPool);
+	CompareFaces(searcher, useAnnIndex ? &annIndex : nullptr, faces, gallery, comparisonThreshold);
 
-	const long minTime = *std::min_element(runTimes.begin(), runTimes.end());
-	const long maxTime = *std::max_element(runTimes.begin(), runTimes.end());
-	const float avgTime = std::accumulate(runTimes.begin(), runTimes.end(), 0) / (float)numTests;
-	const float potentialFps = 1000.0f / avgTime;
+	const fs::path imagePath(imageFilepath);
+	const std::string& faceFolderName = "faces";
+	Utils::CreateDirectory(faceFolderName);
+	const std::string& imageFacesFolder = faceFolderName + "/" + imagePath.stem().string();
+	Utils::CreateDirectory(imageFacesFolder, true);
 
-	std::cout << "finished indexing performance test:" << std::endl;
-	std::cout << "face count: " << faces.size() << std::endl;
-	std::cout << "min indexing time: " << minTime << " ms" << std::endl;
-	std::cout << "max indexing time: " << maxTime << " ms" << std::endl;
-	std::cout << "avg indexing time: " << avgTime << " ms" << " (fps=" << potentialFps << ")" << std::endl;
-	std::cout << std::endl;
+	DrawFaces(image, faces, imagePath, imageFacesFolder);
+	SaveNormalizationResult(normalizedFaces, imagePath, imageFacesFolder);
+	SaveIndexingResult(faces, imageFacesFolder);
 }
 
 void DrawFaces(const cv::Mat& image, const std::vector<Face>& faces,
@@ -261,11 +220,8 @@ void SaveNormalizationResult(const std::vector<cv::Mat>& normalizedFaces, const
 
 	for (int i = 0; i < normalizedFaces.size(); i++)
 	{
-		const cv::Size dstSize(112, 112);
-		cv::Mat finalImage;
-		cv::resize(normalizedFaces[i], finalImage, dstSize);
 		const std::string& finalFaceImagePath = normFacesFolderName + "/" + std::to_string(i) + "_norm" + ext;
-		cv::imwrite(finalFaceImagePath, finalImage);
+		cv::imwrite(finalFaceImagePath, normalizedFaces[i]);
 	}
 }
 
@@ -331,59 +287,357 @@ std::map<std::string, FaceIndex> ReadDataBaseFromFile(const std::string& databas
 	return databaseMap;
 }
 
-void IndexFaces(ArcFace50Indexer& indexer, std::vector<Face>& faces, const std::vector<cv::Mat>& normalizedFaces,
-	const cv::Size& arcFaceTargetSize)
+void SplitDatabase(const std::map<std::string, FaceIndex>& database, std::vector<std::string>* labels, std::vector<FaceIndex>* indexes)
 {
-	for (int i = 0; i < faces.size(); i++)
+	labels->reserve(database.size());
+	indexes->reserve(database.size());
+	for (auto const& entry : database)
 	{
-		cv::Mat scaledNormImage;
-		cv::resize(normalizedFaces[i], scaledNormImage, arcFaceTargetSize);
-		faces[i].normImage = scaledNormImage;
-		faces[i].index = indexer.GetIndex(scaledNormImage);
+		labels->emplace_back(entry.first);
+		indexes->emplace_back(entry.second);
 	}
 }
 
-void CompareFaces(const FaceComparer& comparer, std::vector<Face>& faces, const std::map<std::string, FaceIndex>& database,
-	const int indexSize, const float comparisonThreshold)
+FaceGallery LoadGallery(const std::string& galleryFilepath, const std::string& databasePath, const int indexSize)
 {
-	for (int i = 0; i < faces.size(); i++)
+	FaceGallery gallery;
+	EmbeddingType type = EmbeddingType::Float32;
+
+	if (fs::exists(galleryFilepath) && gallery.Load(galleryFilepath))
 	{
-		float maxSimilarity = -1.5f;
-		std::string maxSimilarName;
-		bool matched = false;
+		std::cout << "faces in gallery: " << gallery.GetCount() << std::endl;
+		if (!IsGalleryStale(galleryFilepath, databasePath))
+			return gallery;
 
-		for (auto const& entry : database)
-		{
-			const FaceIndex& currentIndex = faces[i].index;
+		type = gallery.GetEmbeddingType();
+	}
 
-			const std::string& name = entry.first;
-			const FaceIndex& index = entry.second;
+	// first start or changed database: convert the text database, later starts only map the file
+	std::vector<std::string> labels;
+	std::vector<FaceIndex> indexes;
+	SplitDatabase(ReadDataBaseFromFile(databasePath, indexSize), &labels, &indexes);
 
-			const float similarity = comparer.GetCosineSimilarity(index, currentIndex);
-			if (similarity > comparisonThreshold && similarity > maxSimilarity)
-			{
-				matched = true;
-				maxSimilarity = similarity;
-				maxSimilarName = name;
-				std::cout << "face " << i << " is similar to " << name << " with value of " << similarity << std::endl;
-			}
+	// entries appended from other folders (--append-gallery) would be lost by a rebuild
+	if (gallery.GetCount() > labels.size())
+	{
+		std::cout << "gallery " << galleryFilepath << " is older than database " << databasePath << " but has entries the database lacks, "
+			<< "keeping it; rebuild it with --build-gallery to pick up the database changes" << std::endl;
+		return gallery;
+	}
+
+	if (!gallery.IsEmpty())
+		std::cout << "gallery " << galleryFilepath << " is older than database " << databasePath << ", rebuilding it" << std::endl;
+
+	// the mapping has to be released before the file is written again
+	gallery = FaceGallery();
+	gallery.Build(labels, indexes, indexSize, type);
+	if (!gallery.IsEmpty())
+		gallery.Save(galleryFilepath);
+
+	return gallery;
+}
+
+// the database changed after the gallery was written when any file or folder in it is newer than the gallery file
+bool IsGalleryStale(const std::string& galleryFilepath, const std::string& databasePath)
+{
+	if (!fs::exists(databasePath))
+		return false;
+
+	const fs::file_time_type galleryTime = fs::last_write_time(galleryFilepath);
+	if (fs::last_write_time(databasePath) > galleryTime)
+		return true;
+
+	for (const auto& dirEntry : fs::recursive_directory_iterator(databasePath))
+	{
+		if (fs::last_write_time(dirEntry.path()) > galleryTime)
+			return true;
+	}
+
+	return false;
+}
+
+int BuildGallery(const std::string& databasePath, const std::string& galleryFilepath, const int indexSize, const EmbeddingType type)
+{
+	std::vector<std::string> labels;
+	std::vector<FaceIndex> indexes;
+	SplitDatabase(ReadDataBaseFromFile(databasePath, indexSize), &labels, &indexes);
+
+	FaceGallery gallery;
+	gallery.Build(labels, indexes, indexSize, type);
+	if (!gallery.Save(galleryFilepath))
+		return -1;
+
+	std::cout << "gallery " << galleryFilepath << " written with " << gallery.GetCount() << " faces" << std::endl;
+
+	return 0;
+}
+
+int AppendGallery(const std::string& galleryFilepath, const std::string& databasePath, const int indexSize)
+{
+	std::vector<std::string> labels;
+	std::vector<FaceIndex> indexes;
+	SplitDatabase(ReadDataBaseFromFile(databasePath, indexSize), &labels, &indexes);
+
+	if (!FaceGallery::Append(galleryFilepath, labels, indexes))
+		return -1;
+
+	std::cout << labels.size() << " faces appended to gallery " << galleryFilepath << std::endl;
+
+	return 0;
+}
+
+int BuildAnnIndex(const std::string& galleryFilepath, const std::string& annIndexFilepath)
+{
+	FaceGallery gallery;
+	if (!gallery.Load(galleryFilepath))
+		return -1;
+
+	HnswIndex annIndex(gallery.GetDimension());
+	annIndex.Build(gallery);
+	if (!annIndex.Save(annIndexFilepath))
+		return -1;
+
+	std::cout << "ANN index " << annIndexFilepath << " written with " << annIndex.GetCount() << " entries" << std::endl;
+
+	return 0;
+}
+
+// every fifth identity of the database is held out as a probe
+int ReportQuantizationAccuracy(const std::string& databasePath, const int indexSize)
+{
+	const std::map<std::string, FaceIndex>& database = ReadDataBaseFromFile(databasePath, indexSize);
+
+	std::vector<FaceIndex> indexes;
+	std::vector<FaceIndex> heldOutProbes;
+	int entryNumber = 0;
+	for (auto const& entry : database)
+	{
+		if (entryNumber++ % 5 == 4)
+			heldOutProbes.emplace_back(entry.second);
+		else
+			indexes.emplace_back(entry.second);
+	}
+
+	QuantizationAccuracyReport(indexes, heldOutProbes, indexSize);
+
+	return 0;
+}
+
+int ProcessStreams(Ort::Env& env, const FacePipelineConfig& pipelineConfig, const FaceGallery& gallery,
+	const std::vector<std::string>& sources, const std::string& metricsFilepath, const std::string& traceFilepath)
+{
+	std::cout << "processing " << sources.size() << " streams..." << std::endl;
+
+	// frames of different streams are detected together, one detection worker per stream keeps the batches full
+	FacePipelineConfig streamPipelineConfig = pipelineConfig;
+	streamPipelineConfig.detectionBatchSize = std::min((int)sources.size(), 4);
+	streamPipelineConfig.detectionWorkerCount = streamPipelineConfig.detectionBatchSize;
+	streamPipelineConfig.enableTracking = true;
+
+	std::mutex outputMutex;
+	StreamIngestor ingestor(env, streamPipelineConfig, gallery, sources, [&outputMutex](std::unique_ptr<PipelineFrame> frame)
+	{
+		if (frame->failed)
+			return;
+
+		std::lock_guard<std::mutex> lock(outputMutex);
+		for (const Face& face : frame->faces)
+		{
+			if (!face.label.empty())
+				std::cout << "stream " << frame->streamId << ", frame " << frame->id << ": " << face.label << " (" << face.similarity << ")" << std::endl;
 		}
+	});
+
+	if (!ingestor.Start())
+		return -1;
+
+	if (!traceFilepath.empty())
+		Metrics::Get().StartTrace(traceFilepath);
+
+	bool allFinished = false;
+	while (!allFinished)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+
+		if (!metricsFilepath.empty())
+			WriteMetrics(metricsFilepath);
 
-		if (matched)
+		allFinished = true;
+		for (const StreamStats& stats : ingestor.GetStreamStats())
+			allFinished &= stats.finished;
+	}
+
+	ingestor.WaitForStreams();
+
+	if (!traceFilepath.empty())
+		Metrics::Get().StopTrace();
+	if (!metricsFilepath.empty())
+		WriteMetrics(metricsFilepath);
+
+	std::lock_guard<std::mutex> lock(outputMutex);
+	std::cout << "finished processing streams:" << std::endl;
+	for (const StreamStats& stats : ingestor.GetStreamStats())
+	{
+		std::cout << stats.source << ": decoded " << stats.decodedFrames << ", processed " << stats.completedFrames
+			<< ", skipped " << stats.skippedFrames << std::endl;
+	}
+
+	const FacePipelineStats& pipelineStats = ingestor.GetPipelineStats();
+	std::cout << "faces detected: " << pipelineStats.detectedFaces << ", recognized: " << pipelineStats.recognizedFaces << std::endl;
+	std::cout << "metrics: " << Metrics::ToJson(Metrics::Get().GetSnapshot()) << std::endl;
+
+	return 0;
+}
+
+// replaced as a whole, so a scraper (e.g. the node_exporter textfile collector) never reads a partial file
+void WriteMetrics(const std::string& metricsFilepath)
+{
+	const std::string& temporaryFilepath = metricsFilepath + ".tmp";
+	{
+		std::ofstream file(temporaryFilepath);
+		file << Metrics::ToPrometheusText(Metrics::Get().GetSnapshot());
+		if (!file.good())
 		{
-			std::cout << "face " << i << " matches best with entry " << maxSimilarName << " with similarity of " << maxSimilarity << std::endl;
-			faces[i].label = maxSimilarName;
-			faces[i].similarity = maxSimilarity;
+			std::cout << "failed to write metrics to " << temporaryFilepath << std::endl;
+			return;
 		}
 	}
+
+	if (!AtomicFile::Replace(temporaryFilepath, metricsFilepath))
+		std::cout << "failed to replace " << metricsFilepath << std::endl;
 }
 
-void FillAttributes(GenderAgeAnalyzer& analyzer, std::vector<Face>& faces)
+void IndexFaces(ArcFace50Indexer& indexer, std::vector<Face>& faces, const std::vector<cv::Mat>& normalizedFaces)
 {
 	for (int i = 0; i < faces.size(); i++)
+		faces[i].normImage = normalizedFaces[i];
+
+	std::vector<FaceIndex> indexes = indexer.GetIndexes(normalizedFaces);
+	for (int i = 0; i < faces.size(); i++)
+		faces[i].index = std::move(indexes[i]);
+}
+
+void CompareFaces(GallerySearcher& searcher, HnswIndex* annIndex, std::vector<Face>& faces, const FaceGallery& gallery,
+	const float comparisonThreshold)
+{
+	const int maxMatchCount = 5;
+
+	std::vector<FaceIndex> probes;
+	probes.reserve(faces.size());
+	for (const Face& face : faces)
+		probes.emplace_back(face.index);
+
+	// the exhaustive search matches all faces of the frame in one parallel pass, the ANN index answers them one by one;
+	// entries below the threshold are pruned during the search in both cases
+	std::vector<std::vector<GalleryMatch>> matches;
+	if (annIndex == nullptr)
+		matches = searcher.Search(probes, maxMatchCount, comparisonThreshold);
+	else
 	{
-		const GenderAgeAttributes& attributes = analyzer.GetAttributes(faces[i].normImage);
-		faces[i].gender = attributes.first;
-		faces[i].age = attributes.second;
+		for (const FaceIndex& probe : probes)
+			matches.emplace_back(annIndex->Search(probe, maxMatchCount, comparisonThreshold));
+	}
+
+	for (int i = 0; i < faces.size(); i++)
+	{
+		for (const GalleryMatch& match : matches[i])
+			std::cout << "face " << i << " is similar to " << gallery.GetLabel(match.row) << " with value of " << match.similarity << std::endl;
+
+		if (matches[i].empty())
+			continue;
+
+		const GalleryMatch& bestMatch = matches[i][0];
+		const std::string& bestMatchName = gallery.GetLabel(bestMatch.row);
+		std::cout << "face " << i << " matches best with entry " << bestMatchName << " with similarity of " << bestMatch.similarity << std::endl;
+		faces[i].label = bestMatchName;
+		faces[i].similarity = bestMatch.similarity;
+	}
+}
+
+void FillAttributes(std::vector<Face>& faces, const std::vector<GenderAgeAttributes>& attributes)
+{
+	for (int i = 0; i < faces.size(); i++)
+	{
+		faces[i].gender = attributes[i].first;
+		faces[i].age = attributes[i].second;
+	}
+}
+
+// compares fp16 and int8 galleries with float32 on held-out probes: memory, scan time, score error and ranking agreement
+void QuantizationAccuracyReport(const std::vector<FaceIndex>& indexes, const std::vector<FaceIndex>& heldOutProbes, const int indexSize)
+{
+	const int maxMatchCount = std::min(10, (int)indexes.size());
+	const int probeCount = (int)heldOutProbes.size();
+	if (maxMatchCount == 0 || probeCount == 0)
+	{
+		std::cout << "not enough entries for a quantization report" << std::endl;
+		return;
+	}
+
+	const std::vector<std::string> labels(indexes.size());
+
+	FaceGallery referenceGallery;
+	referenceGallery.Build(labels, indexes, indexSize);
+	GallerySearcher referenceSearcher(referenceGallery);
+
+	std::vector<std::vector<GalleryMatch>> referenceMatches(probeCount);
+	float referenceTime = 0;
+	for (int i = 0; i < probeCount; i++)
+	{
+		const auto begin = std::chrono::steady_clock::now();
+		referenceMatches[i] = referenceSearcher.Search(heldOutProbes[i], maxMatchCount);
+		const auto end = std::chrono::steady_clock::now();
+		referenceTime += std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+	}
+
+	std::cout << "gallery size: " << indexes.size() << "x" << indexSize << ", held-out probes: " << probeCount << std::endl;
+	std::cout << "float32: " << referenceGallery.GetRowStride() << " bytes per identity, avg scan time " << referenceTime / probeCount
+		<< " us" << std::endl;
+
+	const std::pair<EmbeddingType, std::string> types[] = { { EmbeddingType::Float16, "fp16" }, { EmbeddingType::Int8, "int8" } };
+	for (const auto& type : types)
+	{
+		FaceGallery gallery;
+		gallery.Build(labels, indexes, indexSize, type.first);
+		GallerySearcher searcher(gallery);
+
+		// similarities of the float32 top-k rows computed from the quantized rows
+		FaceIndex probe(indexSize);
+		FaceIndex row(indexSize);
+		float maxError = 0;
+		float errorSum = 0;
+		int errorCount = 0;
+		int top1Count = 0;
+		int foundCount = 0;
+		float time = 0;
+
+		for (int i = 0; i < probeCount; i++)
+		{
+			const auto begin = std::chrono::steady_clock::now();
+			const std::vector<GalleryMatch>& matches = searcher.Search(heldOutProbes[i], maxMatchCount);
+			const auto end = std::chrono::steady_clock::now();
+			time += std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+
+			top1Count += !matches.empty() && matches[0].row == referenceMatches[i][0].row;
+			for (const GalleryMatch& match : matches)
+			{
+				for (const GalleryMatch& referenceMatch : referenceMatches[i])
+				{
+					if (match.row != referenceMatch.row)
+						continue;
+
+					const float error = std::abs(match.similarity - referenceMatch.similarity);
+					maxError = std::max(maxError, error);
+					errorSum += error;
+					errorCount++;
+					foundCount++;
+				}
+			}
+		}
+
+		std::cout << type.second << ": " << gallery.GetRowStride() << " bytes per identity, avg scan time " << time / probeCount << " us"
+			<< ", top-1 agreement " << (float)top1Count / probeCount << ", recall@" << maxMatchCount << " "
+			<< (float)foundCount / (probeCount * maxMatchCount) << ", similarity error avg " << (errorCount > 0 ? errorSum / errorCount : 0)
+			<< " max " << maxError << std::endl;
 	}
 }
\ No newline at end of file
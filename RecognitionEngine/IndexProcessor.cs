@@ -1,7 +1,10 @@
 ﻿using Primitives.Logging;
 using RecognitionPrimitives;
 using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
+using System.Linq;
+using System.Threading.Tasks;
 
 namespace RecognitionEngine
 {
@@ -26,17 +29,54 @@ namespace RecognitionEngine
 		public IReadOnlyList<(Guid, float)> MatchOneToManyWithThreshold(IFaceIndex index, Dictionary<Guid, IFaceIndex> listToMatch,
 			float threshold)
 		{
-			var results = new List<(Guid, float)>();
-			foreach (var indexToMatch in listToMatch)
+			return MatchManyToManyWithThreshold(new[] { index }, listToMatch, threshold)[0];
+		}
+
+		// Matches all probes in one parallel pass: the gallery is split into shards, every shard keeps its own
+		// per-probe top lists and those are merged at the end. Results are sorted by similarity, best first.
+		public IReadOnlyList<IReadOnlyList<(Guid, float)>> MatchManyToManyWithThreshold(IReadOnlyList<IFaceIndex> indexes,
+			Dictionary<Guid, IFaceIndex> listToMatch, float threshold, int maxMatchCount = int.MaxValue)
+		{
+			var entries = listToMatch.ToArray();
+			var mergedResults = new List<(Guid, float)>[indexes.Count];
+			for (var i = 0; i < indexes.Count; i++)
+				mergedResults[i] = new List<(Guid, float)>();
+
+			if (entries.Length == 0)
+				return mergedResults;
+
+			var shardSize = Math.Max((entries.Length + Environment.ProcessorCount - 1) / Environment.ProcessorCount, 1);
+			var mergeLock = new object();
+
+			Parallel.ForEach(Partitioner.Create(0, entries.Length, shardSize), shard =>
 			{
-				var similarity = GetIndexSimilarity(index, indexToMatch.Value);
-				if (similarity < threshold)
-					continue;
+				var shardResults = new List<(Guid, float)>[indexes.Count];
+				for (var i = 0; i < indexes.Count; i++)
+				{
+					shardResults[i] = new List<(Guid, float)>();
+					for (var j = shard.Item1; j < shard.Item2; j++)
+					{
+						var similarity = GetIndexSimilarity(indexes[i], entries[j].Value);
+						if (similarity < threshold)
+							continue;
 
-				results.Add((indexToMatch.Key, similarity));
-			}
+						shardResults[i].Add((entries[j].Key, similarity));
+					}
 
-			return results;
+					TrimToBest(shardResults[i], maxMatchCount);
+				}
+
+				lock (mergeLock)
+				{
+					for (var i = 0; i < indexes.Count; i++)
+						mergedResults[i].AddRange(shardResults[i]);
+				}
+			});
+
+			foreach (var results in mergedResults)
+				TrimToBest(results, maxMatchCount);
+
+			return mergedResults;
 		}
 
 		public IReadOnlyList<float> MatchToMany(IFaceIndex index, IReadOnlyList<IFaceIndex> listToMatch)
@@ -52,6 +92,13 @@ namespace RecognitionEngine
 			return results;
 		}
 
+		private static void TrimToBest(List<(Guid, float)> results, int maxMatchCount)
+		{
+			results.Sort((r1, r2) => r2.Item2.CompareTo(r1.Item2));
+			if (results.Count > maxMatchCount)
+				results.RemoveRange(maxMatchCount, results.Count - maxMatchCount);
+		}
+
 		private float GetIndexSimilarity(IFaceIndex index1, IFaceIndex index2)
 		{
 			if (index1.Version != index2.Version)